@@ -0,0 +1,322 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <string>
+#include "Bundle.h"
+#include "Logger.h"
+
+const char Bundle::MAGIC[8] = {'I', 'C', 'S', 'P', 'B', 'D', 'L', '1'};
+const uint32_t Bundle::ROW_WORDS;
+
+Bundle::Bundle() {
+    mapping = NULL;
+    mapping_size = 0;
+    header = NULL;
+    bitmap = NULL;
+    rows = NULL;
+    words = NULL;
+}
+
+Bundle::~Bundle() {
+    release();
+}
+
+void Bundle::release() {
+    if (mapping != NULL) {
+        munmap(mapping, mapping_size);
+        mapping = NULL;
+        mapping_size = 0;
+    }
+}
+
+uint16_t Bundle::crc(uint16_t crc, const uint32_t *instructions, uint32_t count) {
+    // CRC-16/CCITT over the three bytes of each instruction (LSB first)
+    for (uint32_t i = 0; i < count; i++) {
+        for (int byte = 0; byte < 3; byte++) {
+            crc ^= (uint16_t) (((instructions[i] >> (8 * byte)) & 0xffu) << 8);
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (uint16_t) (crc & 0x8000u ? (crc << 1) ^ 0x1021u : crc << 1);
+            }
+        }
+    }
+    return crc;
+}
+
+void Bundle::pack(const uint32_t *instructions, uint16_t *words) {
+    for (uint32_t i = 0; i < MemoryImage::ROW_SIZE; i += 2, words += 3) {
+        words[0] = (uint16_t) (instructions[i] & 0xffffu);
+        words[1] = (uint16_t) (((instructions[i + 1] >> 8) & 0xff00u) | ((instructions[i] >> 16) & 0xffu));
+        words[2] = (uint16_t) (instructions[i + 1] & 0xffffu);
+    }
+}
+
+void Bundle::digest(const uint32_t *instructions, uint32_t count, uint32_t &sum, uint32_t &weighted_sum) {
+    sum = 0;
+    weighted_sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        sum += instructions[i];
+        weighted_sum += sum;
+    }
+}
+
+uint32_t Bundle::code_limit(const DEVICE &device) {
+    // Rows of the bundle are written as part of the rows of the device (and vice versa)
+    uint32_t row_size = 2 * (device.ROW_SIZE > MemoryImage::ROW_SIZE ? device.ROW_SIZE : MemoryImage::ROW_SIZE);
+    return device.CONFIG_WORDS_START_ADDR - (device.CONFIG_WORDS_START_ADDR % row_size);
+}
+
+void Bundle::build(const MemoryImage &image, const DEVICE &device) {
+    uint32_t upper_memory_limit = code_limit(device);
+    std::vector<uint32_t> row_addresses;
+    image.get_rows(row_addresses, 0, upper_memory_limit);
+
+    std::vector<uint32_t> other_rows;
+    std::vector<MemoryWord> other_words;
+    image.get_rows(other_rows, upper_memory_limit);
+    for (size_t i = 0; i < other_rows.size(); i++) {
+        for (uint32_t address = other_rows[i]; address < other_rows[i] + 2 * MemoryImage::ROW_SIZE; address++) {
+            if (!image.has_word(address)) {
+                continue;
+            }
+            if (address < device.CONFIG_WORDS_START_ADDR) {
+                Logger::log("PIC24F",
+                            "Warning: Cannot program at 0x%06x! This is within the row of the config registers! Verification will most probably fail.",
+                            address);
+            }
+            MemoryWord word;
+            word.address = address;
+            word.data = image.get_word(address);
+            other_words.push_back(word);
+        }
+    }
+
+    build(image, row_addresses, other_words, device.NAME, 1);
+}
+
+void Bundle::build(const MemoryImage &image, uint32_t from, uint32_t to) {
+    std::vector<uint32_t> row_addresses;
+    image.get_rows(row_addresses, from, to);
+    build(image, row_addresses, std::vector<MemoryWord>(), "", 0);
+}
+
+void Bundle::build(const MemoryImage &image, const std::vector<uint32_t> &row_addresses,
+                   const std::vector<MemoryWord> &other_words, const char *device, int image_crc) {
+    uint32_t row_size = 2 * MemoryImage::ROW_SIZE;
+    uint32_t first_row = row_addresses.empty() ? 0 : row_addresses.front() / row_size;
+    uint32_t bitmap_size = row_addresses.empty() ? 0 : (row_addresses.back() / row_size - first_row) / 32 + 1;
+    size_t size = sizeof(Header) + bitmap_size * sizeof(uint32_t) + row_addresses.size() * sizeof(Row) +
+                  other_words.size() * sizeof(MemoryWord);
+
+    release();
+    buffer.assign(size, 0);
+    Header *new_header = (Header *) &buffer[0];
+    uint32_t *new_bitmap = (uint32_t *) (new_header + 1);
+    Row *new_rows = (Row *) (new_bitmap + bitmap_size);
+    MemoryWord *new_words = (MemoryWord *) (new_rows + row_addresses.size());
+
+    memcpy(new_header->magic, MAGIC, sizeof(new_header->magic));
+    new_header->version = VERSION;
+    new_header->size = (uint32_t) size;
+    new_header->first_row = first_row;
+    new_header->bitmap_size = bitmap_size;
+    new_header->rows = (uint32_t) row_addresses.size();
+    new_header->words = (uint32_t) other_words.size();
+    strncpy(new_header->device, device, sizeof(new_header->device) - 1);
+
+    // The CRC of the image covers everything from address 0, rows which aren't given are erased
+    std::vector<uint32_t> erased(MemoryImage::ROW_SIZE, MemoryImage::ERASED);
+    uint16_t result = 0xffff;
+    uint32_t next = 0;
+    for (size_t i = 0; i < row_addresses.size(); i++) {
+        uint32_t row = row_addresses[i] / row_size - first_row;
+        new_bitmap[row / 32] |= 1u << (row % 32);
+
+        const uint32_t *instructions = image.get_row(row_addresses[i]);
+        Row &target = new_rows[i];
+        digest(instructions, MemoryImage::ROW_SIZE, target.sum, target.weighted_sum);
+        target.crc = crc(0xffff, instructions, MemoryImage::ROW_SIZE);
+        pack(instructions, target.words);
+
+        if (image_crc) {
+            for (; next < row_addresses[i]; next += row_size) {
+                result = crc(result, &erased[0], MemoryImage::ROW_SIZE);
+            }
+            result = crc(result, instructions, MemoryImage::ROW_SIZE);
+            next += row_size;
+        }
+    }
+    new_header->instructions = next / 2;
+    new_header->crc = result;
+
+    for (size_t i = 0; i < other_words.size(); i++) {
+        new_words[i] = other_words[i];
+    }
+
+    attach(&buffer[0], size);
+}
+
+int Bundle::attach(const uint8_t *data, size_t size) {
+    if (size < sizeof(Header)) {
+        return 0;
+    }
+    const Header *new_header = (const Header *) data;
+    uint64_t expected = sizeof(Header) + (uint64_t) new_header->bitmap_size * sizeof(uint32_t) +
+                        (uint64_t) new_header->rows * sizeof(Row) + (uint64_t) new_header->words * sizeof(MemoryWord);
+    if (memcmp(new_header->magic, MAGIC, sizeof(new_header->magic)) != 0 || new_header->version != VERSION ||
+        new_header->size != size || expected != size || new_header->device[sizeof(new_header->device) - 1] != 0) {
+        return 0;
+    }
+
+    header = new_header;
+    bitmap = (const uint32_t *) (header + 1);
+    rows = (const Row *) (bitmap + header->bitmap_size);
+    words = (const MemoryWord *) (rows + header->rows);
+
+    addresses.clear();
+    for (uint32_t i = 0; i < header->bitmap_size; i++) {
+        for (uint32_t bit = 0; bit < 32; bit++) {
+            if (bitmap[i] & (1u << bit)) {
+                addresses.push_back((header->first_row + 32 * i + bit) * 2 * MemoryImage::ROW_SIZE);
+            }
+        }
+    }
+    return addresses.size() == header->rows;
+}
+
+void Bundle::save(const char *name) const {
+    if (header == NULL) {
+        throw std::runtime_error(std::string("Cannot write an empty bundle to ") + name);
+    }
+    FILE *out = fopen(name, "wb");
+    if (out == NULL) {
+        throw std::runtime_error(std::string("Cannot create ") + name);
+    }
+    int ok = fwrite(header, header->size, 1, out) == 1;
+    if (fclose(out) != 0 || !ok) {
+        throw std::runtime_error(std::string("Cannot write ") + name);
+    }
+}
+
+void Bundle::load(const char *name) {
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("Cannot open ") + name);
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        throw std::runtime_error(std::string("Cannot read ") + name);
+    }
+    if ((size_t) info.st_size < sizeof(Header)) {
+        close(fd);
+        throw std::runtime_error(std::string("Not a bundle file: ") + name);
+    }
+
+    void *data = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error(std::string("Cannot map ") + name);
+    }
+
+    release();
+    buffer.clear();
+    mapping = data;
+    mapping_size = (size_t) info.st_size;
+    if (!attach((const uint8_t *) data, mapping_size)) {
+        detach();
+        throw std::runtime_error(std::string("Not a bundle file: ") + name);
+    }
+
+    // The rows are used as they are, so a damaged file must not get any further
+    std::vector<uint32_t> instructions(MemoryImage::ROW_SIZE);
+    for (size_t row = 0; row < addresses.size(); row++) {
+        for (uint32_t i = 0; i < MemoryImage::ROW_SIZE; i++) {
+            instructions[i] = get_instruction(row, i);
+        }
+        uint32_t sum, weighted_sum;
+        digest(&instructions[0], MemoryImage::ROW_SIZE, sum, weighted_sum);
+        if (crc(0xffff, &instructions[0], MemoryImage::ROW_SIZE) != rows[row].crc || sum != rows[row].sum ||
+            weighted_sum != rows[row].weighted_sum) {
+            char address[16];
+            snprintf(address, sizeof(address), "0x%06x", addresses[row]);
+            detach();
+            throw std::runtime_error(std::string("The row at ") + address + " of " + name + " is damaged");
+        }
+    }
+}
+
+void Bundle::detach() {
+    release();
+    header = NULL;
+    bitmap = NULL;
+    rows = NULL;
+    words = NULL;
+    addresses.clear();
+}
+
+int Bundle::is_bundle(const char *name) {
+    char magic[sizeof(MAGIC)];
+    FILE *in = fopen(name, "rb");
+    if (in == NULL) {
+        return 0;
+    }
+    int result = fread(magic, sizeof(magic), 1, in) == 1 && memcmp(magic, MAGIC, sizeof(magic)) == 0;
+    fclose(in);
+    return result;
+}
+
+void Bundle::unpack(MemoryImage &image) const {
+    for (size_t row = 0; row < addresses.size(); row++) {
+        for (uint32_t i = 0; i < MemoryImage::ROW_SIZE; i++) {
+            uint32_t instruction = get_instruction(row, i);
+            image.set_word(addresses[row] + 2 * i, instruction & 0xffffu);
+            image.set_word(addresses[row] + 2 * i + 1, instruction >> 16);
+        }
+    }
+}
+
+const char *Bundle::device_name() const {
+    return header == NULL ? "" : header->device;
+}
+
+size_t Bundle::row_count() const {
+    return addresses.size();
+}
+
+uint32_t Bundle::row_address(size_t row) const {
+    return addresses[row];
+}
+
+const Bundle::Row &Bundle::get_row(size_t row) const {
+    return rows[row];
+}
+
+uint32_t Bundle::get_instruction(size_t row, uint32_t index) const {
+    // Each pair of instructions occupies three words (see pack)
+    const uint16_t *pair = rows[row].words + 3 * (index / 2);
+    if (index % 2 == 0) {
+        return pair[0] | (uint32_t) (pair[1] & 0xffu) << 16;
+    }
+    return pair[2] | (uint32_t) (pair[1] >> 8) << 16;
+}
+
+size_t Bundle::word_count() const {
+    return header == NULL ? 0 : header->words;
+}
+
+const MemoryWord &Bundle::get_word(size_t word) const {
+    return words[word];
+}
+
+uint32_t Bundle::get_instructions() const {
+    return header == NULL ? 0 : header->instructions;
+}
+
+uint16_t Bundle::get_crc() const {
+    // Like the CRC of a bundle without rows
+    return header == NULL ? 0xffff : header->crc;
+}
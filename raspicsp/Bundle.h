@@ -0,0 +1,222 @@
+//
+// Contains a firmware image prepared for a device, so that it can be programmed without parsing a hex file
+//
+
+#ifndef RASPICSP_BUNDLE_H
+#define RASPICSP_BUNDLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "devices.h"
+#include "MemoryImage.h"
+
+/*
+ * Stores the rows of program code already packed into the words sent to the device (the layout used by
+ * the TBLWT sequences as well as by PROGP): each group of four instructions becomes six words, the lower
+ * 16 bits of the first two instructions with their upper bytes in between, then the next two the same way.
+ * For each row, the digest computed by PIC24::target_digest and the CRC computed by the programming
+ * executive are stored as well, so that verifying doesn't need to look at the instructions unless a
+ * row doesn't match.
+ *
+ * All other words given by the hex file (like the config words) are kept as single words.
+ *
+ * A bundle is either built from a memory image or loaded from a file, which is mapped into memory and
+ * used as it is (the file format is the same as the memory layout, using the byte order of the host).
+ * Until then, the bundle is empty: it contains no rows and no words.
+ */
+class Bundle {
+public:
+
+    /*
+     * Contains the number of words of a packed row
+     */
+    static const uint32_t ROW_WORDS = MemoryImage::ROW_SIZE / 4 * 6;
+
+    /*
+     * Describes a row of program code
+     */
+    struct Row {
+        uint32_t sum;
+        uint32_t weighted_sum;
+        uint16_t crc;
+        uint16_t reserved;
+        uint16_t words[ROW_WORDS];
+    };
+
+private:
+
+    /*
+     * Describes the file format, which is followed by the bitmap of the rows present (one bit per row,
+     * starting with first_row), the rows (in ascending order) and the words
+     */
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t size;
+        uint32_t first_row;
+        uint32_t bitmap_size;
+        uint32_t rows;
+        uint32_t words;
+        uint32_t instructions;
+        uint16_t crc;
+        uint16_t reserved;
+        char device[32];
+    };
+
+    static const char MAGIC[8];
+    static const uint32_t VERSION = 2;
+
+    /*
+     * Contains the bundle if it was built (instead of loaded)
+     */
+    std::vector<uint8_t> buffer;
+
+    /*
+     * Contains the mapping of the file if the bundle was loaded
+     */
+    void *mapping;
+    size_t mapping_size;
+
+    const Header *header;
+    const uint32_t *bitmap;
+    const Row *rows;
+    const MemoryWord *words;
+
+    /*
+     * Contains the address of each row (as given by the bitmap)
+     */
+    std::vector<uint32_t> addresses;
+
+    /*
+     * Updates the pointers above for the bundle at the given location. Returns 0 if it isn't valid.
+     */
+    int attach(const uint8_t *data, size_t size);
+
+    /*
+     * Releases the mapping of the file (if any)
+     */
+    void release();
+
+    /*
+     * Releases the mapping and leaves the bundle empty (like a new one)
+     */
+    void detach();
+
+    /*
+     * Builds the bundle from the given rows of the image and the given words. The CRC of the whole
+     * image is only computed if image_crc is set.
+     */
+    void build(const MemoryImage &image, const std::vector<uint32_t> &row_addresses,
+               const std::vector<MemoryWord> &other_words, const char *device, int image_crc);
+
+    /*
+     * Continues the CRC computed by the programming executive over the given instructions
+     */
+    static uint16_t crc(uint16_t crc, const uint32_t *instructions, uint32_t count);
+
+    Bundle(const Bundle &);
+    Bundle &operator=(const Bundle &);
+
+public:
+
+    Bundle();
+    ~Bundle();
+
+    /*
+     * Builds the bundle for the given device from the given image: the rows below the row containing
+     * the config words are stored as code, all other words as they are.
+     */
+    void build(const MemoryImage &image, const DEVICE &device);
+
+    /*
+     * Builds the bundle from all rows of the given image between from (inclusive) and to (exclusive)
+     */
+    void build(const MemoryImage &image, uint32_t from, uint32_t to);
+
+    /*
+     * Writes the bundle to the given file
+     */
+    void save(const char *name) const;
+
+    /*
+     * Loads the bundle stored in the given file. The CRC and the digest of each row are checked against its
+     * instructions.
+     */
+    void load(const char *name);
+
+    /*
+     * Determines if the given file contains a bundle
+     */
+    static int is_bundle(const char *name);
+
+    /*
+     * Stores the instructions of all rows into the given image
+     */
+    void unpack(MemoryImage &image) const;
+
+    /*
+     * Returns the name of the device the bundle was built for
+     */
+    const char *device_name() const;
+
+    /*
+     * Returns the number of rows
+     */
+    size_t row_count() const;
+
+    /*
+     * Returns the address of the given row
+     */
+    uint32_t row_address(size_t row) const;
+
+    /*
+     * Returns the given row
+     */
+    const Row &get_row(size_t row) const;
+
+    /*
+     * Returns the instruction with the given index of the given row
+     */
+    uint32_t get_instruction(size_t row, uint32_t index) const;
+
+    /*
+     * Returns the number of words which are not part of the rows
+     */
+    size_t word_count() const;
+
+    /*
+     * Returns the given word which is not part of the rows (in ascending order of the addresses)
+     */
+    const MemoryWord &get_word(size_t word) const;
+
+    /*
+     * Returns the number of instructions from address 0 to the end of the last row
+     */
+    uint32_t get_instructions() const;
+
+    /*
+     * Returns the CRC of these instructions (erased ones included)
+     */
+    uint16_t get_crc() const;
+
+    /*
+     * Returns the end of the program code of the given device: rows can only be written below the row
+     * containing the config words
+     */
+    static uint32_t code_limit(const DEVICE &device);
+
+    /*
+     * Packs the ROW_SIZE instructions of a row into the ROW_WORDS words sent to the device
+     */
+    static void pack(const uint32_t *instructions, uint16_t *words);
+
+    /*
+     * Computes the digest of the given instructions as computed by PIC24::target_digest: the sum of the
+     * instructions and the sum of all partial sums (both modulo 2^32). The latter weights each instruction
+     * by its distance to the end, so that exchanged instructions are detected as well as changed ones.
+     */
+    static void digest(const uint32_t *instructions, uint32_t count, uint32_t &sum, uint32_t &weighted_sum);
+};
+
+#endif //RASPICSP_BUNDLE_H
@@ -0,0 +1,426 @@
+#include <string.h>
+#include <stdexcept>
+#include <string>
+#include "Capture.h"
+#include "Disassembler.h"
+#include "Logger.h"
+
+const char Capture::MAGIC[8] = {'I', 'C', 'S', 'P', 'C', 'A', 'P', '1'};
+
+/*
+ * Contains the names of the events as printed by decode
+ */
+static const char *EVENT_NAMES[] = {"MCLR", "DELAY", "KEY", "CLOCKS", "SIX", "VISI", "RESULT", "PE_WORD",
+                                    "HANDSHAKE", "MISSING", "PE_READ", "SELECT"};
+
+/*
+ * Keeps track of the current time and of the signal levels while writing a value change dump
+ */
+struct VcdWriter {
+    FILE *out;
+    uint64_t cursor;
+    uint64_t written;
+    uint32_t half_period;
+    std::string levels;
+
+    void set(int signal, char level) {
+        if (levels[signal] == level) {
+            return;
+        }
+        if (written != cursor) {
+            fprintf(out, "#%llu\n", (unsigned long long) cursor);
+            written = cursor;
+        }
+        fprintf(out, "%c%c\n", level, '!' + signal);
+        levels[signal] = level;
+    }
+
+    /*
+     * Generates a clock cycle while PGD is driven with the given level
+     */
+    void write_bit(int bit) {
+        set(1, '1');
+        set(2, bit ? '1' : '0');
+        cursor += half_period;
+        set(1, '0');
+        cursor += half_period;
+    }
+
+    /*
+     * Generates a clock cycle in which the given targets drive the given levels (negative values
+     * are unknown)
+     */
+    void read_bit(const std::vector<int64_t> &values, int word, int bit) {
+        set(1, '1');
+        int targets = (int) levels.size() - 3;
+        for (int target = 0; target < targets; target++) {
+            int64_t value = values[word * targets + target];
+            set(3 + target, value < 0 ? 'x' : ((value >> bit) & 1) ? '1' : '0');
+        }
+        cursor += half_period;
+        set(1, '0');
+        cursor += half_period;
+    }
+};
+
+Capture::Capture(const char *device, uint32_t half_period_ns, int targets, uint32_t capacity) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.half_period_ns = half_period_ns;
+    header.targets = (uint32_t) targets;
+    strncpy(header.device, device, sizeof(header.device) - 1);
+
+    uint32_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    records.resize(size);
+    mask = size - 1;
+    count = 0;
+    start = Delay::now();
+}
+
+Capture::Capture(const char *file) {
+    FILE *in = fopen(file, "rb");
+    if (in == NULL) {
+        throw std::runtime_error(std::string("Cannot open ") + file);
+    }
+
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != VERSION || header.targets < 1 || header.targets > HAL::MAX_TARGETS) {
+        fclose(in);
+        throw std::runtime_error(std::string("Not a capture file: ") + file);
+    }
+    header.device[sizeof(header.device) - 1] = 0;
+
+    records.resize(header.records);
+    size_t read = records.empty() ? 0 : fread(&records[0], sizeof(Record), records.size(), in);
+    fclose(in);
+    if (read != records.size()) {
+        throw std::runtime_error(std::string("Truncated capture file: ") + file);
+    }
+
+    mask = 0;
+    count = records.size();
+    start = 0;
+}
+
+uint64_t Capture::size() const {
+    return count < records.size() ? count : records.size();
+}
+
+const Capture::Record &Capture::get(uint64_t index) const {
+    if (count <= records.size()) {
+        return records[index];
+    }
+    return records[(count + index) & mask];
+}
+
+uint64_t Capture::collect_results(uint64_t index, int words, std::vector<int64_t> &values) const {
+    int targets = (int) header.targets;
+    values.assign(words * targets, -1);
+
+    // Results are recorded word by word, each word in ascending order of the targets
+    int word = 0;
+    int last_target = targets;
+    while (index + 1 < size() && get(index + 1).event == RESULT) {
+        const Record &record = get(++index);
+        if (record.target <= last_target && last_target != targets) {
+            word++;
+        }
+        last_target = record.target;
+        if (word < words && record.target < targets) {
+            values[word * targets + record.target] = record.value;
+        }
+    }
+
+    return index;
+}
+
+void Capture::save(const char *file) {
+    header.records = size();
+    header.dropped = count - header.records;
+
+    FILE *out = fopen(file, "wb");
+    if (out == NULL) {
+        throw std::runtime_error(std::string("Cannot create ") + file);
+    }
+
+    int ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    if (count > records.size()) {
+        // The buffer has wrapped around: the oldest record follows the newest one
+        uint32_t oldest = (uint32_t) (count & mask);
+        ok = ok && fwrite(&records[oldest], sizeof(Record), records.size() - oldest, out) == records.size() - oldest;
+        ok = ok && fwrite(&records[0], sizeof(Record), oldest, out) == oldest;
+    } else if (count > 0) {
+        ok = ok && fwrite(&records[0], sizeof(Record), count, out) == count;
+    }
+    if (fclose(out) != 0 || !ok) {
+        throw std::runtime_error(std::string("Cannot write ") + file);
+    }
+
+    Logger::log("capture", "%llu events written to %s (%llu dropped)", (unsigned long long) header.records, file,
+                (unsigned long long) header.dropped);
+}
+
+const char *Capture::device_name() const {
+    return header.device;
+}
+
+void Capture::decode(FILE *out, const DEVICE &device) const {
+    Disassembler disassembler(device);
+    fprintf(out, "# %s, %u target(s), %llu events (%llu dropped)\n", header.device, header.targets,
+            (unsigned long long) size(), (unsigned long long) (count - size()));
+
+    for (uint64_t i = 0; i < size(); i++) {
+        const Record &record = get(i);
+        const char *name = record.event <= SELECT ? EVENT_NAMES[record.event] : "?";
+        fprintf(out, "%14.3f us  %-9s ", record.time / 1000.0, name);
+        switch (record.event) {
+            case MCLR:
+                fprintf(out, "%s\n", record.value ? "high" : "low");
+                break;
+            case DELAY:
+                fprintf(out, "%u us\n", record.value);
+                break;
+            case KEY:
+                fprintf(out, "0x%08x (%u bits)\n", record.value, record.arg);
+                break;
+            case CLOCKS:
+                fprintf(out, "%u\n", record.arg);
+                break;
+            case SIX:
+                fprintf(out, "0x%06x  %s\n", record.value, disassembler.disassemble(record.value).c_str());
+                break;
+            case RESULT:
+                fprintf(out, "target %u: 0x%04x\n", record.target, record.value);
+                break;
+            case PE_WORD:
+                fprintf(out, "0x%04x\n", record.value);
+                break;
+            case HANDSHAKE:
+                fprintf(out, "timeout %u us (polled every %u us)\n", record.value, record.arg);
+                break;
+            case MISSING:
+            case SELECT:
+                fprintf(out, "0x%08x\n", record.value);
+                break;
+            case PE_READ:
+                fprintf(out, "%u words\n", record.value);
+                break;
+            default:
+                fprintf(out, "\n");
+                break;
+        }
+    }
+}
+
+void Capture::export_vcd(FILE *out) const {
+    int targets = (int) header.targets;
+    fprintf(out, "$comment raspicsp capture of %s $end\n", header.device);
+    fprintf(out, "$timescale 1ns $end\n");
+    fprintf(out, "$scope module icsp $end\n");
+    fprintf(out, "$var wire 1 ! MCLR $end\n");
+    fprintf(out, "$var wire 1 \" PGC $end\n");
+    fprintf(out, "$var wire 1 # PGD $end\n");
+    for (int target = 0; target < targets; target++) {
+        fprintf(out, "$var wire 1 %c PGD_IN%d $end\n", '$' + target, target);
+    }
+    fprintf(out, "$upscope $end\n");
+    fprintf(out, "$enddefinitions $end\n");
+
+    // Start with all signals unknown, so that the first assignment of each one is written
+    VcdWriter vcd;
+    vcd.out = out;
+    vcd.cursor = 0;
+    vcd.written = 1;
+    vcd.half_period = header.half_period_ns > 0 ? header.half_period_ns : 1000;
+    vcd.levels.assign(3 + targets, '?');
+    vcd.set(0, 'x');
+    vcd.set(1, '0');
+    vcd.set(2, '0');
+    for (int target = 0; target < targets; target++) {
+        vcd.set(3 + target, 'z');
+    }
+
+    std::vector<int64_t> values;
+    uint32_t selected = 0xffffffffu;
+    for (uint64_t i = 0; i < size(); i++) {
+        const Record &record = get(i);
+        if (record.time > vcd.cursor) {
+            vcd.cursor = record.time;
+        }
+
+        switch (record.event) {
+            case MCLR:
+                vcd.set(0, record.value ? '1' : '0');
+                break;
+            case DELAY:
+                vcd.cursor += record.value * 1000ull;
+                break;
+            case KEY:
+                for (int bit = record.arg - 1; bit >= 0; bit--) {
+                    vcd.write_bit((record.value >> bit) & 1);
+                }
+                break;
+            case CLOCKS:
+                for (int bit = 0; bit < record.arg; bit++) {
+                    vcd.write_bit(0);
+                }
+                break;
+            case SIX:
+                for (int bit = 0; bit < 28; bit++) {
+                    vcd.write_bit(bit >= 4 && ((record.value >> (bit - 4)) & 1));
+                }
+                break;
+            case PE_WORD:
+                for (int bit = 15; bit >= 0; bit--) {
+                    vcd.write_bit((record.value >> bit) & 1);
+                }
+                break;
+            case VISI:
+                for (int bit = 0; bit < 12; bit++) {
+                    vcd.write_bit(bit == 0);
+                }
+                vcd.set(2, 'z');
+                i = collect_results(i, 1, values);
+                for (int bit = 0; bit < 16; bit++) {
+                    vcd.read_bit(values, 0, bit);
+                }
+                vcd.set(2, '0');
+                break;
+            case HANDSHAKE:
+                // Busy executives hold PGD high until their response is ready
+                vcd.set(2, 'z');
+                for (int target = 0; target < targets; target++) {
+                    vcd.set(3 + target, (selected >> target) & 1 ? '1' : 'z');
+                }
+                break;
+            case MISSING:
+                for (int target = 0; target < targets; target++) {
+                    if ((selected >> target) & 1 && !((record.value >> target) & 1)) {
+                        vcd.set(3 + target, '0');
+                    }
+                }
+                break;
+            case PE_READ:
+                i = collect_results(i, record.value, values);
+                for (uint32_t word = 0; word < record.value; word++) {
+                    for (int bit = 15; bit >= 0; bit--) {
+                        vcd.read_bit(values, word, bit);
+                    }
+                }
+                vcd.set(2, '0');
+                break;
+            case SELECT:
+                selected = record.value;
+                for (int target = 0; target < targets; target++) {
+                    if (!((selected >> target) & 1)) {
+                        vcd.set(3 + target, 'z');
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    fprintf(out, "#%llu\n", (unsigned long long) vcd.cursor);
+}
+
+uint64_t Capture::replay(HAL &hal) const {
+    if (count > size() || header.dropped > 0) {
+        throw std::runtime_error("The capture is incomplete (its ring buffer has wrapped around)");
+    }
+    if (hal.targets() != (int) header.targets) {
+        throw std::runtime_error("The capture was taken with a different number of targets");
+    }
+    Logger::log("capture", "Replaying %llu events", (unsigned long long) size());
+
+    int targets = (int) header.targets;
+    uint64_t differences = 0;
+    std::vector<int64_t> expected;
+    std::vector<uint32_t> actual;
+    uint32_t results[HAL::MAX_TARGETS] = {0};
+    for (uint64_t i = 0; i < size(); i++) {
+        const Record &record = get(i);
+        uint64_t index = i;
+        int words = 0;
+
+        switch (record.event) {
+            case MCLR:
+                if (record.value) {
+                    hal.mclr_up();
+                } else {
+                    hal.mclr_down();
+                }
+                break;
+            case DELAY:
+                hal.delay(record.value);
+                break;
+            case KEY:
+                hal.shift_out(record.value, record.arg, false);
+                break;
+            case CLOCKS:
+                hal.shift_out(0, record.arg, true);
+                break;
+            case SIX:
+                hal.shift_out(record.value << 4, 28, true);
+                break;
+            case PE_WORD:
+                hal.shift_out(record.value, 16, false);
+                break;
+            case VISI:
+                hal.shift_out(0x001, 12, true);
+                hal.read_mode();
+                hal.shift_in_all(16, true, results);
+                hal.write_mode();
+                actual.assign(results, results + targets);
+                words = 1;
+                break;
+            case HANDSHAKE: {
+                hal.read_mode();
+                uint32_t pending = hal.wait_ready(record.value, record.arg);
+                if (i + 1 < size() && get(i + 1).event == MISSING) {
+                    const Record &missing = get(++i);
+                    if (missing.value != pending) {
+                        Logger::log("capture", "Event %llu: targets 0x%08x didn't respond instead of 0x%08x",
+                                    (unsigned long long) i, pending, missing.value);
+                        differences++;
+                    }
+                }
+                break;
+            }
+            case PE_READ:
+                actual.resize(record.value * targets);
+                for (uint32_t word = 0; word < record.value; word++) {
+                    hal.shift_in_all(16, false, results);
+                    for (int target = 0; target < targets; target++) {
+                        actual[word * targets + target] = results[target];
+                    }
+                }
+                hal.write_mode();
+                words = (int) record.value;
+                break;
+            case SELECT:
+                hal.select_targets(record.value);
+                break;
+            default:
+                break;
+        }
+
+        if (words > 0) {
+            i = collect_results(index, words, expected);
+            for (size_t j = 0; j < expected.size(); j++) {
+                if (expected[j] >= 0 && (uint32_t) expected[j] != actual[j]) {
+                    Logger::log("capture", "Event %llu: target %d read 0x%04x instead of 0x%04x",
+                                (unsigned long long) index, (int) (j % targets), actual[j], (uint32_t) expected[j]);
+                    differences++;
+                }
+            }
+        }
+    }
+
+    Logger::log("capture", "Replay finished with %llu difference(s)", (unsigned long long) differences);
+    return differences;
+}
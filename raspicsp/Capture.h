@@ -0,0 +1,160 @@
+//
+// Records the traffic of an ICSP session in a compact binary format
+//
+
+#ifndef RASPICSP_CAPTURE_H
+#define RASPICSP_CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "Delay.h"
+#include "HAL.h"
+#include "devices.h"
+
+/*
+ * Stores every SIX command, VISI read, programming executive word and MCLR / timing event of a session
+ * in a preallocated ring buffer. Recording an event only copies 16 bytes, so (unlike tracing) it can stay
+ * enabled while programming. At the end of the session the buffer is written to a file which can be
+ * decoded into PIC24 mnemonics, exported as VCD for a waveform viewer or replayed against a HAL.
+ *
+ * If more events are recorded than fit into the buffer, the oldest ones are overwritten.
+ */
+class Capture {
+public:
+
+    /*
+     * Enumerates the recorded events. The meaning of value and arg depends on the event.
+     */
+    enum EVENT {
+        MCLR = 0,       // value: level of MCLR
+        DELAY = 1,      // value: duration in microseconds
+        KEY = 2,        // value: entry code, arg: number of bits (sent MSB first)
+        CLOCKS = 3,     // arg: number of additional clock cycles (PGD low)
+        SIX = 4,        // value: op code
+        VISI = 5,       // followed by one RESULT per selected target
+        RESULT = 6,     // value: word read from the given target
+        PE_WORD = 7,    // value: command word sent to the programming executive
+        HANDSHAKE = 8,  // value: timeout in microseconds, arg: poll interval in microseconds
+        MISSING = 9,    // value: targets which didn't finish the handshake
+        PE_READ = 10,   // value: number of response words, followed by RESULTs (word by word)
+        SELECT = 11     // value: selected targets
+    };
+
+    /*
+     * Describes a single event
+     */
+    struct Record {
+        uint64_t time;
+        uint32_t value;
+        uint16_t arg;
+        uint8_t event;
+        uint8_t target;
+    };
+
+    /*
+     * Contains the default number of records kept in memory (32 MB)
+     */
+    static const uint32_t DEFAULT_CAPACITY = 1 << 21;
+
+private:
+
+    /*
+     * Describes the file format, which is followed by the records (oldest first)
+     */
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t half_period_ns;
+        uint32_t targets;
+        uint32_t reserved;
+        uint64_t records;
+        uint64_t dropped;
+        char device[32];
+    };
+
+    static const char MAGIC[8];
+    static const uint32_t VERSION = 1;
+
+    Header header;
+    std::vector<Record> records;
+    uint32_t mask;
+    uint64_t count;
+    uint64_t start;
+
+    /*
+     * Returns the index-th record (in chronological order)
+     */
+    const Record &get(uint64_t index) const;
+
+    /*
+     * Returns the number of records available
+     */
+    uint64_t size() const;
+
+    /*
+     * Collects the RESULT records following the given index: values[word * targets + target] receives
+     * the given word of each target (or -1 if it wasn't recorded). Returns the index of the last RESULT.
+     */
+    uint64_t collect_results(uint64_t index, int words, std::vector<int64_t> &values) const;
+
+public:
+
+    /*
+     * Creates an empty capture for the given device. The capacity is rounded up to a power of two.
+     */
+    Capture(const char *device, uint32_t half_period_ns, int targets, uint32_t capacity = DEFAULT_CAPACITY);
+
+    /*
+     * Loads the capture stored in the given file
+     */
+    Capture(const char *file);
+
+    /*
+     * Records an event
+     */
+    inline void record(EVENT event, uint32_t value, uint16_t arg = 0, uint8_t target = 0) {
+        record(Delay::now(), event, value, arg, target);
+    }
+
+    /*
+     * Records an event which happened at the given time (as returned by Delay::now)
+     */
+    inline void record(uint64_t time, EVENT event, uint32_t value, uint16_t arg = 0, uint8_t target = 0) {
+        Record &record = records[count++ & mask];
+        record.time = time - start;
+        record.value = value;
+        record.arg = arg;
+        record.event = (uint8_t) event;
+        record.target = target;
+    }
+
+    /*
+     * Writes the capture to the given file
+     */
+    void save(const char *file);
+
+    /*
+     * Returns the name of the device being programmed when the capture was taken
+     */
+    const char *device_name() const;
+
+    /*
+     * Prints the events in human-readable form (disassembling SIX commands of the given device)
+     */
+    void decode(FILE *out, const DEVICE &device) const;
+
+    /*
+     * Writes the signals MCLR, PGC, PGD and the levels read from each target as value change dump
+     */
+    void export_vcd(FILE *out) const;
+
+    /*
+     * Drives the recorded events via the given HAL and compares everything read back with the
+     * recording. Returns the number of differences.
+     */
+    uint64_t replay(HAL &hal) const;
+};
+
+
+#endif //RASPICSP_CAPTURE_H
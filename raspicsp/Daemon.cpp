@@ -0,0 +1,301 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sstream>
+#include <stdexcept>
+#include "Daemon.h"
+#include "Logger.h"
+
+volatile sig_atomic_t Daemon::stopped = 0;
+
+/*
+ * Fills the address of the socket at the given path
+ */
+static void socketAddress(const char *path, struct sockaddr_un &address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        throw std::runtime_error(std::string("Path of the socket too long: ") + path);
+    }
+    strcpy(address.sun_path, path);
+}
+
+Daemon::Daemon(const char *path) : path(path) {
+    jobs = 0;
+    output = NULL;
+    stopped = 0;
+
+    struct sockaddr_un address;
+    socketAddress(path, address);
+    server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (server < 0) {
+        throw std::runtime_error("Cannot create socket");
+    }
+
+    // A socket nobody is listening on was left by a daemon which didn't exit cleanly
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe >= 0 && connect(probe, (struct sockaddr *) &address, sizeof(address)) == 0) {
+        close(probe);
+        close(server);
+        throw std::runtime_error(std::string("Another daemon is listening on ") + path);
+    }
+    if (probe >= 0) {
+        close(probe);
+    }
+    unlink(path);
+
+    if (bind(server, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(server, 16) < 0) {
+        close(server);
+        throw std::runtime_error(std::string("Cannot listen on ") + path);
+    }
+
+    // Clients may go away at any time, SIGINT and SIGTERM are only accepted while waiting for jobs
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &old_actions[0]);
+    sigaction(SIGTERM, &action, &old_actions[1]);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, &old_mask);
+
+    Logger::log("daemon", "Listening on %s", path);
+}
+
+Daemon::~Daemon() {
+    if (output != NULL) {
+        fclose(output);
+        Logger::redirect(NULL);
+    }
+    for (size_t i = 0; i < connections.size(); i++) {
+        close(connections[i].fd);
+    }
+    for (size_t i = 0; i < queue.size(); i++) {
+        close(queue[i].client);
+    }
+    close(server);
+    unlink(path.c_str());
+
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    sigaction(SIGINT, &old_actions[0], NULL);
+    sigaction(SIGTERM, &old_actions[1], NULL);
+}
+
+void Daemon::on_signal(int) {
+    stopped = 1;
+}
+
+int Daemon::next(Job &job) {
+    while (true) {
+        // Everything which arrived while the last job was executed is queued first
+        if (!poll_clients(queue.empty() ? -1 : 0)) {
+            return 0;
+        }
+        if (queue.empty()) {
+            continue;
+        }
+        job = queue.front();
+        queue.pop_front();
+
+        // A client which has gone doesn't wait for its job anymore
+        char data;
+        ssize_t length = recv(job.client, &data, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (length == 0 || (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            Logger::log("daemon", "Job %u dropped as its client has gone", job.id);
+            close(job.client);
+            continue;
+        }
+        fcntl(job.client, F_SETFL, fcntl(job.client, F_GETFL) & ~O_NONBLOCK);
+        output = fdopen(job.client, "w");
+        if (output == NULL) {
+            close(job.client);
+            continue;
+        }
+        setvbuf(output, NULL, _IOLBF, 0);
+
+        Logger::log("daemon", "Job %u: %s %s %s", job.id, job.command.c_str(), job.device.c_str(),
+                    job.file.c_str());
+        Logger::redirect(output);
+        Logger::log("daemon", "Starting job %u", job.id);
+        return 1;
+    }
+}
+
+void Daemon::finish(Job &job, int result) {
+    fprintf(output, "result %d\n", result);
+    fclose(output);
+    output = NULL;
+    Logger::redirect(NULL);
+    Logger::log("daemon", "Job %u finished (result %d)", job.id, result);
+}
+
+int Daemon::poll_clients(int timeout) {
+    std::vector<struct pollfd> fds(1 + connections.size());
+    fds[0].fd = server;
+    fds[0].events = POLLIN;
+    for (size_t i = 0; i < connections.size(); i++) {
+        fds[i + 1].fd = connections[i].fd;
+        fds[i + 1].events = POLLIN;
+    }
+
+    sigset_t mask = old_mask;
+    sigdelset(&mask, SIGINT);
+    sigdelset(&mask, SIGTERM);
+    struct timespec time = {timeout / 1000, (timeout % 1000) * 1000000L};
+    int count = ppoll(&fds[0], fds.size(), timeout < 0 ? NULL : &time, &mask);
+    if (stopped) {
+        return 0;
+    }
+    if (count < 0) {
+        if (errno == EINTR) {
+            return 1;
+        }
+        throw std::runtime_error("Waiting for clients failed");
+    }
+
+    std::vector<Connection> remaining;
+    for (size_t i = 0; i < connections.size(); i++) {
+        if (fds[i + 1].revents == 0 || receive(connections[i])) {
+            remaining.push_back(connections[i]);
+        }
+    }
+    connections.swap(remaining);
+    if (fds[0].revents & POLLIN) {
+        accept_connections();
+    }
+    return 1;
+}
+
+void Daemon::accept_connections() {
+    while (true) {
+        int fd = accept4(server, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd < 0) {
+            return;
+        }
+        Connection connection;
+        connection.fd = fd;
+        // The request is most probably already there
+        if (receive(connection)) {
+            connections.push_back(connection);
+        }
+    }
+}
+
+int Daemon::receive(Connection &connection) {
+    char buffer[512];
+    while (true) {
+        ssize_t length = recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1;
+        }
+        if (length <= 0) {
+            close(connection.fd);
+            return 0;
+        }
+
+        connection.request.append(buffer, (size_t) length);
+        size_t end = connection.request.find('\n');
+        if (end != std::string::npos) {
+            enqueue(connection.fd, connection.request.substr(0, end));
+            return 0;
+        }
+        if (connection.request.size() > MAX_REQUEST_LENGTH) {
+            send_text(connection.fd, "error Request too long\nresult 1\n");
+            close(connection.fd);
+            return 0;
+        }
+    }
+}
+
+void Daemon::enqueue(int fd, const std::string &request) {
+    std::istringstream in(request);
+    std::vector<std::string> words;
+    std::string word;
+    while (in >> word) {
+        words.push_back(word);
+    }
+
+    size_t expected = 0;
+    if (!words.empty()) {
+        expected = words[0] == "id" ? 2 : words[0] == "program" || words[0] == "verify" || words[0] == "dump" ? 3 : 0;
+    }
+    if (expected == 0 || words.size() != expected) {
+        send_text(fd, expected == 0 ? "error Unknown command (use program, verify, dump or id)\nresult 1\n"
+                                    : "error Wrong number of arguments\nresult 1\n");
+        close(fd);
+        return;
+    }
+
+    Job job;
+    job.id = ++jobs;
+    job.command = words[0];
+    job.device = words[1];
+    job.file = expected == 3 ? words[2] : "";
+    job.client = fd;
+
+    std::ostringstream status;
+    status << "queued " << job.id << " " << queue.size() << "\n";
+    send_text(fd, status.str());
+    queue.push_back(job);
+}
+
+void Daemon::send_text(int fd, const std::string &text) {
+    ssize_t result = send(fd, text.data(), text.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    (void) result;
+}
+
+int Daemon::submit(const char *path, const std::vector<std::string> &request) {
+    struct sockaddr_un address;
+    socketAddress(path, address);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw std::runtime_error(std::string("Cannot connect to the daemon at ") + path);
+    }
+
+    std::string line;
+    for (size_t i = 0; i < request.size(); i++) {
+        line += (i > 0 ? " " : "") + request[i];
+    }
+    line += "\n";
+    if (send(fd, line.data(), line.size(), MSG_NOSIGNAL) != (ssize_t) line.size()) {
+        close(fd);
+        throw std::runtime_error("Cannot send the job to the daemon");
+    }
+
+    FILE *in = fdopen(fd, "r");
+    if (in == NULL) {
+        close(fd);
+        throw std::runtime_error("Cannot receive the result from the daemon");
+    }
+    char buffer[1024];
+    int result = -1;
+    while (fgets(buffer, sizeof(buffer), in) != NULL) {
+        if (strncmp(buffer, "result ", 7) == 0) {
+            result = atoi(buffer + 7);
+        } else {
+            fputs(buffer, stdout);
+            fflush(stdout);
+        }
+    }
+    fclose(in);
+
+    if (result < 0) {
+        throw std::runtime_error("The daemon closed the connection before the job was finished");
+    }
+    return result;
+}
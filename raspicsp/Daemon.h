@@ -0,0 +1,142 @@
+//
+// Accepts jobs via a UNIX socket, so that a long-running process can program devices
+//
+
+#ifndef RASPICSP_DAEMON_H
+#define RASPICSP_DAEMON_H
+
+#include <signal.h>
+#include <stdio.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+/*
+ * Describes a job received by the daemon
+ */
+class Job {
+public:
+
+    /*
+     * Contains the number of the job (counted since the daemon was started)
+     */
+    unsigned id;
+
+    /*
+     * Contains the command (program, verify, dump or id), the device (or auto) and the file (unless
+     * the command is id)
+     */
+    std::string command;
+    std::string device;
+    std::string file;
+
+    /*
+     * Contains the connection of the client which submitted the job
+     */
+    int client;
+};
+
+/*
+ * Listens on a UNIX socket for jobs and queues them, so that they are executed one after another.
+ *
+ * A client sends a single line: the command, the device and the file, separated by spaces. It receives
+ * the position of the job in the queue, then all messages logged while the job is executed (the same
+ * ones printed by a session started from the command line) and finally "result" followed by the exit
+ * code a session from the command line would have returned.
+ *
+ * The daemon is single threaded: connections and requests which arrive while a job is executed are
+ * waiting in the socket until it has finished. SIGINT and SIGTERM are blocked while a job is executed,
+ * so that they neither interrupt a delay nor leave a device half programmed - the daemon stops before
+ * the next job instead.
+ */
+class Daemon {
+public:
+
+    /*
+     * Contains the maximal length of a request
+     */
+    static const size_t MAX_REQUEST_LENGTH = 4096;
+
+    /*
+     * Creates the socket at the given path (replacing a stale one) and starts listening
+     */
+    Daemon(const char *path);
+    ~Daemon();
+
+    /*
+     * Waits for the next job. While it is executed, all messages are sent to its client. Returns 0 if
+     * the daemon was stopped by a signal.
+     */
+    int next(Job &job);
+
+    /*
+     * Sends the result of the given job to its client and closes the connection
+     */
+    void finish(Job &job, int result);
+
+    /*
+     * Submits a job to the daemon listening at the given path and prints everything it sends back.
+     * Returns the result of the job.
+     */
+    static int submit(const char *path, const std::vector<std::string> &request);
+
+private:
+
+    /*
+     * Describes a connection whose request hasn't been received completely
+     */
+    struct Connection {
+        int fd;
+        std::string request;
+    };
+
+    static volatile sig_atomic_t stopped;
+
+    std::string path;
+    int server;
+    std::vector<Connection> connections;
+    std::deque<Job> queue;
+    unsigned jobs;
+
+    /*
+     * Contains the client stream of the running job (NULL if no job is running)
+     */
+    FILE *output;
+
+    sigset_t old_mask;
+    struct sigaction old_actions[2];
+
+    static void on_signal(int number);
+
+    /*
+     * Waits up to the given time (in ms, -1 to wait forever) for connections and requests. Returns 0 if the
+     * daemon was stopped.
+     */
+    int poll_clients(int timeout);
+
+    /*
+     * Accepts all waiting connections
+     */
+    void accept_connections();
+
+    /*
+     * Receives the pending data of the given connection. Returns 0 if it has to be removed (as it was
+     * closed or the request has been received completely).
+     */
+    int receive(Connection &connection);
+
+    /*
+     * Parses the given request and queues it (or reports why it is invalid)
+     */
+    void enqueue(int fd, const std::string &request);
+
+    /*
+     * Sends the given text to a client (ignoring errors, as the client may have gone)
+     */
+    static void send_text(int fd, const std::string &text);
+
+    Daemon(const Daemon &);
+    Daemon &operator=(const Daemon &);
+};
+
+#endif //RASPICSP_DAEMON_H
@@ -0,0 +1,216 @@
+#include <sys/fcntl.h>
+#include <sys/mman.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdexcept>
+#include "Delay.h"
+#include "Logger.h"
+
+#if defined(__aarch64__) || (defined(__arm__) && defined(__ARM_ARCH) && __ARM_ARCH >= 7)
+#define HAS_ARM_TIMER
+#endif
+
+static const char *SOURCE_NAMES[] = {"spin", "armtimer", "systimer", "clock"};
+
+uint64_t Delay::worst_overrun_ns = 0;
+uint64_t Delay::worst_wakeup_ns = 0;
+
+Delay::Delay(SOURCE source, uint32_t peripheral_base) : source(source) {
+    system_timer = NULL;
+    switch (source) {
+        case SPIN:
+            calibrate();
+            break;
+        case ARM_TIMER: {
+#ifdef HAS_ARM_TIMER
+#ifdef __aarch64__
+            __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(ticks_per_second));
+#else
+            uint32_t frequency;
+            __asm__ __volatile__("mrc p15, 0, %0, c14, c0, 0" : "=r"(frequency));
+            ticks_per_second = frequency;
+#endif
+            break;
+#else
+            throw std::runtime_error("The ARM generic timer is not available on this platform");
+#endif
+        }
+        case SYSTEM_TIMER:
+            setup_system_timer(peripheral_base);
+            ticks_per_second = 1000000;
+            break;
+        case CLOCK:
+            ticks_per_second = 1000000000;
+            break;
+    }
+    overrun_scale = (1000000000ull << 16) / ticks_per_second;
+    Logger::log("Delay", "Using %s as time source (%llu ticks per second)", source_name(source),
+                (unsigned long long) ticks_per_second);
+}
+
+Delay::~Delay() {
+    if (system_timer != NULL) {
+        munmap((void *) system_timer, BLOCK_SIZE);
+    }
+}
+
+void Delay::calibrate() {
+    // Measure the very loop used by wait_ticks and keep the fastest of some runs, as the first
+    // ones usually suffer from a CPU which is still clocked down
+    uint64_t iterations = 1 << 16;
+    uint64_t fastest = 0;
+    for (int run = 0; run < 5; run++) {
+        uint64_t elapsed = 0;
+        while (elapsed < 10000000) {
+            iterations *= 2;
+            uint64_t start = now();
+            wait_ticks(iterations);
+            elapsed = now() - start;
+        }
+        iterations /= 2;
+        uint64_t rate = iterations * 2 * 1000000000ull / elapsed;
+        if (rate > fastest) {
+            fastest = rate;
+        }
+    }
+    ticks_per_second = fastest;
+}
+
+void Delay::setup_system_timer(uint32_t peripheral_base) {
+#ifndef DRYRUN
+    Logger::trace("Delay", "Mapping the system timer at 0x%08x into address space", peripheral_base + SYSTEM_TIMER_OFFSET);
+    int mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
+    if (mem_fd < 0) {
+        throw std::runtime_error("Cannot open /dev/mem");
+    }
+
+    void *timer_map = mmap(
+            NULL,
+            BLOCK_SIZE,
+            PROT_READ,
+            MAP_SHARED,
+            mem_fd,
+            peripheral_base + SYSTEM_TIMER_OFFSET
+    );
+
+    close(mem_fd);
+
+    if (timer_map == MAP_FAILED) {
+        throw std::runtime_error("Cannot map the system timer into local address space");
+    }
+
+    system_timer = (volatile uint32_t *) timer_map;
+#else
+    (void) peripheral_base;
+    throw std::runtime_error("The system timer is not available in a dry run");
+#endif
+}
+
+uint64_t Delay::read_arm_counter() {
+#ifdef HAS_ARM_TIMER
+    uint64_t result;
+#ifdef __aarch64__
+    __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(result));
+#else
+    __asm__ __volatile__("isb; mrrc p15, 1, %Q0, %R0, c14" : "=r"(result));
+#endif
+    return result;
+#else
+    return 0;
+#endif
+}
+
+uint64_t Delay::ticks_for(uint32_t nanos) {
+    // Round up, as we must never wait shorter than requested
+    return (nanos * ticks_per_second + 999999999ull) / 1000000000ull;
+}
+
+void Delay::wait_ticks(uint64_t ticks) {
+    if (ticks == 0) {
+        return;
+    }
+
+    switch (source) {
+        case SPIN:
+            for (uint64_t i = 0; i < ticks; i++) {
+                __asm__ __volatile__("");
+            }
+            return;
+        case ARM_TIMER: {
+            // The counter is read at an arbitrary point of its current tick, so it has to advance by ticks + 1
+            // to wait for at least the given number of complete ticks
+            uint64_t start = read_arm_counter();
+            uint64_t elapsed;
+            while ((elapsed = read_arm_counter() - start) <= ticks) {
+            }
+            record_overrun(elapsed - ticks - 1);
+            return;
+        }
+        case SYSTEM_TIMER: {
+            // The counter register (CLO) is located at offset 0x04. As the timer is another peripheral
+            // than the GPIO block, barriers are required to keep the accesses in order. Like the ARM counter,
+            // it has to advance by ticks + 1 (otherwise a wait for 1 µs may end immediately).
+            __sync_synchronize();
+            uint32_t start = system_timer[1];
+            uint32_t elapsed;
+            while ((elapsed = system_timer[1] - start) <= ticks) {
+            }
+            __sync_synchronize();
+            record_overrun(elapsed - ticks - 1);
+            return;
+        }
+        case CLOCK: {
+            uint64_t start = now();
+            uint64_t elapsed;
+            while ((elapsed = now() - start) < ticks) {
+            }
+            record_overrun(elapsed - ticks);
+            return;
+        }
+    }
+}
+
+void Delay::wait(uint32_t nanos) {
+    wait_ticks(ticks_for(nanos));
+}
+
+void Delay::record_wakeup(uint64_t late) {
+    if (late > worst_wakeup_ns) {
+        worst_wakeup_ns = late;
+    }
+}
+
+uint64_t Delay::worst_overrun() {
+    return worst_overrun_ns;
+}
+
+uint64_t Delay::worst_wakeup() {
+    return worst_wakeup_ns;
+}
+
+void Delay::reset_latencies() {
+    worst_overrun_ns = 0;
+    worst_wakeup_ns = 0;
+}
+
+const char *Delay::source_name(SOURCE source) {
+    return SOURCE_NAMES[source];
+}
+
+int Delay::find_source(const char *name, SOURCE &source) {
+    for (int i = SPIN; i <= CLOCK; i++) {
+        if (strcmp(name, SOURCE_NAMES[i]) == 0) {
+            source = (SOURCE) i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+uint64_t Delay::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
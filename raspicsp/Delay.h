@@ -0,0 +1,147 @@
+//
+// Provides busy-waits with sub microsecond resolution
+//
+
+#ifndef RASPICSP_DELAY_H
+#define RASPICSP_DELAY_H
+
+#include <stdint.h>
+
+/*
+ * Implements short busy-waits used to generate the PGC clock.
+ *
+ * Waits are expressed in ticks of the selected source, so that the (rather expensive) conversion
+ * from nanoseconds can be performed once and the hot path only compares counter values.
+ */
+class Delay {
+public:
+
+    /*
+     * Enumerates the available time sources
+     */
+    enum SOURCE {
+        /*
+         * A calibrated loop which needs no timer at all (but suffers from CPU frequency scaling)
+         */
+        SPIN,
+        /*
+         * The virtual counter of the ARM generic timer (ARMv7 and later)
+         */
+        ARM_TIMER,
+        /*
+         * The free running 1 MHz counter of the BCM system timer (mapped via /dev/mem)
+         */
+        SYSTEM_TIMER,
+        /*
+         * clock_gettime(CLOCK_MONOTONIC_RAW)
+         */
+        CLOCK
+    };
+
+    /*
+     * Creates a delay using the given source. The peripheral base is used to locate the system timer.
+     */
+    Delay(SOURCE source, uint32_t peripheral_base);
+
+    /*
+     * Releases the mapped system timer
+     */
+    ~Delay();
+
+    /*
+     * Converts the given number of nanoseconds into ticks of the selected source
+     */
+    uint64_t ticks_for(uint32_t nanos);
+
+    /*
+     * Waits for the given number of ticks
+     */
+    void wait_ticks(uint64_t ticks);
+
+    /*
+     * Waits for the given number of nanoseconds
+     */
+    void wait(uint32_t nanos);
+
+    /*
+     * Returns the name of the given source
+     */
+    static const char *source_name(SOURCE source);
+
+    /*
+     * Tries to find the source with the given name
+     */
+    static int find_source(const char *name, SOURCE &source);
+
+    /*
+     * Returns the value of CLOCK_MONOTONIC_RAW in nanoseconds
+     */
+    static uint64_t now();
+
+    /*
+     * Records that a sleep (like usleep) ended the given number of nanoseconds later than requested
+     */
+    static void record_wakeup(uint64_t late);
+
+    /*
+     * Returns the longest time (in ns) a wait_ticks ran beyond its last tick (e.g. because the thread was
+     * preempted while clocking PGC) since the last reset. Waits using SPIN are not measured.
+     */
+    static uint64_t worst_overrun();
+
+    /*
+     * Returns the longest time (in ns) a sleep ended too late since the last reset
+     */
+    static uint64_t worst_wakeup();
+
+    /*
+     * Resets the worst overrun and wake-up
+     */
+    static void reset_latencies();
+
+private:
+
+    static const uint32_t SYSTEM_TIMER_OFFSET = 0x3000;
+    static const uint32_t BLOCK_SIZE = 4096;
+
+    SOURCE source;
+    uint64_t ticks_per_second;
+    volatile uint32_t *system_timer;
+
+    /*
+     * Contains the nanoseconds per tick (as 16.16 fixed point number), so that an overrun can be converted
+     * without a division
+     */
+    uint64_t overrun_scale;
+
+    static uint64_t worst_overrun_ns;
+    static uint64_t worst_wakeup_ns;
+
+    /*
+     * Records that a wait ran the given number of ticks beyond its last tick
+     */
+    inline void record_overrun(uint64_t ticks) {
+        uint64_t nanos = (ticks * overrun_scale) >> 16;
+        if (nanos > worst_overrun_ns) {
+            worst_overrun_ns = nanos;
+        }
+    }
+
+    /*
+     * Determines the number of loop iterations per second for SPIN
+     */
+    void calibrate();
+
+    /*
+     * Maps the BCM system timer into our address space
+     */
+    void setup_system_timer(uint32_t peripheral_base);
+
+    /*
+     * Reads the virtual counter of the ARM generic timer
+     */
+    static uint64_t read_arm_counter();
+};
+
+
+#endif //RASPICSP_DELAY_H
@@ -0,0 +1,243 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "DeviceDatabase.h"
+
+#define PROPERTY(name, field) {name, offsetof(DEVICE, field), sizeof(((DEVICE *) 0)->field)}
+
+const char *DeviceDatabase::DEFAULT_FILE = "/etc/raspicsp/devices.conf";
+
+const DeviceDatabase::Property DeviceDatabase::PROPERTIES[] = {
+        PROPERTY("icsp_code", ICSP_CODE),
+        PROPERTY("icsp_code_length", ICSP_CODE_LENGTH),
+        PROPERTY("tblpag_addr", TBLPAG_ADDR),
+        PROPERTY("nvmcon_addr", NVMCON_ADDR),
+        PROPERTY("visi_addr", VISI_ADDR),
+        PROPERTY("start_addr", START_ADDR),
+        PROPERTY("device_id_addr", DEVICE_ID_ADDR),
+        PROPERTY("nvmcon_erase_all", NVMCON_ERASE_ALL),
+        PROPERTY("nvmcon_write_row", NVMCON_WRITE_ROW),
+        PROPERTY("nvmcon_write_word", NVMCON_WRITE_WORD),
+        PROPERTY("nvmcon_writing", NVMCON_WRITING),
+        PROPERTY("config_words_start_addr", CONFIG_WORDS_START_ADDR),
+        PROPERTY("no_config_words", NO_CONFIG_WORDS),
+        PROPERTY("nvmcon_erase_page", NVMCON_ERASE_PAGE),
+        PROPERTY("chip_erase_time", CHIP_ERASE_TIME),
+        PROPERTY("page_erase_time", PAGE_ERASE_TIME),
+        PROPERTY("row_write_time", ROW_WRITE_TIME),
+        PROPERTY("word_write_time", WORD_WRITE_TIME),
+        PROPERTY("eicsp_code", EICSP_CODE),
+        PROPERTY("executive_addr", EXECUTIVE_ADDR),
+        PROPERTY("executive_size", EXECUTIVE_SIZE),
+        PROPERTY("app_id_addr", APP_ID_ADDR),
+        PROPERTY("app_id", APP_ID),
+        PROPERTY("ram_addr", RAM_ADDR),
+        PROPERTY("instruction_cycle_time", INSTRUCTION_CYCLE_TIME),
+        PROPERTY("row_size", ROW_SIZE),
+        PROPERTY("page_size", PAGE_SIZE),
+        PROPERTY("write_latches", WRITE_LATCHES),
+        {NULL, 0, 0}
+};
+
+DeviceDatabase::DeviceDatabase() {
+    for (int i = 0; i < NUM_DEVICES; i++) {
+        add(DEVICES[i], DEVICES[i].NAME);
+    }
+    for (int i = 0; i < NUM_DEVICE_IDS; i++) {
+        by_id[DEVICE_IDS[i].ID] = by_name[DEVICE_IDS[i].TYPE->NAME];
+    }
+}
+
+size_t DeviceDatabase::add(const DEVICE &device, const std::string &name) {
+    std::map<std::string, size_t>::iterator existing = by_name.find(name);
+    size_t index;
+    if (existing != by_name.end()) {
+        index = existing->second;
+        devices[index] = device;
+    } else {
+        index = devices.size();
+        devices.push_back(device);
+        names.push_back(name);
+        by_name[name] = index;
+    }
+    devices[index].NAME = names[index].c_str();
+    return index;
+}
+
+/*
+ * Removes leading and trailing whitespace
+ */
+static std::string trim(const std::string &text) {
+    size_t start = 0;
+    size_t end = text.size();
+    while (start < end && isspace((unsigned char) text[start])) {
+        start++;
+    }
+    while (end > start && isspace((unsigned char) text[end - 1])) {
+        end--;
+    }
+    return text.substr(start, end - start);
+}
+
+/*
+ * Parses a number (decimal or hex) which has to fit into the given maximum
+ */
+static uint32_t parseNumber(const std::string &text, uint32_t max, const std::string &location) {
+    char *end = NULL;
+    unsigned long value = strtoul(text.c_str(), &end, 0);
+    if (text.empty() || *end != '\0' || text[0] == '-' || value > max) {
+        throw std::runtime_error("Invalid number '" + text + "' " + location);
+    }
+    return (uint32_t) value;
+}
+
+void DeviceDatabase::load(const char *name) {
+    std::ifstream in(name);
+    if (!in) {
+        throw std::runtime_error(std::string("Cannot open ") + name);
+    }
+
+    // The device being parsed, it is added when the next one starts (or the file ends)
+    std::string device_name;
+    std::string device_location;
+    DEVICE device;
+    std::vector<uint16_t> ids;
+    std::vector<const char *> missing;
+
+    std::string line;
+    int line_number = 0;
+    while (true) {
+        int more = (int) !!std::getline(in, line);
+        line_number++;
+        std::ostringstream location;
+        location << "in line " << line_number << " of " << name;
+        line = more ? trim(line) : std::string();
+
+        if ((!more || (!line.empty() && line[0] == '[')) && !device_name.empty()) {
+            if (!missing.empty()) {
+                throw std::runtime_error(std::string("The property ") + missing[0] + " of " + device_name +
+                                         " is missing " + device_location);
+            }
+            validate(device, device_location);
+            size_t index = add(device, device_name);
+            for (size_t i = 0; i < ids.size(); i++) {
+                by_id[ids[i]] = index;
+            }
+            device_name.clear();
+        }
+        if (!more) {
+            break;
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        if (line[0] == '[') {
+            if (line[line.size() - 1] != ']' || trim(line.substr(1, line.size() - 2)).empty()) {
+                throw std::runtime_error("Invalid device name " + location.str());
+            }
+            device_name = trim(line.substr(1, line.size() - 2));
+            device_location = location.str();
+            memset(&device, 0, sizeof(device));
+            ids.clear();
+            missing.clear();
+            for (const Property *property = PROPERTIES; property->name != NULL; property++) {
+                missing.push_back(property->name);
+            }
+            continue;
+        }
+
+        size_t separator = line.find('=');
+        if (separator == std::string::npos) {
+            throw std::runtime_error("Expected property = value " + location.str());
+        }
+        if (device_name.empty()) {
+            throw std::runtime_error("Expected [device name] " + location.str());
+        }
+        std::string key = trim(line.substr(0, separator));
+        std::string value = trim(line.substr(separator + 1));
+
+        if (key == "base") {
+            if (missing.size() != sizeof(PROPERTIES) / sizeof(PROPERTIES[0]) - 1 || !ids.empty()) {
+                throw std::runtime_error("The base has to be the first property " + location.str());
+            }
+            const DEVICE *base = find(value.c_str());
+            if (base == NULL) {
+                throw std::runtime_error("Unknown device " + value + " " + location.str());
+            }
+            device = *base;
+            missing.clear();
+        } else if (key == "ids") {
+            for (size_t i = 0; i < value.size(); i++) {
+                if (value[i] == ',') {
+                    value[i] = ' ';
+                }
+            }
+            std::istringstream list(value);
+            std::string id;
+            while (list >> id) {
+                ids.push_back((uint16_t) parseNumber(id, 0xffff, location.str()));
+            }
+        } else {
+            const Property *property = PROPERTIES;
+            while (property->name != NULL && key != property->name) {
+                property++;
+            }
+            if (property->name == NULL) {
+                throw std::runtime_error("Unknown property " + key + " " + location.str());
+            }
+            uint32_t number = parseNumber(value, property->size == 1 ? 0xff : 0xffffffff, location.str());
+            uint8_t *field = (uint8_t *) &device + property->offset;
+            if (property->size == 1) {
+                *field = (uint8_t) number;
+            } else {
+                memcpy(field, &number, sizeof(number));
+            }
+            for (size_t i = 0; i < missing.size(); i++) {
+                if (missing[i] == property->name) {
+                    missing.erase(missing.begin() + i);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void DeviceDatabase::validate(const DEVICE &device, const std::string &location) {
+    if (device.ROW_SIZE < 4 || (device.ROW_SIZE & (device.ROW_SIZE - 1)) != 0) {
+        throw std::runtime_error("The row size has to be a power of two (at least 4) " + location);
+    }
+    if (device.PAGE_SIZE < device.ROW_SIZE || device.PAGE_SIZE < 64 ||
+        (device.PAGE_SIZE & (device.PAGE_SIZE - 1)) != 0) {
+        throw std::runtime_error("The page size has to be a power of two (at least 64 and the row size) " + location);
+    }
+    if (device.WRITE_LATCHES != device.ROW_SIZE) {
+        throw std::runtime_error("Only devices with a write latch per instruction of a row are supported " + location);
+    }
+    if (device.ICSP_CODE_LENGTH == 0 || device.ICSP_CODE_LENGTH > 32 || device.NO_CONFIG_WORDS == 0 ||
+        device.CONFIG_WORDS_START_ADDR % 2 != 0) {
+        throw std::runtime_error("Invalid ICSP code or config words " + location);
+    }
+}
+
+const DEVICE *DeviceDatabase::find(const char *name) const {
+    std::map<std::string, size_t>::const_iterator existing = by_name.find(name);
+    return existing != by_name.end() ? &devices[existing->second] : NULL;
+}
+
+const DEVICE *DeviceDatabase::find_by_id(uint16_t id) const {
+    std::map<uint16_t, size_t>::const_iterator existing = by_id.find(id);
+    return existing != by_id.end() ? &devices[existing->second] : NULL;
+}
+
+size_t DeviceDatabase::size() const {
+    return devices.size();
+}
+
+const DEVICE &DeviceDatabase::get(size_t index) const {
+    return devices[index];
+}
@@ -0,0 +1,98 @@
+//
+// Contains all known devices, including the ones described by a device file
+//
+
+#ifndef RASPICSP_DEVICEDATABASE_H
+#define RASPICSP_DEVICEDATABASE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include "devices.h"
+
+/*
+ * Holds the devices known to the programmer, indexed by their names and by the device IDs of their parts.
+ * It starts with the devices of devices.h, further devices (or different properties of these) are loaded
+ * from device files.
+ *
+ * A device file describes one device per section: the name in brackets is followed by its properties, one
+ * per line, named like the fields of DEVICE in lower case (e.g. "row_size = 64"). Numbers are given in
+ * decimal or (with 0x) in hex. Additionally, "ids" lists the device IDs of the parts (as read from
+ * DEVICE_ID_ADDR) and "base" names a device whose properties are used for all properties not given (it
+ * has to be the first property then). Lines starting with # are ignored.
+ */
+class DeviceDatabase {
+public:
+
+    /*
+     * Contains the device file which is loaded at startup (if it exists)
+     */
+    static const char *DEFAULT_FILE;
+
+    /*
+     * Creates a database containing the devices of devices.h
+     */
+    DeviceDatabase();
+
+    /*
+     * Loads the given device file. Devices which are already known are replaced.
+     */
+    void load(const char *name);
+
+    /*
+     * Returns the device with the given name or NULL if it is unknown
+     */
+    const DEVICE *find(const char *name) const;
+
+    /*
+     * Returns the device a part with the given device ID belongs to or NULL if it is unknown
+     */
+    const DEVICE *find_by_id(uint16_t id) const;
+
+    /*
+     * Returns the number of devices
+     */
+    size_t size() const;
+
+    /*
+     * Returns the given device (in the order the devices were added)
+     */
+    const DEVICE &get(size_t index) const;
+
+private:
+
+    /*
+     * Describes a property of a device in a device file
+     */
+    struct Property {
+        const char *name;
+        size_t offset;
+        size_t size;
+    };
+
+    static const Property PROPERTIES[];
+
+    /*
+     * Contains the devices and their names (the names of the devices point into names). Both only grow,
+     * so that the devices handed out remain valid.
+     */
+    std::deque<DEVICE> devices;
+    std::deque<std::string> names;
+
+    std::map<std::string, size_t> by_name;
+    std::map<uint16_t, size_t> by_id;
+
+    /*
+     * Adds the given device (or replaces the one with the same name) and returns its index
+     */
+    size_t add(const DEVICE &device, const std::string &name);
+
+    /*
+     * Checks that the given device can be programmed, the location is used in error messages
+     */
+    static void validate(const DEVICE &device, const std::string &location);
+};
+
+#endif //RASPICSP_DEVICEDATABASE_H
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include "Disassembler.h"
+
+Disassembler::Disassembler(const DEVICE &device) : device(device) {
+}
+
+std::string Disassembler::file_register(uint32_t addr) {
+    if (addr == device.NVMCON_ADDR) {
+        return "NVMCON";
+    }
+    if (addr == device.TBLPAG_ADDR) {
+        return "TBLPAG";
+    }
+    if (addr == device.VISI_ADDR) {
+        return "VISI";
+    }
+
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "0x%04x", addr);
+    return buffer;
+}
+
+std::string Disassembler::operand(uint32_t reg, uint32_t mode) {
+    static const char *FORMATS[] = {"W%u", "[W%u]", "[W%u--]", "[W%u++]", "[--W%u]", "[++W%u]"};
+
+    char buffer[16];
+    if (mode > 5) {
+        snprintf(buffer, sizeof(buffer), "?W%u", reg);
+    } else {
+        snprintf(buffer, sizeof(buffer), FORMATS[mode], reg);
+    }
+    return buffer;
+}
+
+std::string Disassembler::disassemble(uint32_t op_code) {
+    char buffer[64];
+    op_code &= 0xffffffu;
+
+    if (op_code == 0 || (op_code & 0xff0000u) == 0xff0000u) {
+        return "NOP";
+    }
+    if ((op_code & 0xf00000u) == 0x200000u) {
+        snprintf(buffer, sizeof(buffer), "MOV #0x%04x, W%u", (op_code >> 4) & 0xffffu, op_code & 0xfu);
+        return buffer;
+    }
+    if ((op_code & 0xf80000u) == 0x880000u) {
+        snprintf(buffer, sizeof(buffer), "MOV W%u, %s", op_code & 0xfu,
+                 file_register((op_code >> 3) & 0xfffeu).c_str());
+        return buffer;
+    }
+    if ((op_code & 0xf80000u) == 0x800000u) {
+        snprintf(buffer, sizeof(buffer), "MOV %s, W%u", file_register((op_code >> 3) & 0xfffeu).c_str(),
+                 op_code & 0xfu);
+        return buffer;
+    }
+    if ((op_code & 0xff0000u) == 0xa80000u) {
+        snprintf(buffer, sizeof(buffer), "BSET %s, #%u", file_register(op_code & 0x1ffeu).c_str(),
+                 ((op_code >> 12) & 0xeu) | (op_code & 0x1u));
+        return buffer;
+    }
+    if ((op_code & 0xff0000u) == 0x040000u) {
+        snprintf(buffer, sizeof(buffer), "GOTO 0x%06x", op_code & 0xfffeu);
+        return buffer;
+    }
+    if ((op_code & 0xffc000u) == 0x090000u) {
+        snprintf(buffer, sizeof(buffer), "REPEAT #%u", op_code & 0x3fffu);
+        return buffer;
+    }
+    uint32_t alu = op_code & 0xf80000u;
+    if (alu == 0x400000u || alu == 0x480000u || alu == 0x600000u || alu == 0x680000u) {
+        const char *name = alu == 0x400000u ? "ADD" : alu == 0x480000u ? "ADDC" : alu == 0x600000u ? "AND" : "XOR";
+        snprintf(buffer, sizeof(buffer), "%s%s W%u, %s, %s", name, (op_code & 0x4000u) ? ".B" : "",
+                 (op_code >> 15) & 0xfu, operand(op_code & 0xfu, (op_code >> 4) & 0x7u).c_str(),
+                 operand((op_code >> 7) & 0xfu, (op_code >> 11) & 0x7u).c_str());
+        return buffer;
+    }
+    if ((op_code & 0xfe0000u) == 0xba0000u) {
+        const char *names[] = {"TBLRDL", "TBLRDH", "TBLWTL", "TBLWTH"};
+        uint32_t write = (op_code >> 16) & 1;
+        uint32_t high = (op_code >> 15) & 1;
+        snprintf(buffer, sizeof(buffer), "%s%s %s, %s", names[write * 2 + high], (op_code & 0x4000u) ? ".B" : "",
+                 operand(op_code & 0xfu, (op_code >> 4) & 0x7u).c_str(),
+                 operand((op_code >> 7) & 0xfu, (op_code >> 11) & 0x7u).c_str());
+        return buffer;
+    }
+
+    snprintf(buffer, sizeof(buffer), ".word 0x%06x", op_code);
+    return buffer;
+}
@@ -0,0 +1,46 @@
+//
+// Converts op codes back into PIC24 mnemonics
+//
+
+#ifndef RASPICSP_DISASSEMBLER_H
+#define RASPICSP_DISASSEMBLER_H
+
+#include <stdint.h>
+#include <string>
+#include "devices.h"
+
+/*
+ * Disassembles the instructions emitted by the programmer (the inverse of PIC24::LDI, STO, TBLWTL...).
+ *
+ * Only the subset of the instruction set used via ICSP is known, everything else is shown as plain
+ * word. Addresses of the registers used while programming (NVMCON, TBLPAG and VISI) are shown by name.
+ */
+class Disassembler {
+private:
+    const DEVICE &device;
+
+    /*
+     * Formats a file register address
+     */
+    std::string file_register(uint32_t addr);
+
+    /*
+     * Formats a register operand using the given addressing mode (see TBL_MODE)
+     */
+    std::string operand(uint32_t reg, uint32_t mode);
+
+public:
+
+    /*
+     * Creates a new disassembler which names the registers of the given device
+     */
+    Disassembler(const DEVICE &device);
+
+    /*
+     * Returns the mnemonic and the operands of the given op code
+     */
+    std::string disassemble(uint32_t op_code);
+};
+
+
+#endif //RASPICSP_DISASSEMBLER_H
@@ -0,0 +1,143 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <string>
+#include "ElfFile.h"
+
+#ifndef EM_DSPIC30F
+#define EM_DSPIC30F 118
+#endif
+
+ElfFile::ElfFile() {
+    data = NULL;
+    size = 0;
+    header = NULL;
+}
+
+ElfFile::~ElfFile() {
+    release();
+}
+
+void ElfFile::release() {
+    if (data != NULL) {
+        munmap((void *) data, size);
+        data = NULL;
+        size = 0;
+    }
+    header = NULL;
+    segments.clear();
+}
+
+int ElfFile::is_elf(const char *name) {
+    unsigned char ident[SELFMAG];
+    FILE *in = fopen(name, "rb");
+    if (in == NULL) {
+        return 0;
+    }
+    int result = fread(ident, sizeof(ident), 1, in) == 1 && memcmp(ident, ELFMAG, SELFMAG) == 0;
+    fclose(in);
+    return result;
+}
+
+void ElfFile::load(const char *name) {
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("Cannot open ") + name);
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        throw std::runtime_error(std::string("Cannot read ") + name);
+    }
+    if ((size_t) info.st_size < sizeof(Elf32_Ehdr)) {
+        close(fd);
+        throw std::runtime_error(std::string("Not an ELF file for a PIC24: ") + name);
+    }
+
+    void *mapping = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error(std::string("Cannot map ") + name);
+    }
+
+    release();
+    data = (const uint8_t *) mapping;
+    size = (size_t) info.st_size;
+    if (!attach()) {
+        release();
+        throw std::runtime_error(std::string("Not an ELF file for a PIC24: ") + name);
+    }
+}
+
+int ElfFile::attach() {
+    header = (const Elf32_Ehdr *) data;
+    if (memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 || header->e_ident[EI_CLASS] != ELFCLASS32 ||
+        header->e_ident[EI_DATA] != ELFDATA2LSB || header->e_machine != EM_DSPIC30F ||
+        header->e_phentsize != sizeof(Elf32_Phdr) ||
+        (uint64_t) header->e_phoff + (uint64_t) header->e_phnum * sizeof(Elf32_Phdr) > size) {
+        return 0;
+    }
+
+    const Elf32_Phdr *program_headers = (const Elf32_Phdr *) (data + header->e_phoff);
+    for (uint32_t i = 0; i < header->e_phnum; i++) {
+        const Elf32_Phdr &segment = program_headers[i];
+        if (segment.p_type != PT_LOAD || segment.p_filesz == 0 || (segment.p_flags & PF_W)) {
+            continue;
+        }
+        if ((uint64_t) segment.p_offset + segment.p_filesz > size) {
+            return 0;
+        }
+        segments.push_back(&segment);
+    }
+    return 1;
+}
+
+void ElfFile::compile(MemoryImage &memory) const {
+    for (size_t i = 0; i < segments.size(); i++) {
+        memory.set_bytes(segments[i]->p_paddr, data + segments[i]->p_offset, segments[i]->p_filesz);
+    }
+}
+
+void ElfFile::get_sections(std::vector<ElfSection> &sections, uint32_t config_start) const {
+    sections.clear();
+    if (header->e_shoff == 0 || header->e_shentsize != sizeof(Elf32_Shdr) || header->e_shstrndx >= header->e_shnum ||
+        (uint64_t) header->e_shoff + (uint64_t) header->e_shnum * sizeof(Elf32_Shdr) > size) {
+        return;
+    }
+    const Elf32_Shdr *section_headers = (const Elf32_Shdr *) (data + header->e_shoff);
+    const Elf32_Shdr &names = section_headers[header->e_shstrndx];
+    if ((uint64_t) names.sh_offset + names.sh_size > size) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < header->e_shnum; i++) {
+        const Elf32_Shdr &section = section_headers[i];
+        if (!(section.sh_flags & SHF_ALLOC) || (section.sh_flags & SHF_WRITE) || section.sh_type == SHT_NOBITS ||
+            section.sh_size == 0) {
+            continue;
+        }
+
+        // The address of the section itself may be in the PSV window, the segment gives its location in flash
+        for (size_t j = 0; j < segments.size(); j++) {
+            const Elf32_Phdr &segment = *segments[j];
+            if (section.sh_offset < segment.p_offset || section.sh_offset >= segment.p_offset + segment.p_filesz) {
+                continue;
+            }
+            ElfSection result;
+            const char *name = (const char *) data + names.sh_offset + section.sh_name;
+            result.name = section.sh_name < names.sh_size &&
+                          memchr(name, 0, names.sh_size - section.sh_name) != NULL ? name : "";
+            result.address = segment.p_paddr + (section.sh_offset - segment.p_offset) / 2;
+            result.size = section.sh_size / 2;
+            result.type = result.address >= config_start ? ElfSection::CONFIG
+                                                         : section.sh_flags & SHF_EXECINSTR ? ElfSection::CODE
+                                                                                            : ElfSection::CONST;
+            sections.push_back(result);
+            break;
+        }
+    }
+}
@@ -0,0 +1,106 @@
+//
+// Reads an ELF file produced by XC16, which contains program code.
+//
+
+#ifndef RASPICSP_ELFFILE_H
+#define RASPICSP_ELFFILE_H
+
+#include <elf.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "MemoryImage.h"
+
+/*
+ * Describes a section of program memory
+ */
+class ElfSection {
+public:
+
+    enum TYPE {
+        CODE, CONST, CONFIG
+    };
+
+    const char *name;
+
+    /*
+     * Contains the address of the section in PC units (where it is programmed, even if it is accessed
+     * through the PSV window)
+     */
+    uint32_t address;
+
+    /*
+     * Contains the size of the section in PC units
+     */
+    uint32_t size;
+
+    TYPE type;
+};
+
+/*
+ * Used to read the program memory from an ELF file built by XC16 (instead of converting it into a hex
+ * file first).
+ *
+ * The file is mapped into memory and only the loadable segments are read from the mapping. XC16 stores
+ * program memory in the same layout as a hex file: each instruction takes four bytes (the lower 16 bits,
+ * the upper 8 bits and the phantom byte), i.e. two bytes per PC unit, starting at the physical address
+ * of the segment (given in PC units). Writable segments are located in data memory (which is
+ * initialized by the startup code) and are ignored.
+ */
+class ElfFile {
+public:
+
+    ElfFile();
+    ~ElfFile();
+
+    /*
+     * Loads the given file
+     */
+    void load(const char *name);
+
+    /*
+     * Determines if the given file is an ELF file
+     */
+    static int is_elf(const char *name);
+
+    /*
+     * Compiles the content of the loadable segments into the given memory image
+     */
+    void compile(MemoryImage &memory) const;
+
+    /*
+     * Returns the sections of program memory. Sections at or above the given address are treated as config words,
+     * all others as code (if executable) or constant data.
+     */
+    void get_sections(std::vector<ElfSection> &sections, uint32_t config_start) const;
+
+private:
+
+    /*
+     * Contains the mapping of the file
+     */
+    const uint8_t *data;
+    size_t size;
+
+    const Elf32_Ehdr *header;
+
+    /*
+     * Contains the loadable segments in program memory
+     */
+    std::vector<const Elf32_Phdr *> segments;
+
+    /*
+     * Releases the mapping of the file (if any)
+     */
+    void release();
+
+    /*
+     * Checks the headers and collects the segments. Returns 0 if the file isn't a valid ELF file for a PIC24.
+     */
+    int attach();
+
+    ElfFile(const ElfFile &);
+    ElfFile &operator=(const ElfFile &);
+};
+
+#endif //RASPICSP_ELFFILE_H
@@ -0,0 +1,173 @@
+#include <sys/fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <string>
+#include "GPIOChipHAL.h"
+#include "Logger.h"
+
+GPIOChipHAL::GPIOChipHAL(const char *chip, uint8_t mclr_pin, uint8_t pgd_pin, uint8_t pgc_pin,
+                         Delay::SOURCE delay_source, uint32_t half_period_ns) :
+        clock(check_source(delay_source), 0) {
+    Logger::log("HAL", "Starting HAL on %s, lines %d (MCRL), %d (PGD) and %d (PGC)", chip, mclr_pin, pgd_pin,
+                pgc_pin);
+    Logger::log("HAL", "PGC half period: %d ns", half_period_ns);
+    half_period = clock.ticks_for(half_period_ns);
+#ifdef HAL_TIMING
+    timing.set_nominal_half_period(half_period_ns);
+#endif
+
+    int chip_fd = open(chip, O_RDWR | O_CLOEXEC);
+    if (chip_fd < 0) {
+        throw std::runtime_error(std::string("Cannot open ") + chip);
+    }
+
+    struct gpio_v2_line_request request;
+    memset(&request, 0, sizeof(request));
+    // The order of the offsets has to match MCLR_LINE, PGC_LINE and PGD_LINE
+    request.offsets[0] = mclr_pin;
+    request.offsets[1] = pgc_pin;
+    request.offsets[2] = pgd_pin;
+    request.num_lines = 3;
+    strncpy(request.consumer, "raspicsp", sizeof(request.consumer) - 1);
+    request.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+    request.config.num_attrs = 1;
+    request.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    request.config.attrs[0].attr.values = 0;
+    request.config.attrs[0].mask = MCLR_LINE | PGC_LINE | PGD_LINE;
+
+    int result = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &request);
+    close(chip_fd);
+    if (result < 0) {
+        throw std::runtime_error(std::string("Cannot request the GPIO lines of ") + chip);
+    }
+
+    line_fd = request.fd;
+    values = 0;
+}
+
+GPIOChipHAL::~GPIOChipHAL() {
+    close(line_fd);
+}
+
+Delay::SOURCE GPIOChipHAL::check_source(Delay::SOURCE source) {
+    if (source == Delay::SYSTEM_TIMER) {
+        throw std::runtime_error("The system timer requires /dev/mem and cannot be used with a GPIO chip");
+    }
+    return source;
+}
+
+void GPIOChipHAL::set_lines(uint64_t mask, uint64_t bits) {
+    values = (values & ~mask) | bits;
+
+    struct gpio_v2_line_values line_values;
+    line_values.mask = mask;
+    line_values.bits = bits;
+    if (ioctl(line_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &line_values) < 0) {
+        throw std::runtime_error("Cannot set the values of the GPIO lines");
+    }
+}
+
+uint64_t GPIOChipHAL::get_lines(uint64_t mask) {
+    struct gpio_v2_line_values line_values;
+    line_values.mask = mask;
+    line_values.bits = 0;
+    if (ioctl(line_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &line_values) < 0) {
+        throw std::runtime_error("Cannot read the values of the GPIO lines");
+    }
+    return line_values.bits;
+}
+
+void GPIOChipHAL::configure(int pgd_input) {
+    struct gpio_v2_line_config config;
+    memset(&config, 0, sizeof(config));
+    config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+
+    // Without explicit values, outputs would be reset to 0 - which would reset the device via MCLR
+    uint64_t outputs = MCLR_LINE | PGC_LINE | (pgd_input ? 0 : PGD_LINE);
+    config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    config.attrs[0].attr.values = values & outputs;
+    config.attrs[0].mask = outputs;
+    config.num_attrs = 1;
+
+    if (pgd_input) {
+        config.attrs[1].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+        config.attrs[1].attr.flags = GPIO_V2_LINE_FLAG_INPUT;
+        config.attrs[1].mask = PGD_LINE;
+        config.num_attrs = 2;
+    }
+
+    if (ioctl(line_fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0) {
+        throw std::runtime_error("Cannot change the direction of PGD");
+    }
+}
+
+void GPIOChipHAL::mclr_up() {
+    set_lines(MCLR_LINE, MCLR_LINE);
+}
+
+void GPIOChipHAL::mclr_down() {
+    set_lines(MCLR_LINE, 0);
+}
+
+void GPIOChipHAL::write_mode() {
+    configure(0);
+}
+
+void GPIOChipHAL::read_mode() {
+    configure(1);
+}
+
+void GPIOChipHAL::write_bit(int bit) {
+    set_lines(PGD_LINE | PGC_LINE, (bit ? PGD_LINE : 0) | PGC_LINE);
+    TIMING_EDGE(timing);
+    clock.wait_ticks(half_period);
+    set_lines(PGC_LINE, 0);
+    TIMING_EDGE(timing);
+    clock.wait_ticks(half_period);
+}
+
+int GPIOChipHAL::read_bit() {
+    set_lines(PGC_LINE, PGC_LINE);
+    TIMING_EDGE(timing);
+    clock.wait_ticks(half_period);
+    int result = get_lines(PGD_LINE) ? 1 : 0;
+    set_lines(PGC_LINE, 0);
+    TIMING_EDGE(timing);
+    clock.wait_ticks(half_period);
+
+    return result;
+}
+
+void GPIOChipHAL::shift_out(uint32_t value, int nbits, bool lsb_first) {
+    for (int i = 0; i < nbits; i++) {
+        uint32_t bit = (value >> (lsb_first ? i : nbits - 1 - i)) & 1;
+        set_lines(PGD_LINE | PGC_LINE, (bit ? PGD_LINE : 0) | PGC_LINE);
+        TIMING_EDGE(timing);
+        clock.wait_ticks(half_period);
+        set_lines(PGC_LINE, 0);
+        TIMING_EDGE(timing);
+        clock.wait_ticks(half_period);
+    }
+}
+
+uint32_t GPIOChipHAL::shift_in(int nbits, bool lsb_first) {
+    uint32_t result = 0;
+    for (int i = 0; i < nbits; i++) {
+        set_lines(PGC_LINE, PGC_LINE);
+        TIMING_EDGE(timing);
+        clock.wait_ticks(half_period);
+        uint32_t bit = get_lines(PGD_LINE) ? 1 : 0;
+        set_lines(PGC_LINE, 0);
+        TIMING_EDGE(timing);
+        clock.wait_ticks(half_period);
+        result |= bit << (lsb_first ? i : nbits - 1 - i);
+    }
+    return result;
+}
+
+void GPIOChipHAL::sample_all(uint32_t *values) {
+    values[0] = get_lines(PGD_LINE) ? 1 : 0;
+}
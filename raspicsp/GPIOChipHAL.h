@@ -0,0 +1,89 @@
+//
+// Defines the HAL backend which uses the GPIO character device of the linux kernel.
+//
+
+#ifndef RASPICSP_GPIOCHIPHAL_H
+#define RASPICSP_GPIOCHIPHAL_H
+
+#include "HAL.h"
+#include "Delay.h"
+
+/*
+ * Drives MCLR, PGC and PGD using the GPIO character device (/dev/gpiochipN, uAPI v2).
+ *
+ * In contrast to RaspberryHAL this neither requires root privileges nor any knowledge about the
+ * SoC - it works on any board (and with the gpio-sim kernel module) as long as the user has access
+ * to the chip device. The price is one ioctl per pin change. As the device latches PGD on the
+ * falling edge of PGC, PGD is updated together with the rising edge of PGC, so that writing a bit
+ * only takes two calls.
+ */
+class GPIOChipHAL : public HAL {
+private:
+
+    /*
+     * Contains the bits of the lines within the line request
+     */
+    static const uint64_t MCLR_LINE = 1;
+    static const uint64_t PGC_LINE = 2;
+    static const uint64_t PGD_LINE = 4;
+
+    int line_fd;
+    uint64_t values;
+    Delay clock;
+    uint64_t half_period;
+
+    /*
+     * Sets the lines selected by mask to the given values
+     */
+    void set_lines(uint64_t mask, uint64_t bits);
+
+    /*
+     * Reads the lines selected by mask
+     */
+    uint64_t get_lines(uint64_t mask);
+
+    /*
+     * Configures all lines as outputs except PGD, which becomes an input if requested. The current
+     * output values are retained.
+     */
+    void configure(int pgd_input);
+
+    /*
+     * Ensures that the given source can be used without mapping /dev/mem
+     */
+    static Delay::SOURCE check_source(Delay::SOURCE source);
+
+public:
+
+    /*
+     * Requests the given line offsets of the given chip (e.g. /dev/gpiochip0) as MCLR, PGD and PGC.
+     */
+    GPIOChipHAL(const char *chip, uint8_t mclr_pin, uint8_t pgd_pin, uint8_t pgc_pin,
+                Delay::SOURCE delay_source, uint32_t half_period_ns);
+
+    /*
+     * Releases the requested lines
+     */
+    virtual ~GPIOChipHAL();
+
+    virtual void mclr_up();
+
+    virtual void mclr_down();
+
+    virtual void write_mode();
+
+    virtual void read_mode();
+
+    virtual void write_bit(int bit);
+
+    virtual int read_bit();
+
+    virtual void shift_out(uint32_t value, int nbits, bool lsb_first);
+
+    virtual uint32_t shift_in(int nbits, bool lsb_first);
+
+    virtual void sample_all(uint32_t *values);
+};
+
+
+#endif //RASPICSP_GPIOCHIPHAL_H
@@ -5,102 +5,135 @@
 #ifndef RASPICSP_HAL_H
 #define RASPICSP_HAL_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include "TimingProbe.h"
 
 /*
- * The Hardware Abstraction Layer contains raspberry PI specific code to drive the
- * GPIO pins in order to behave as required for the pins MCLR (reset pin), PGC (clock), PGD (data).
+ * Enumerates the steps of a precompiled sequence of PGC cycles (see Transaction)
  */
-class HAL {
-private:
+enum CYCLE {
+    CYCLE_LOW = 0,
+    CYCLE_HIGH = 1,
+    CYCLE_READ = 2,
+    CYCLE_READ_MODE = 3,
+    CYCLE_WRITE_MODE = 4
+};
 
-    static const uint32_t BCM2708_PERI_BASE = 0x20000000;
-    static const uint32_t GPIO_BASE = BCM2708_PERI_BASE + 0x200000;
-    static const uint32_t BLOCK_SIZE = 4096;
-    static const uint32_t PERIOD_MICRO_SECONDS = 1;
+/*
+ * The Hardware Abstraction Layer describes how the pins MCLR (reset pin), PGC (clock) and PGD (data)
+ * of the connected device are driven.
+ *
+ * The actual work is done by a backend, like RaspberryHAL (which talks to the GPIO registers of the
+ * raspberry PI) or SimulatorHAL (which drives a software model of the device).
+ */
+class HAL {
+public:
 
-    uint8_t mclr_pin;
-    uint8_t pgd_pin;
-    uint8_t pgc_pin;
-    volatile unsigned *gpio;
+    /*
+     * Contains the maximal number of targets which can be driven in parallel (gang programming)
+     */
+    static const int MAX_TARGETS = 32;
 
+#ifdef HAL_TIMING
     /*
-     * Maps the GPIO pins into the address space of our process to gain control
+     * Records the timing of the PGC edges (only present in instrumented builds)
      */
-    void setup_io();
+    TimingProbe timing;
+#endif
+
+    virtual ~HAL();
 
     /*
-     * Initializes the GPIO pins as required
+     * Raises the reset pin to 1
      */
-    void setup_pins();
+    virtual void mclr_up() = 0;
 
     /*
-     * Makes the given pin an input pin
+     * Lowers the reset pin to 0
      */
-    void make_input(uint8_t pin);
+    virtual void mclr_down() = 0;
 
     /*
-     * Makes the given pin an output pin
+     * Enables write mode (PCD is an output)
      */
-    void make_output(uint8_t pin);
+    virtual void write_mode() = 0;
 
     /*
-     * Writes a 1 (high) to the given pin
+     * Enables read mode (PGD is an input)
      */
-    void set_pin(uint8_t pin);
+    virtual void read_mode() = 0;
 
     /*
-     * Writes a 0 (low) to the given pin
+     * Writes a bit (sets PGD to 0 or 1 depending on bit and emits a plus on PGC).
      */
-    void clear_pin(uint8_t pin);
+    virtual void write_bit(int bit) = 0;
 
     /*
-     * Reads the value of the given pin
+     * Reads a bit (reads PCD while sending a pulse on PGC)
      */
-    int read_pin(uint8_t pin);
+    virtual int read_bit() = 0;
 
     /*
-     * Delays the execution my the given number of microseconds
+     * Writes the lower nbits of value (starting with the least or most significant bit) by
+     * emitting one PGC pulse per bit.
      */
-    void delayMicrosecondsHard(unsigned int howLong);
+    virtual void shift_out(uint32_t value, int nbits, bool lsb_first);
 
-public:
+    /*
+     * Reads nbits (PGD must be in read mode) and returns them assembled to a word. The first bit
+     * read is either the least or the most significant bit of the result.
+     */
+    virtual uint32_t shift_in(int nbits, bool lsb_first);
 
     /*
-     * Creates a new instance which uses the given GPIOs as MCLR, PGD und PGC
+     * Returns the number of targets connected to this HAL. All targets receive the same bits, but each
+     * one has its own PGD line to answer.
      */
-    HAL(uint8_t mclr_pin, uint8_t pgd_pin, uint8_t pgc_pin);
+    virtual int targets();
 
     /*
-     * Raises the reset pin to 1
+     * Selects the targets (bit i represents target i) which are driven. Deselected targets are no longer
+     * clocked (as far as the wiring permits) and their PGD lines are ignored until they are selected again.
      */
-    void mclr_up();
+    virtual void select_targets(uint32_t mask);
 
     /*
-     * Lowers the reset pin to 0
+     * Reads nbits from every target at once (like shift_in) and stores the result of target i in
+     * values[i]. The values of deselected targets are undefined.
      */
-    void mclr_down();
+    virtual void shift_in_all(int nbits, bool lsb_first, uint32_t *values);
 
     /*
-     * Enables write mode (PCD is an output)
+     * Reads the current level of PGD (without clocking) of every target and stores it in values[i].
+     * This is used to detect the handshake of the programming executive.
      */
-    void write_mode();
+    virtual void sample_all(uint32_t *values);
 
     /*
-     * Enables read mode (PGD is an input)
+     * Polls PGD of all targets (every interval microseconds) until it is low or until timeout microseconds
+     * have elapsed. Returns the targets (bit i represents target i) whose PGD remained high.
      */
-    void read_mode();
+    virtual uint32_t wait_ready(uint32_t timeout, uint32_t interval);
 
     /*
-     * Writes a bit (sets PGD to 0 or 1 depending on bit and emits a plus on PGC).
+     * Executes the given sequence of cycles. CYCLE_LOW and CYCLE_HIGH write a bit, CYCLE_READ reads a bit
+     * and CYCLE_READ_MODE / CYCLE_WRITE_MODE switch the direction of PGD without clocking. For each read
+     * bit, a sample is stored in levels (which has to be converted using decode_levels).
      */
-    void write_bit(int bit);
+    virtual void replay(const uint8_t *cycles, size_t count, uint32_t *levels);
 
     /*
-     * Reads a bit (reads PCD while sending a pulse on PGC)
+     * Converts nbits samples (as recorded by replay) into one value per target (like shift_in_all). By
+     * default, bit i of a sample contains the bit read from target i.
      */
-    int read_bit();
+    virtual void decode_levels(const uint32_t *levels, int nbits, bool lsb_first, uint32_t *values);
 
+    /*
+     * Waits the given number of microseconds without clocking the device. This is used
+     * for the rather long delays required when entering or leaving ICSP mode.
+     */
+    virtual void delay(unsigned int micros);
 };
 
 
@@ -1,60 +1,260 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <iterator>
+#include <stdexcept>
+#include <string>
 #include "HexFile.h"
-#include <iomanip>
+
+const uint16_t HexFile::DIGITS[256] = {
+        0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,
+        0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,
+        0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,
+        0x000, 0x001, 0x002, 0x003, 0x004, 0x005, 0x006, 0x007, 0x008, 0x009, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,
+        0x100, 0x00a, 0x00b, 0x00c, 0x00d, 0x00e, 0x00f, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,
+        0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,
+        0x100, 0x00a, 0x00b, 0x00c, 0x00d, 0x00e, 0x00f, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,
+        0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,
+        0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,
+        0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,
+        0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,
+        0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,
+        0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,
+        0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,
+        0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,
+        0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100
+};
+
+HexFile::HexFile() {
+    record_count = 0;
+    begin();
+}
+
+void HexFile::begin() {
+    base = 0;
+    line = 1;
+    finished = 0;
+}
+
+int HexFile::parse(const char *name) {
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("Cannot open ") + name);
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        throw std::runtime_error(std::string("Cannot read ") + name);
+    }
+    if (info.st_size == 0) {
+        close(fd);
+        return parse("", 0);
+    }
+
+    void *text = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) {
+        throw std::runtime_error(std::string("Cannot map ") + name);
+    }
+    int result = parse((const char *) text, (size_t) info.st_size);
+    munmap(text, (size_t) info.st_size);
+
+    return result;
+}
+
+uint32_t HexFile::decode_word(const uint8_t *text, uint32_t &invalid) {
+    // Each of the eight characters occupies one byte lane (the first one in the lowest lane)
+    const uint64_t ONES = 0x0101010101010101ull;
+    const uint64_t HIGH = 0x8080808080808080ull;
+    uint64_t x = (uint64_t) text[0] | (uint64_t) text[1] << 8 | (uint64_t) text[2] << 16 | (uint64_t) text[3] << 24 |
+                 (uint64_t) text[4] << 32 | (uint64_t) text[5] << 40 | (uint64_t) text[6] << 48 |
+                 (uint64_t) text[7] << 56;
+
+    // A lane of (x | HIGH) - n * ONES keeps its high bit if the character is at least n
+    uint64_t lower = x | 0x2020202020202020ull;
+    uint64_t digit = ((x | HIGH) - '0' * ONES) & ~((x | HIGH) - ('9' + 1) * ONES) & HIGH;
+    uint64_t alpha = ((lower | HIGH) - 'a' * ONES) & ~((lower | HIGH) - ('f' + 1) * ONES) & HIGH;
+    invalid |= (uint32_t) (((x | ~(digit | alpha)) & HIGH) != 0) << 8;
+
+    // Combine the nibbles of neighbouring lanes and pack the resulting four bytes
+    uint64_t nibbles = (x & 0x0f0f0f0f0f0f0f0full) + (alpha >> 7) * 9;
+    uint64_t bytes = ((nibbles << 4) | (nibbles >> 8)) & 0x00ff00ff00ff00ffull;
+    bytes |= bytes >> 8;
+    return (uint32_t) (bytes & 0xffffu) | (uint32_t) ((bytes >> 16) & 0xffff0000u);
+}
+
+uint32_t HexFile::decode_bytes(const uint8_t *text, uint32_t count, uint8_t *out) {
+    uint32_t invalid = 0;
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t value = decode_byte(text + 2 * i);
+        invalid |= value;
+        sum += value;
+        out[i] = (uint8_t) value;
+    }
+    return (sum & 0xffu) | (invalid & ~0xffu);
+}
+
+uint32_t HexFile::decode_record(const uint8_t *text, uint32_t count, uint8_t *out) {
+#ifdef __SSE2__
+    // Characters are compared as signed bytes: adding 0x80 - first moves the range to the lowest values
+    const __m128i LANES = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i valid = _mm_set1_epi8(-1);
+    __m128i sum = _mm_setzero_si128();
+    for (uint32_t i = 0; i < count; i += 8, text += 16, out += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) text);
+        __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+        __m128i digit = _mm_cmplt_epi8(_mm_add_epi8(x, _mm_set1_epi8((char) (0x80 - '0'))), _mm_set1_epi8(-128 + 10));
+        __m128i alpha = _mm_cmplt_epi8(_mm_add_epi8(lower, _mm_set1_epi8((char) (0x80 - 'a'))), _mm_set1_epi8(-128 + 6));
+
+        // Only the characters of the record count, the remainder of the last block is ignored
+        __m128i used = _mm_cmpgt_epi8(_mm_set1_epi8((char) (count - i < 8 ? 2 * (count - i) : 16)), LANES);
+        valid = _mm_and_si128(valid, _mm_or_si128(_mm_or_si128(digit, alpha), _mm_xor_si128(used, _mm_set1_epi8(-1))));
+
+        // Every 16 bit lane holds two digits, the first one in the lower byte
+        __m128i nibbles = _mm_add_epi8(_mm_and_si128(x, _mm_set1_epi8(0x0f)), _mm_and_si128(alpha, _mm_set1_epi8(9)));
+        __m128i bytes = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(nibbles, 4), _mm_set1_epi16(0xf0)),
+                                     _mm_srli_epi16(nibbles, 8));
+        bytes = _mm_packus_epi16(bytes, bytes);
+        _mm_storel_epi64((__m128i *) out, bytes);
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_and_si128(bytes, _mm_packs_epi16(used, used)), _mm_setzero_si128()));
+    }
+
+    return ((uint32_t) _mm_cvtsi128_si32(sum) & 0xffu) | (_mm_movemask_epi8(valid) != 0xffff ? 0x100u : 0);
+#else
+    uint32_t invalid = 0;
+    uint32_t sum = 0;
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        uint32_t value = decode_word(text + 2 * i, invalid);
+        sum += value + (value >> 8) + (value >> 16) + (value >> 24);
+        out[i] = (uint8_t) value;
+        out[i + 1] = (uint8_t) (value >> 8);
+        out[i + 2] = (uint8_t) (value >> 16);
+        out[i + 3] = (uint8_t) (value >> 24);
+    }
+    uint32_t rest = decode_bytes(text + 2 * i, count - i, out + i);
+    return ((sum + rest) & 0xffu) | ((invalid | rest) & ~0xffu);
+#endif
+}
 
 int HexFile::parse(std::istream &input) {
-    int line_number = 0;
-    while (!input.eof()) {
-        std::string line;
-        line_number++;
-        std::getline(input, line);
-        if (line.substr(0, 1) != ":") {
-            if (line != "") {
-                return -line_number;
-            }
-        } else {
-            HexEntry entry;
-            entry.numBytes = (uint8_t) std::stoul(line.substr(1, 2), 0, 16);
-            entry.addr = (uint32_t) std::stoul(line.substr(3, 4), 0, 16);
-            entry.type = (uint8_t) std::stoul(line.substr(7, 2), 0, 16);
-            unsigned long position = 9;
-            for (int i = 0; i < entry.numBytes; i++) {
-                entry.data.push_back((uint8_t) std::stoul(line.substr(position, 2), 0, 16));
-                position += 2;
+    std::string text((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    return parse(text.data(), text.size());
+}
+
+int HexFile::parse(const char *text, size_t length) {
+    begin();
+    return parse_part(text, length);
+}
+
+int HexFile::parse_part(const char *text, size_t length) {
+    // A file can't contain more records or data bytes than this, so the arenas don't grow while parsing
+    if (records.size() < length / MIN_RECORD_LENGTH + 1) {
+        records.resize(length / MIN_RECORD_LENGTH + 1);
+    }
+    if (arena.size() < length / 2 + 8) {
+        arena.resize(length / 2 + 8);
+    }
+    HexRecord *record = records.data();
+    record_count = 0;
+    uint8_t *first = arena.data();
+    uint8_t *out = first;
+
+    const uint8_t *pos = (const uint8_t *) text;
+    const uint8_t *end = finished ? pos : pos + length;
+    int count = 0;
+    while (pos < end) {
+        if (*pos != ':') {
+            if (*pos == '\n') {
+                line++;
+            } else if (*pos != '\r' && *pos != ' ' && *pos != '\t') {
+                return -line;
             }
-            entry.checksum = (uint32_t) std::stoul(line.substr(position, 2), 0, 16);
-            entries.push_back(entry);
+            pos++;
+            continue;
+        }
+        if ((size_t) (end - pos) < MIN_RECORD_LENGTH) {
+            return -line;
+        }
+
+        // Length, address, type, data and checksum are decoded at once (all have to be valid hex digits)
+        const uint8_t *digits = pos + 1;
+        uint32_t total = 5 + decode_byte(digits);
+        if (total > 0x104 || (size_t) (end - digits) < 2 * total) {
+            return -line;
+        }
+        // Decoding the record as blocks may read up to 16 characters (and write up to 8 bytes) beyond it
+        uint32_t check = (size_t) (end - digits) >= 16 * ((total + 7) / 8) ? decode_record(digits, total, out)
+                                                                           : decode_bytes(digits, total, out);
+        pos = digits + 2 * total;
+        if (check != 0 || (pos < end && *pos != '\r' && *pos != '\n' && *pos != ' ' && *pos != '\t')) {
+            return -line;
+        }
+        count++;
+
+        // The arena keeps the whole record, the data starts after length, address and type (all other records
+        // aren't kept)
+        uint32_t bytes = out[0];
+        uint32_t type = out[3];
+        const uint8_t *data = out + 4;
+        if (type == 0) {
+            record->addr = base + (out[1] << 8 | out[2]);
+            record->offset = (uint32_t) (data - first);
+            record->length = bytes;
+            record++;
+            out += total;
+        } else if (type == 1 && bytes == 0) {
+            finished = 1;
+        } else if (type == 2 && bytes == 2) {
+            base = (uint32_t) (data[0] << 8 | data[1]) << 4;
+        } else if (type == 4 && bytes == 2) {
+            base = (uint32_t) (data[0] << 8 | data[1]) << 16;
+        } else if (type != 5 || bytes != 4) {
+            return -line;
+        }
+
+        // Skip the line break right away
+        if (pos < end && *pos == '\r') {
+            pos++;
+        }
+        if (pos < end && *pos == '\n') {
+            pos++;
+            line++;
+        }
+        if (finished) {
+            break;
         }
     }
 
-    return (int) entries.size();
+    record_count = (size_t) (record - records.data());
+    return count;
 }
 
-bool compareMemoryEntry(const MemoryWord &left, const MemoryWord &right) {
-    return left.address < right.address;
+size_t HexFile::get_record_count() const {
+    return record_count;
 }
 
-void HexFile::compileTo16BitWords(std::list<MemoryWord> &memory) {
+const HexRecord *HexFile::get_records() const {
+    return records.data();
+}
+
+const uint8_t *HexFile::record_data(const HexRecord &record) const {
+    return arena.data() + record.offset;
+}
+
+void HexFile::compile(MemoryImage &memory) {
     memory.clear();
-    uint32_t current_upper = 0;
-    std::list<HexEntry>::const_iterator iterator;
-    for (iterator = entries.begin(); iterator != entries.end(); ++iterator) {
-        HexEntry const entry = *iterator;
-
-        if (entry.type == 4) {
-            current_upper = ((entry.data[0] & 0xFFu) << 8) | (entry.data[1] & 0xFFu);
-        } else if (entry.type == 0) {
-            int idx = 0;
-            uint32_t base_address = ((current_upper & 0xFFFFu) << 16 | entry.addr) >> 1;
-            while (idx < entry.numBytes) {
-                MemoryWord word;
-                word.address = base_address;
-                word.data = ((entry.data[idx + 1] & 0xFFu) << 8) | (entry.data[idx] & 0xFFu);
-                idx += 2;
-                base_address++;
-                memory.push_back(word);
-            }
-        }
-    }
+    append(memory);
+}
 
-    memory.sort(compareMemoryEntry);
+void HexFile::append(MemoryImage &memory) {
+    const HexRecord *iterator;
+    for (iterator = records.data(); iterator != records.data() + record_count; ++iterator) {
+        memory.set_bytes(iterator->addr >> 1, record_data(*iterator), iterator->length);
+    }
 }
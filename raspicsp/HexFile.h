@@ -6,70 +6,156 @@
 #define RASPICSP_HEXFILE_H
 
 #include <inttypes.h>
-#include <list>
+#include <stddef.h>
 #include <istream>
-#include <ostream>
 #include <vector>
+#include "MemoryImage.h"
 
 /*
- * Represents one line of a hex file
+ * Represents a data record of a hex file. The data itself is kept in the arena of the file.
  */
-class HexEntry {
+class HexRecord {
 public:
     /*
-     * Contains the number of bytes in this entry
-     */
-    uint8_t numBytes;
-
-    /*
-     * Contains byte-address of the first byte in this entry
+     * Contains the byte address of the first byte (including the extended segment or linear address)
      */
     uint32_t addr;
 
     /*
-     * Contains the type of the record
-     */
-    uint8_t type;
-
-    /*
-     * Contains the byte-data
+     * Contains the position of the first byte within the arena
      */
-    std::vector<uint8_t> data;
+    uint32_t offset;
 
     /*
-     * Contains a checksum for the byte data
+     * Contains the number of bytes in this record
      */
-    uint32_t checksum;
-};
-
-/*
- * Represents a 16 bit word of memory
- */
-class MemoryWord {
-public:
-    uint32_t address;
-    uint32_t data;
+    uint32_t length;
 };
 
 /*
- * Used to reads a hex file into a list of memory locations
+ * Used to reads a hex file into a memory image.
+ *
+ * The file is mapped into memory and decoded in a single pass. All data bytes are written into one
+ * arena which is sized for the file up front, so that parsing doesn't allocate per record. Every record
+ * has to have a valid checksum and one of the types 00 (data), 01 (end of file), 02 (extended segment
+ * address), 04 (extended linear address) or 05 (start linear address).
  */
 class HexFile {
 public:
 
+    HexFile();
+
     /*
-     * Parses the given stream. Returns the number of lines read or a negative number
+     * Parses the given file. Returns the number of records read or a negative number
      * to indicate the first line which contained invalid data.
      */
+    int parse(const char *name);
+
+    /*
+     * Parses the given stream (see above)
+     */
     int parse(std::istream &input);
 
     /*
-     * Compiles the content of the file into a list of memory locations
+     * Parses the given text (see above)
+     */
+    int parse(const char *text, size_t length);
+
+    /*
+     * Parses the next part of a file given in several parts (like a stream). Each part has to end with
+     * a complete record, the first one has to be preceded by a call to begin. The extended addresses
+     * and the line numbers carry over from the previous parts, the records only contain the ones of
+     * this part. Returns the result like parse.
+     */
+    int parse_part(const char *text, size_t length);
+
+    /*
+     * Starts parsing a new file in parts
+     */
+    void begin();
+
+    /*
+     * Compiles the content of the file into the given memory image (records may be given in any order)
      */
-    void compileTo16BitWords(std::list<MemoryWord> &memory);
+    void compile(MemoryImage &memory);
+
+    /*
+     * Adds the content of the file (or the last part) to the given memory image
+     */
+    void append(MemoryImage &memory);
+
+    /*
+     * Returns the number of data records read by the last parse
+     */
+    size_t get_record_count() const;
+
+    /*
+     * Returns the data records read by the last parse
+     */
+    const HexRecord *get_records() const;
+
+    /*
+     * Returns the data of the given record
+     */
+    const uint8_t *record_data(const HexRecord &record) const;
 
 private:
-    std::list<HexEntry> entries;
+
+    /*
+     * Contains the number of characters of the shortest possible record (":00000001FF")
+     */
+    static const size_t MIN_RECORD_LENGTH = 11;
+
+    /*
+     * Contains the value of each hex digit or 0x100 for all other characters
+     */
+    static const uint16_t DIGITS[256];
+
+    /*
+     * Contains the data records. Like the arena, it is only grown, so that parsing several files reuses the
+     * same memory (only the first record_count entries are valid).
+     */
+    std::vector<HexRecord> records;
+    size_t record_count;
+
+    /*
+     * Contains the state which carries over from one part to the next: the current extended address,
+     * the current line and whether the end of file record was found
+     */
+    uint32_t base;
+    int line;
+    int finished;
+
+    /*
+     * Contains all records as decoded bytes (length, address, type, data and checksum)
+     */
+    std::vector<uint8_t> arena;
+
+    /*
+     * Decodes the two hex digits at the given position. Returns a value above 0xff if these aren't
+     * hex digits.
+     */
+    static inline uint32_t decode_byte(const uint8_t *text) {
+        return (uint32_t) (DIGITS[text[0]] << 4) | DIGITS[text[1]];
+    }
+
+    /*
+     * Decodes the eight hex digits at the given position into four bytes (the first one in the lowest
+     * bits) at once. Sets a bit above 0xff in invalid if these aren't hex digits.
+     */
+    static uint32_t decode_word(const uint8_t *text, uint32_t &invalid);
+
+    /*
+     * Decodes the given number of bytes from the hex digits at the given position. Returns the sum of the
+     * bytes (modulo 256) and sets a bit above 0xff if these aren't hex digits.
+     */
+    static uint32_t decode_bytes(const uint8_t *text, uint32_t count, uint8_t *out);
+
+    /*
+     * Decodes a record like decode_bytes, but in blocks of eight bytes (using SSE2 if available). Therefore,
+     * up to 16 characters beyond the record may be read and up to 8 bytes beyond it may be written.
+     */
+    static uint32_t decode_record(const uint8_t *text, uint32_t count, uint8_t *out);
 };
 
 #endif //RASPICSP_HEXFILE_H
@@ -0,0 +1,86 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <string>
+#include "HexStream.h"
+
+HexStream::HexStream(int fd, const char *name) : fd(fd), name(name) {
+    used = 0;
+    file.begin();
+}
+
+const MemoryImage &HexStream::get_image() const {
+    return image;
+}
+
+int HexStream::read(std::vector<uint32_t> &complete) {
+    if (buffer.size() < used + CHUNK_SIZE) {
+        buffer.resize(used + CHUNK_SIZE);
+    }
+    ssize_t count;
+    do {
+        count = ::read(fd, &buffer[used], CHUNK_SIZE);
+    } while (count < 0 && errno == EINTR);
+    if (count < 0) {
+        throw std::runtime_error(std::string("Cannot read ") + name);
+    }
+
+    if (count == 0) {
+        process(&buffer[0], used, complete);
+        used = 0;
+        return 0;
+    }
+    used += (size_t) count;
+
+    // Only complete lines are parsed, the rest is kept until the next part arrives
+    size_t end = used;
+    while (end > 0 && buffer[end - 1] != '\n') {
+        end--;
+    }
+    if (end > 0) {
+        process(&buffer[0], end, complete);
+        memmove(&buffer[0], &buffer[end], used - end);
+        used -= end;
+    }
+    return 1;
+}
+
+void HexStream::process(const char *text, size_t length, std::vector<uint32_t> &complete) {
+    int result = file.parse_part(text, length);
+    if (result < 0) {
+        throw std::runtime_error(std::string("Invalid record in line ") + std::to_string(-result) + " of " + name);
+    }
+
+    // Rows which were already reported may have been programmed, so they must not change anymore
+    uint32_t row_size = 2 * MemoryImage::ROW_SIZE;
+    const HexRecord *records = file.get_records();
+    size_t count = file.get_record_count();
+    for (size_t i = 0; i < count; i++) {
+        if (records[i].length == 0) {
+            continue;
+        }
+        uint32_t last = (records[i].addr + records[i].length - 1) >> 1;
+        for (uint32_t row = (records[i].addr >> 1) / row_size * row_size; row <= last; row += row_size) {
+            if (reported.count(row) != 0) {
+                char address[16];
+                snprintf(address, sizeof(address), "0x%06x", row);
+                throw std::runtime_error(std::string("The row at ") + address + " is given again in " + name);
+            }
+        }
+    }
+    file.append(image);
+
+    for (size_t i = 0; i < count; i++) {
+        if (records[i].length == 0) {
+            continue;
+        }
+        uint32_t last = (records[i].addr + records[i].length - 1) >> 1;
+        for (uint32_t row = (records[i].addr >> 1) / row_size * row_size; row <= last; row += row_size) {
+            if (image.is_complete(row) && reported.insert(row).second) {
+                complete.push_back(row);
+            }
+        }
+    }
+}
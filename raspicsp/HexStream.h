@@ -0,0 +1,69 @@
+//
+// Reads a hex file from a stream (like a pipe) part by part
+//
+
+#ifndef RASPICSP_HEXSTREAM_H
+#define RASPICSP_HEXSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <set>
+#include <vector>
+#include "HexFile.h"
+#include "MemoryImage.h"
+
+/*
+ * Reads whatever is available from a file descriptor, parses the complete records and adds them to a
+ * memory image. Rows are reported as soon as all of their words were given, so that they can be
+ * programmed while the rest of the file is still being received. Rows which are never completed stay
+ * in the image until the end of the input.
+ */
+class HexStream {
+public:
+
+    /*
+     * Contains the number of bytes read at once
+     */
+    static const size_t CHUNK_SIZE = 65536;
+
+    /*
+     * Creates a stream reading from the given file descriptor (the name is used in error messages)
+     */
+    HexStream(int fd, const char *name);
+
+    /*
+     * Reads and parses the next part of the input. The addresses of the rows which became complete are
+     * appended to complete. Returns 0 once the end of the input was reached.
+     */
+    int read(std::vector<uint32_t> &complete);
+
+    /*
+     * Returns the image containing everything read so far
+     */
+    const MemoryImage &get_image() const;
+
+private:
+
+    int fd;
+    const char *name;
+    HexFile file;
+    MemoryImage image;
+
+    /*
+     * Contains the input which wasn't parsed yet (the beginning of an incomplete line)
+     */
+    std::vector<char> buffer;
+    size_t used;
+
+    /*
+     * Contains the rows which were reported as complete
+     */
+    std::set<uint32_t> reported;
+
+    /*
+     * Parses the given complete lines and reports the rows which became complete
+     */
+    void process(const char *text, size_t length, std::vector<uint32_t> &complete);
+};
+
+#endif //RASPICSP_HEXSTREAM_H
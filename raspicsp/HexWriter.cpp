@@ -0,0 +1,76 @@
+#include <stdexcept>
+#include "HexWriter.h"
+
+HexWriter::HexWriter(FILE *out) : out(out) {
+    used = 0;
+    upper = 0xffffffffu;
+}
+
+void HexWriter::record(uint8_t type, uint16_t addr, const uint8_t *data, int count) {
+    // A record needs at most 11 characters plus two per byte
+    if (used + 11 + 2 * count > BUFFER_SIZE) {
+        flush();
+    }
+
+    static const char DIGITS[] = "0123456789ABCDEF";
+    uint8_t header[] = {(uint8_t) count, (uint8_t) (addr >> 8), (uint8_t) addr, type};
+    uint8_t checksum = 0;
+    char *pos = buffer + used;
+    *pos++ = ':';
+    for (int i = 0; i < 4 + count; i++) {
+        uint8_t byte = i < 4 ? header[i] : data[i - 4];
+        checksum += byte;
+        *pos++ = DIGITS[byte >> 4];
+        *pos++ = DIGITS[byte & 0xfu];
+    }
+    checksum = (uint8_t) -checksum;
+    *pos++ = DIGITS[checksum >> 4];
+    *pos++ = DIGITS[checksum & 0xfu];
+    *pos++ = '\n';
+    used = (int) (pos - buffer);
+}
+
+void HexWriter::flush() {
+    if (used > 0 && fwrite(buffer, 1, (size_t) used, out) != (size_t) used) {
+        throw std::runtime_error("Cannot write the hex file");
+    }
+    used = 0;
+}
+
+void HexWriter::write(uint32_t addr, const uint32_t *instructions, uint32_t count) {
+    uint8_t data[RECORD_SIZE];
+    int length = 0;
+    uint32_t start = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t byte_addr = (addr + 2 * i) * 2;
+        // A record ends when it is full or at the end of a 64k segment
+        if (length > 0 && (length == RECORD_SIZE || (byte_addr & 0xffffu) == 0)) {
+            record(0, (uint16_t) start, data, length);
+            length = 0;
+        }
+        if ((byte_addr >> 16) != upper) {
+            upper = byte_addr >> 16;
+            uint8_t segment[] = {(uint8_t) (upper >> 8), (uint8_t) upper};
+            record(4, 0, segment, 2);
+        }
+        if (length == 0) {
+            start = byte_addr & 0xffffu;
+        }
+
+        data[length++] = (uint8_t) instructions[i];
+        data[length++] = (uint8_t) (instructions[i] >> 8);
+        data[length++] = (uint8_t) (instructions[i] >> 16);
+        data[length++] = 0;
+    }
+    if (length > 0) {
+        record(0, (uint16_t) start, data, length);
+    }
+}
+
+void HexWriter::close() {
+    record(1, 0, NULL, 0);
+    flush();
+    if (fflush(out) != 0) {
+        throw std::runtime_error("Cannot write the hex file");
+    }
+}
@@ -0,0 +1,70 @@
+//
+// Writes program code as hex file.
+//
+
+#ifndef RASPICSP_HEXWRITER_H
+#define RASPICSP_HEXWRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Writes instructions as "Intel HEX" records, using the layout of the compilers from Microchip
+ * (which is expected by HexFile::compile): each instruction occupies four bytes (its
+ * three bytes, LSB first, followed by a zero byte) at twice its address.
+ *
+ * Records are formatted into a fixed buffer which is written whenever it is full, so that
+ * arbitrary amounts of code can be streamed into a file (or a pipe) with constant memory.
+ */
+class HexWriter {
+private:
+
+    /*
+     * Contains the number of data bytes per record
+     */
+    static const int RECORD_SIZE = 16;
+
+    /*
+     * Contains the size of the output buffer
+     */
+    static const int BUFFER_SIZE = 8192;
+
+    FILE *out;
+    char buffer[BUFFER_SIZE];
+    int used;
+
+    /*
+     * Contains the upper 16 bits of the byte address set by the last extended linear address record
+     */
+    uint32_t upper;
+
+    /*
+     * Appends a record of the given type with the given data to the buffer
+     */
+    void record(uint8_t type, uint16_t addr, const uint8_t *data, int count);
+
+    /*
+     * Writes the contents of the buffer to the file
+     */
+    void flush();
+
+public:
+
+    /*
+     * Creates a writer which writes into the given file
+     */
+    HexWriter(FILE *out);
+
+    /*
+     * Writes count instructions starting at the given address
+     */
+    void write(uint32_t addr, const uint32_t *instructions, uint32_t count);
+
+    /*
+     * Writes the end of file record and flushes the buffer
+     */
+    void close();
+};
+
+
+#endif //RASPICSP_HEXWRITER_H
@@ -1,84 +1,161 @@
-#include <unistd.h>
 #include "ICSP.h"
 #include "Logger.h"
 
+void ICSP::mclr(int level) {
+    if (capture != NULL) {
+        capture->record(Capture::MCLR, level);
+    }
+    if (level) {
+        hal.mclr_up();
+    } else {
+        hal.mclr_down();
+    }
+}
+
+void ICSP::delay(uint32_t micros) {
+    if (capture != NULL) {
+        capture->record(Capture::DELAY, micros);
+    }
+    hal.delay(micros);
+}
+
+void ICSP::record_results(uint64_t time, const uint32_t *values) {
+    int targets = hal.targets();
+    for (int target = 0; target < targets; target++) {
+        if ((selected >> target) & 1) {
+            capture->record(time, Capture::RESULT, values[target], 0, (uint8_t) target);
+        }
+    }
+}
+
+void ICSP::enter(uint32_t code) {
+    Logger::trace("ICSP", "Entering Konami Code: 0x%08x (%d bits)", code, device.ICSP_CODE_LENGTH);
+
+    mclr(1);
+    delay(100);
+    mclr(0);
+    delay(100);
+
+    if (capture != NULL) {
+        capture->record(Capture::KEY, code, (uint16_t) device.ICSP_CODE_LENGTH);
+    }
+    hal.shift_out(code, device.ICSP_CODE_LENGTH, false);
+
+    delay(20000);
+    mclr(1);
+    delay(50000);
+}
+
 void ICSP::enter_ICSP() {
     Logger::log("ICSP", "Entering ICSP mode");
-    Logger::trace("ICSP", "Entering Konami Code: 0x%08x (%d bits)", device.ICSP_CODE, device.ICSP_CODE_LENGTH);
+    enter(device.ICSP_CODE);
+
+    // The first SIX command after entering ICSP requires 5 additional clock cycles
+    if (capture != NULL) {
+        capture->record(Capture::CLOCKS, 0, 5);
+    }
+    hal.shift_out(0, 5, true);
+}
 
-    hal.mclr_up();
-    usleep(100);
-    hal.mclr_down();
-    usleep(100);
+void ICSP::enter_enhanced() {
+    Logger::log("ICSP", "Entering enhanced ICSP mode");
+    mclr(0);
+    delay(5000);
+    enter(device.EICSP_CODE);
+}
 
-    uint32_t bit = 1u << (device.ICSP_CODE_LENGTH - 1);
-    for (uint8_t i = 0; i < device.ICSP_CODE_LENGTH; i++) {
-        hal.write_bit((device.ICSP_CODE & bit) > 0 ? 1 : 0);
-        bit = bit >> 1;
+uint32_t ICSP::send_command(const uint16_t *words, int count, uint32_t timeout) {
+    if (Logger::is_tracing()) {
+        Logger::trace("ICSP", "<< PE 0x%04x (%d words)", words[0], count);
+    }
+    for (int i = 0; i < count; i++) {
+        if (capture != NULL) {
+            capture->record(Capture::PE_WORD, words[i]);
+        }
+        hal.shift_out(words[i], 16, false);
     }
 
-    usleep(20000);
-    hal.mclr_up();
-    usleep(50000);
+    // The executive holds PGD high while it is busy and pulls it low as soon as its response is ready
+    if (capture != NULL) {
+        capture->record(Capture::HANDSHAKE, timeout, HANDSHAKE_POLL_INTERVAL);
+    }
+    hal.read_mode();
+    uint32_t pending = hal.wait_ready(timeout, HANDSHAKE_POLL_INTERVAL);
+    if (capture != NULL) {
+        capture->record(Capture::MISSING, pending);
+    }
+    delay(RESPONSE_DELAY);
 
-    hal.write_bit(0);
-    hal.write_bit(0);
-    hal.write_bit(0);
-    hal.write_bit(0);
-    hal.write_bit(0);
+    return pending;
+}
+
+void ICSP::receive_response(int count, std::vector<uint16_t> &words) {
+    uint64_t time = capture != NULL ? Delay::now() : 0;
+    int targets = hal.targets();
+    uint32_t results[HAL::MAX_TARGETS] = {0};
+    words.resize(count * targets);
+    if (capture != NULL) {
+        capture->record(time, Capture::PE_READ, count);
+    }
+    for (int i = 0; i < count; i++) {
+        hal.shift_in_all(16, false, results);
+        for (int target = 0; target < targets; target++) {
+            words[i * targets + target] = (uint16_t) results[target];
+        }
+        if (capture != NULL) {
+            record_results(time, results);
+        }
+    }
+    hal.write_mode();
+
+    if (Logger::is_tracing() && count > 0) {
+        Logger::trace("ICSP", ">> PE 0x%04x (%d words)", words[0], count);
+    }
 }
 
 void ICSP::write_SIX(uint32_t op_code) {
     if (Logger::is_tracing()) {
         Logger::trace("ICSP", "<< 0x%06x", op_code);
     }
-    hal.write_bit(0);
-    hal.write_bit(0);
-    hal.write_bit(0);
-    hal.write_bit(0);
-    uint32_t bit = 1;
-    for (uint8_t i = 0; i < 24; i++) {
-        hal.write_bit((op_code & bit) > 0 ? 1 : 0);
-        bit = bit << 1;
+    if (capture != NULL) {
+        capture->record(Capture::SIX, op_code);
     }
+    // Control code 0000 followed by the 24 bit op code
+    hal.shift_out(op_code << 4, 28, true);
 }
 
-uint16_t ICSP::read_VISI() {
-    hal.write_bit(1);
-    hal.write_bit(0);
-    hal.write_bit(0);
-    hal.write_bit(0);
+void ICSP::read_VISI(std::vector<uint16_t> &values) {
+    uint64_t time = 0;
+    if (capture != NULL) {
+        time = Delay::now();
+        capture->record(time, Capture::VISI, 0);
+    }
 
-    hal.write_bit(0);
-    hal.write_bit(0);
-    hal.write_bit(0);
-    hal.write_bit(0);
-    hal.write_bit(0);
-    hal.write_bit(0);
-    hal.write_bit(0);
-    hal.write_bit(0);
+    // Control code 0001 followed by 8 idle cycles
+    hal.shift_out(0x001, 12, true);
 
+    uint32_t results[HAL::MAX_TARGETS] = {0};
     hal.read_mode();
+    hal.shift_in_all(16, true, results);
+    hal.write_mode();
 
-    uint16_t result = 0;
-    uint16_t bit = 1;
-    for (uint8_t i = 0; i < 16; i++) {
-        if (hal.read_bit()) {
-            result |= bit;
-        }
-        bit = bit << 1;
+    values.resize(hal.targets());
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i] = (uint16_t) results[i];
+    }
+    if (capture != NULL) {
+        record_results(time, results);
     }
-
-    hal.write_mode();
 
     if (Logger::is_tracing()) {
-        Logger::trace("ICSP", ">> 0x%04x", result);
+        Logger::trace("ICSP", ">> 0x%04x", values[0]);
     }
-
-    return result;
 }
 
-ICSP::ICSP(HAL &hal, const DEVICE &device) : hal(hal), device(device) {
+ICSP::ICSP(HAL &hal, const DEVICE &device, Capture *capture) : hal(hal), device(device), capture(capture) {
+    // Devices dropped by a previous session on the same HAL are tried again
+    selected = 0xffffffffu;
+    hal.select_targets(selected);
     enter_ICSP();
 }
 
@@ -87,15 +164,70 @@ ICSP &ICSP::operator<<(uint32_t op_code) {
     return *this;
 }
 
-ICSP &ICSP::operator>>(uint16_t &visi_contents) {
-    visi_contents = read_VISI();
+ICSP &ICSP::operator>>(std::vector<uint16_t> &visi_contents) {
+    read_VISI(visi_contents);
     return *this;
 }
 
-ICSP::~ICSP() {
-    hal.mclr_down();
-    usleep(5000);
-    hal.mclr_up();
+void ICSP::execute(Transaction &transaction) {
+    uint64_t time = capture != NULL ? Delay::now() : 0;
+    hal.replay(&transaction.cycles[0], transaction.cycles.size(),
+               transaction.levels.empty() ? NULL : &transaction.levels[0]);
+
+    int targets = hal.targets();
+    transaction.targets = targets;
+    transaction.values.resize(transaction.reads * targets);
+    uint32_t results[HAL::MAX_TARGETS] = {0};
+    for (int read = 0; read < transaction.reads; read++) {
+        hal.decode_levels(&transaction.levels[read * 16], 16, true, results);
+        for (int i = 0; i < targets; i++) {
+            transaction.values[read * targets + i] = (uint16_t) results[i];
+        }
+    }
+
+    // The whole transaction is clocked out in one go, therefore all its steps share a timestamp
+    if (capture != NULL) {
+        int read = 0;
+        for (size_t i = 0; i < transaction.steps.size(); i++) {
+            if (transaction.steps[i] == Transaction::VISI_STEP) {
+                capture->record(time, Capture::VISI, 0);
+                for (int target = 0; target < targets; target++) {
+                    results[target] = transaction.values[read * targets + target];
+                }
+                record_results(time, results);
+                read++;
+            } else {
+                capture->record(time, Capture::SIX, transaction.steps[i]);
+            }
+        }
+    }
+
+    if (Logger::is_tracing()) {
+        int read = 0;
+        for (size_t i = 0; i < transaction.steps.size(); i++) {
+            if (transaction.steps[i] == Transaction::VISI_STEP) {
+                Logger::trace("ICSP", ">> 0x%04x", transaction.values[read++ * targets]);
+            } else {
+                Logger::trace("ICSP", "<< 0x%06x", transaction.steps[i]);
+            }
+        }
+    }
 }
 
+int ICSP::targets() {
+    return hal.targets();
+}
 
+void ICSP::select_targets(uint32_t mask) {
+    selected = mask;
+    if (capture != NULL) {
+        capture->record(Capture::SELECT, mask);
+    }
+    hal.select_targets(mask);
+}
+
+ICSP::~ICSP() {
+    mclr(0);
+    delay(5000);
+    mclr(1);
+}
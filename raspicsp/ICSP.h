@@ -6,8 +6,11 @@
 #ifndef RASPICSP_ICSP_H
 #define RASPICSP_ICSP_H
 
+#include <vector>
+#include "Capture.h"
 #include "HAL.h"
 #include "devices.h"
+#include "Transaction.h"
 
 /*
  * Contains the execution engine for the In Circuit Serial Programmer.
@@ -19,28 +22,58 @@ class ICSP {
 private:
     HAL &hal;
     const DEVICE &device;
+    Capture *capture;
+    uint32_t selected;
+
+    /*
+     * Contains the interval (in microseconds) in which PGD is polled while waiting for the
+     * programming executive to respond
+     */
+    static const uint32_t HANDSHAKE_POLL_INTERVAL = 10;
+
+    /*
+     * Contains the time (in microseconds) to wait after the programming executive signaled that
+     * it is ready before its response is clocked out
+     */
+    static const uint32_t RESPONSE_DELAY = 12;
+
+    /*
+     * Sets MCLR to the given level
+     */
+    void mclr(int level);
+
+    /*
+     * Records the values read from all selected targets
+     */
+    void record_results(uint64_t time, const uint32_t *values);
 
     /*
      * Enters the ICSP mode by sending a strictly defined bit pattern while holding MCLR low
      */
     void enter_ICSP();
 
+    /*
+     * Resets the device and sends the given code to enter a programming mode
+     */
+    void enter(uint32_t code);
+
     /*
      * Sends an op code to the device
      */
     void write_SIX(uint32_t op_code);
 
     /*
-     * Reads the contents of the VISI register
+     * Reads the contents of the VISI register of all targets
      */
-    uint16_t read_VISI();
+    void read_VISI(std::vector<uint16_t> &values);
 
 public:
 
     /*
-     * Creates a new ICSP engine for the given HAL and device
+     * Creates a new ICSP engine for the given HAL and device. If a capture is given, all traffic
+     * is recorded into it.
      */
-    ICSP(HAL &hal, const DEVICE &device);
+    ICSP(HAL &hal, const DEVICE &device, Capture *capture = NULL);
 
     /*
      * Resets the device to exit ICSP mode
@@ -53,9 +86,50 @@ public:
     ICSP &operator<<(uint32_t op_code);
 
     /*
-     * Fancy way of receiving contents of the VISI register
+     * Fancy way of receiving contents of the VISI register. As all targets are programmed in parallel,
+     * the vector receives one value per target (values of deselected targets are undefined).
+     */
+    ICSP &operator>>(std::vector<uint16_t> &visi_contents);
+
+    /*
+     * Executes the given transaction and stores the captured VISI contents in it
+     */
+    void execute(Transaction &transaction);
+
+    /*
+     * Enters the enhanced ICSP mode. Instead of executing SIX commands, the device now runs its
+     * programming executive which receives commands via send_command.
+     */
+    void enter_enhanced();
+
+    /*
+     * Sends a command (given as words) to the programming executive and waits (at most timeout
+     * microseconds) until the executive of each target signals that its response is ready. Returns
+     * the targets (bit i represents target i) which didn't respond in time.
+     */
+    uint32_t send_command(const uint16_t *words, int count, uint32_t timeout);
+
+    /*
+     * Receives the given number of words as response of the last command. words[i * targets() + t]
+     * contains word i as sent by target t.
+     */
+    void receive_response(int count, std::vector<uint16_t> &words);
+
+    /*
+     * Waits for the given number of microseconds
+     */
+    void delay(uint32_t micros);
+
+    /*
+     * Returns the number of targets programmed in parallel
+     */
+    int targets();
+
+    /*
+     * Selects the targets (bit i represents target i) which are programmed. A deselected target can be
+     * selected again, but it only follows the commands after entering ICSP mode again (as a new session does).
      */
-    ICSP &operator>>(uint16_t &visi_contents);
+    void select_targets(uint32_t mask);
 };
 
 
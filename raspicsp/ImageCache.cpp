@@ -0,0 +1,99 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdexcept>
+#include "ImageCache.h"
+#include "Logger.h"
+
+ImageCache::ImageCache(Loader loader, size_t capacity) : loader(loader), capacity(capacity) {
+    uses = 0;
+}
+
+ImageCache::~ImageCache() {
+    for (size_t i = 0; i < entries.size(); i++) {
+        delete entries[i].bundle;
+    }
+}
+
+void ImageCache::read_file(const char *name, std::vector<uint8_t> &content) {
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("Cannot open ") + name);
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        throw std::runtime_error(std::string("Cannot read ") + name);
+    }
+
+    content.clear();
+    if (info.st_size > 0) {
+        void *mapping = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error(std::string("Cannot map ") + name);
+        }
+        const uint8_t *data = (const uint8_t *) mapping;
+        content.assign(data, data + info.st_size);
+        munmap(mapping, (size_t) info.st_size);
+    }
+    close(fd);
+}
+
+uint64_t ImageCache::hash(const std::vector<uint8_t> &content) {
+    uint64_t result = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < content.size(); i++) {
+        result = (result ^ content[i]) * 0x100000001b3ull;
+    }
+    return result;
+}
+
+const Bundle &ImageCache::get(const char *name, const DEVICE &device) {
+    std::vector<uint8_t> content;
+    read_file(name, content);
+    uint64_t content_hash = hash(content);
+    uses++;
+    for (size_t i = 0; i < entries.size(); i++) {
+        // Different files may have the same hash, so the content is compared as well
+        if (entries[i].hash == content_hash && entries[i].device == device.NAME && entries[i].content == content) {
+            Logger::log("cache", "Using the cached image of %s (%016llx)", name, (unsigned long long) content_hash);
+            entries[i].last_used = uses;
+            return *entries[i].bundle;
+        }
+    }
+
+    Bundle *bundle = new Bundle();
+    try {
+        loader(name, device, *bundle);
+        std::vector<uint8_t> loaded;
+        read_file(name, loaded);
+        if (loaded != content) {
+            throw std::runtime_error(std::string(name) + " was changed while it was read");
+        }
+    } catch (...) {
+        delete bundle;
+        throw;
+    }
+
+    if (entries.size() >= capacity) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < entries.size(); i++) {
+            if (entries[i].last_used < entries[oldest].last_used) {
+                oldest = i;
+            }
+        }
+        delete entries[oldest].bundle;
+        entries.erase(entries.begin() + oldest);
+    }
+    Entry entry;
+    entry.hash = content_hash;
+    entry.device = device.NAME;
+    entry.bundle = bundle;
+    entry.last_used = uses;
+    entries.push_back(entry);
+    entries.back().content.swap(content);
+    Logger::log("cache", "Image of %s cached (%016llx, %d of %d entries)", name, (unsigned long long) content_hash,
+                (int) entries.size(), (int) capacity);
+    return *bundle;
+}
@@ -0,0 +1,73 @@
+//
+// Keeps the firmware images used by recent jobs of the daemon
+//
+
+#ifndef RASPICSP_IMAGECACHE_H
+#define RASPICSP_IMAGECACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Bundle.h"
+#include "devices.h"
+
+/*
+ * Caches the bundles built from firmware files, keyed by the content of the file (and the device, as the
+ * bundle depends on it). A file which is given again is only read and compared instead of parsed, even if
+ * it was replaced by a file with the same content. The least recently used bundle is dropped when the
+ * cache is full.
+ */
+class ImageCache {
+public:
+
+    /*
+     * Reads the given firmware file (hex, ELF or bundle) into a bundle for the given device
+     */
+    typedef void (*Loader)(const char *name, const DEVICE &device, Bundle &bundle);
+
+    /*
+     * Creates a cache for up to the given number of bundles which are read by the given loader
+     */
+    ImageCache(Loader loader, size_t capacity = 8);
+    ~ImageCache();
+
+    /*
+     * Returns the bundle of the given file for the given device. It remains valid until the next call.
+     */
+    const Bundle &get(const char *name, const DEVICE &device);
+
+private:
+
+    /*
+     * Describes a cached bundle. The content of the file is kept as well, as the hash only selects the
+     * entries which are compared.
+     */
+    struct Entry {
+        uint64_t hash;
+        std::vector<uint8_t> content;
+        std::string device;
+        Bundle *bundle;
+        uint64_t last_used;
+    };
+
+    Loader loader;
+    size_t capacity;
+    std::vector<Entry> entries;
+    uint64_t uses;
+
+    /*
+     * Reads the content of the given file
+     */
+    static void read_file(const char *name, std::vector<uint8_t> &content);
+
+    /*
+     * Computes a 64 bit FNV-1a hash of the given content
+     */
+    static uint64_t hash(const std::vector<uint8_t> &content);
+
+    ImageCache(const ImageCache &);
+    ImageCache &operator=(const ImageCache &);
+};
+
+#endif //RASPICSP_IMAGECACHE_H
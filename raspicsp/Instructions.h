@@ -0,0 +1,194 @@
+//
+// Contains the encoders of the PIC24 instructions sent as SIX commands
+//
+
+#ifndef RASPICSP_INSTRUCTIONS_H
+#define RASPICSP_INSTRUCTIONS_H
+
+#include <stdint.h>
+#include <stdexcept>
+
+/*
+ * Enumerates all working registers supported by a PIC24
+ */
+enum REG {
+    W0 = 0,
+    W1 = 1,
+    W2 = 2,
+    W3 = 3,
+    W4 = 4,
+    W5 = 5,
+    W6 = 6,
+    W7 = 7,
+    W8 = 8,
+    W9 = 9,
+    W10 = 10,
+    W11 = 11,
+    W12 = 12,
+    W13 = 13,
+    W14 = 14,
+    W15 = 15,
+};
+
+/*
+ * Enumerates the modes when accessing registers in TBLRD* and TBLWT* instructions
+ *
+ * The 16-bit MCU and DSC Programmer’s Reference Manual (DS70157F) gets this wrong!
+ * This seems more accurate: https://en.wikipedia.org/wiki/PIC_instruction_listings
+ */
+enum TBL_MODE {
+    DIRECT = 0,
+    INDIRECT = 1,
+    INDIRECT_POST_DEC = 2,
+    INDIRECT_POST_INC = 3,
+    INDIRECT_PRE_DEC = 4,
+    INDIRECT_PRE_INC = 5
+};
+
+/*
+ * All encoders are constexpr: sequences built from constants (like the arrays in PIC24.cpp) are encoded
+ * by the compiler, and an operand which doesn't fit into an instruction fails to compile there. At runtime,
+ * such an operand throws an exception instead of silently sending a different instruction.
+ */
+
+/*
+ * Represent the NOP instruction
+ */
+constexpr uint32_t NOP = 0;
+
+/*
+ * Returns the given op code if its operands are valid
+ */
+constexpr uint32_t checked(bool valid, uint32_t op_code, const char *error) {
+    return valid ? op_code : throw std::runtime_error(error);
+}
+
+/*
+ * Returns the upper 8 bits of a 24 bit word
+ */
+constexpr uint32_t upper8(uint32_t data) {
+    return (data >> 16) & 0xffu;
+}
+
+/*
+ * Returns the lower 16 bits of a 24 bit word
+ */
+constexpr uint32_t lower16(uint32_t data) {
+    return data & 0xffffu;
+}
+
+/*
+ * Creates a STO instruction which writes the value of the register to the given (even) address in the
+ * first 64 KB of data memory
+ */
+constexpr uint32_t STO(REG reg, uint32_t addr) {
+    return checked(addr <= 0xfffeu && addr % 2 == 0, 0x880000u | (addr << 3) | reg, "Invalid address for STO");
+}
+
+/*
+ * Creates a RET instruction which writes the value at the given address into the given register
+ */
+constexpr uint32_t RET(uint32_t addr, REG reg) {
+    return checked(addr <= 0xfffeu && addr % 2 == 0, 0x800000u | (addr << 3) | reg, "Invalid address for RET");
+}
+
+/*
+ * Creates a LDI instruction which loads the given data (16 bits) into the given register
+ */
+constexpr uint32_t LDI(uint32_t data, REG reg) {
+    return checked(data <= 0xffffu, 0x200000u | (data << 4) | reg, "Invalid literal for LDI");
+}
+
+/*
+ * Sets the given bit at the given address (in the first 8 KB of data memory)
+ */
+constexpr uint32_t BSET(uint32_t addr, uint8_t bit) {
+    return checked(addr <= 0x1ffeu && addr % 2 == 0 && bit < 16,
+                   0xA80000u | addr | ((bit & 0xeu) << 12) | (bit & 0x1u), "Invalid operand for BSET");
+}
+
+/*
+ * Creates a table read or write instruction with the given op code. Table reads require an indirect source,
+ * table writes an indirect destination.
+ */
+constexpr uint32_t TBL(uint32_t op_code, REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode) {
+    return checked((op_code & 0x010000u ? dest_mode : src_mode) != DIRECT,
+                   op_code | (dest_mode << 11) | (dest << 7) | (src_mode << 4) | src,
+                   "Table instructions have to access the memory indirectly");
+}
+
+/*
+ * Creates a TBLRDL instruction which transfers the lower 16 bits of the given memory source
+ * to the given destination register. The addressing modes are determined by src_mode and dest_mode.
+ */
+constexpr uint32_t TBLRDL(REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode) {
+    return TBL(0xBA0000u, src, src_mode, dest, dest_mode);
+}
+
+/*
+ * Creates a TBLRDL instruction which transfers the upper 8 bits of the given memory source
+ * to the given destination register. The addressing modes are determined by src_mode and dest_mode.
+ */
+constexpr uint32_t TBLRDH(REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode) {
+    return TBL(0xBA8000u, src, src_mode, dest, dest_mode);
+}
+
+/*
+ * Creates a TBLRDL instruction which transfers the lower 16 bits of the given source register
+ * to the given memory destination. The addressing modes are determined by src_mode and dest_mode.
+ */
+constexpr uint32_t TBLWTL(REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode) {
+    return TBL(0xBB0000u, src, src_mode, dest, dest_mode);
+}
+
+/*
+ * Creates a TBLWTH instruction which transfers the upper 8 bits of the given source register
+ * to the given memory destination. The addressing modes are determined by src_mode and dest_mode.
+ */
+constexpr uint32_t TBLWTH(REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode) {
+    return TBL(0xBB8000u, src, src_mode, dest, dest_mode);
+}
+
+/*
+ * Creates a TBLWTHB instruction which transfers the upper 8 bits of the given source register
+ * to the given memory destination - in byte mode. The addressing modes are determined by src_mode and dest_mode.
+ */
+constexpr uint32_t TBLWTHB(REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode) {
+    return TBL(0xBBC000u, src, src_mode, dest, dest_mode);
+}
+
+/*
+ * Creates a REPEAT instruction which executes the next instruction count times (up to 16384)
+ */
+constexpr uint32_t REPEAT(uint32_t count) {
+    return checked(count >= 1 && count <= 0x4000u, 0x090000u | (count - 1), "Invalid count for REPEAT");
+}
+
+/*
+ * Creates an ADD, ADDC (add with carry), AND or XOR instruction which combines the base register with the
+ * source operand (using the given addressing mode) and writes the result into the destination register.
+ */
+constexpr uint32_t ADD(REG base, REG src, TBL_MODE src_mode, REG dest) {
+    return 0x400000u | (base << 15) | (dest << 7) | (src_mode << 4) | src;
+}
+
+constexpr uint32_t ADDC(REG base, REG src, TBL_MODE src_mode, REG dest) {
+    return 0x480000u | (base << 15) | (dest << 7) | (src_mode << 4) | src;
+}
+
+constexpr uint32_t AND(REG base, REG src, TBL_MODE src_mode, REG dest) {
+    return 0x600000u | (base << 15) | (dest << 7) | (src_mode << 4) | src;
+}
+
+constexpr uint32_t XOR(REG base, REG src, TBL_MODE src_mode, REG dest) {
+    return 0x680000u | (base << 15) | (dest << 7) | (src_mode << 4) | src;
+}
+
+/*
+ * Creates a JMP instruction which which basically updates the program counter (to an address below 64 K).
+ */
+constexpr uint32_t JMP(uint32_t addr) {
+    return checked(addr <= 0xfffeu && addr % 2 == 0, 0x040000u | addr, "Invalid address for JMP");
+}
+
+#endif //RASPICSP_INSTRUCTIONS_H
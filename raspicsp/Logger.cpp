@@ -3,27 +3,34 @@
 #include "Logger.h"
 
 int Logger::tracing = 0;
+FILE *Logger::output = NULL;
 
 void Logger::log(const char *category, const char *format, ...) {
+    FILE *file = output != NULL ? output : stdout;
     va_list argptr;
     va_start(argptr, format);
-    fprintf(stdout, "[%-8s] ", category);
-    vfprintf(stdout, format, argptr);
-    fprintf(stdout, "\n");
+    fprintf(file, "[%-8s] ", category);
+    vfprintf(file, format, argptr);
+    fprintf(file, "\n");
     va_end(argptr);
 }
 
 void Logger::trace(const char *category, const char *format, ...) {
     if (tracing) {
+        FILE *file = output != NULL ? output : stdout;
         va_list argptr;
         va_start(argptr, format);
-        fprintf(stdout, "<%-8s> ", category);
-        vfprintf(stdout, format, argptr);
-        fprintf(stdout, "\n");
+        fprintf(file, "<%-8s> ", category);
+        vfprintf(file, format, argptr);
+        fprintf(file, "\n");
         va_end(argptr);
     }
 }
 
+void Logger::redirect(FILE *file) {
+    output = file;
+}
+
 void Logger::enable_tracing() {
     tracing = 1;
 }
@@ -5,22 +5,30 @@
 #ifndef RASPICSP_LOGGER_H
 #define RASPICSP_LOGGER_H
 
+#include <stdio.h>
+
 /*
  * Provides simple logging methods
  */
 class Logger {
 private:
     static int tracing;
+    static FILE *output;
 public:
     /*
-     * Logs a printf style message to stdout
+     * Logs a printf style message to stdout (or the file given by redirect)
      */
-    static void log(const char *category, const char *format, ...);
+    static void log(const char *category, const char *format, ...) __attribute__((format(printf, 2, 3)));
 
     /*
      * Logs a printf style message to stdout if tracing is enabled
      */
-    static void trace(const char *category, const char *format, ...);
+    static void trace(const char *category, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+    /*
+     * Writes all messages to the given file instead of stdout (e.g. if stdout receives data)
+     */
+    static void redirect(FILE *file);
 
     /*
      * Enables the output of trace messages
@@ -0,0 +1,122 @@
+#include "MemoryImage.h"
+
+const uint32_t MemoryImage::ROW_SIZE;
+const uint32_t MemoryImage::ERASED;
+
+MemoryImage::MemoryImage() {
+    first_row = 0;
+}
+
+uint32_t *MemoryImage::add_row(uint32_t addr) {
+    uint32_t row = addr / (2 * ROW_SIZE);
+    int32_t slot = find_slot(row);
+    if (slot >= 0) {
+        return &instructions[slot * ROW_SIZE];
+    }
+
+    // The index covers all rows from the lowest to the highest one (which are usually given in ascending order)
+    if (index.empty()) {
+        first_row = row;
+    }
+    if (row < first_row) {
+        index.insert(index.begin(), first_row - row, 0);
+        first_row = row;
+    } else if (row - first_row >= index.size()) {
+        index.resize(row - first_row + 1, 0);
+    }
+
+    slot = (int32_t) (instructions.size() / ROW_SIZE);
+    index[row - first_row] = (uint32_t) slot + 1;
+    instructions.resize(instructions.size() + ROW_SIZE, ERASED);
+    present.resize(present.size() + 2 * ROW_SIZE / 64, 0);
+    return &instructions[slot * ROW_SIZE];
+}
+
+void MemoryImage::set_word(uint32_t addr, uint32_t data) {
+    uint32_t *row = add_row(addr);
+    uint32_t offset = addr % (2 * ROW_SIZE);
+    uint32_t &instruction = row[offset / 2];
+    if (offset % 2 == 0) {
+        instruction = (instruction & 0xff0000u) | (data & 0xffffu);
+    } else {
+        instruction = (instruction & 0xffffu) | ((data & 0xffu) << 16);
+    }
+
+    uint32_t slot = (uint32_t) (row - &instructions[0]) / ROW_SIZE;
+    present[slot * (2 * ROW_SIZE / 64) + offset / 64] |= 1ull << (offset % 64);
+}
+
+void MemoryImage::set_bytes(uint32_t addr, const uint8_t *bytes, uint32_t length) {
+    uint32_t idx = 0;
+    while (idx < length) {
+        // The row is only looked up once for all of its words
+        uint32_t *row = add_row(addr);
+        uint64_t *bits = &present[(size_t) (row - &instructions[0]) / ROW_SIZE * (2 * ROW_SIZE / 64)];
+        for (uint32_t offset = addr % (2 * ROW_SIZE); offset < 2 * ROW_SIZE && idx < length; offset++, idx += 2) {
+            uint32_t data = idx + 1 < length ? (uint32_t) (bytes[idx + 1] << 8 | bytes[idx]) : bytes[idx];
+            uint32_t &instruction = row[offset / 2];
+            if (offset % 2 == 0) {
+                instruction = (instruction & 0xff0000u) | data;
+            } else {
+                instruction = (instruction & 0xffffu) | ((data & 0xffu) << 16);
+            }
+            bits[offset / 64] |= 1ull << (offset % 64);
+            addr++;
+        }
+    }
+}
+
+uint32_t MemoryImage::get_word(uint32_t addr) const {
+    uint32_t instruction = get_instruction(addr & ~1u);
+    return addr % 2 == 0 ? instruction & 0xffffu : instruction >> 16;
+}
+
+bool MemoryImage::has_word(uint32_t addr) const {
+    int32_t slot = find_slot(addr / (2 * ROW_SIZE));
+    uint32_t offset = addr % (2 * ROW_SIZE);
+    return slot >= 0 && (present[slot * (2 * ROW_SIZE / 64) + offset / 64] >> (offset % 64)) & 1;
+}
+
+bool MemoryImage::is_complete(uint32_t addr) const {
+    int32_t slot = find_slot(addr / (2 * ROW_SIZE));
+    if (slot < 0) {
+        return false;
+    }
+    for (uint32_t i = 0; i < 2 * ROW_SIZE / 64; i++) {
+        if (present[slot * (2 * ROW_SIZE / 64) + i] != ~0ull) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t MemoryImage::get_instruction(uint32_t addr) const {
+    int32_t slot = find_slot(addr / (2 * ROW_SIZE));
+    return slot >= 0 ? instructions[slot * ROW_SIZE + (addr % (2 * ROW_SIZE)) / 2] : ERASED;
+}
+
+const uint32_t *MemoryImage::get_row(uint32_t addr) const {
+    int32_t slot = find_slot(addr / (2 * ROW_SIZE));
+    return slot >= 0 ? &instructions[slot * ROW_SIZE] : NULL;
+}
+
+void MemoryImage::get_rows(std::vector<uint32_t> &rows, uint32_t from, uint32_t to) const {
+    rows.clear();
+    for (uint32_t i = 0; i < index.size(); i++) {
+        uint32_t addr = (first_row + i) * 2 * ROW_SIZE;
+        if (index[i] != 0 && addr >= from && addr < to) {
+            rows.push_back(addr);
+        }
+    }
+}
+
+size_t MemoryImage::row_count() const {
+    return instructions.size() / ROW_SIZE;
+}
+
+void MemoryImage::clear() {
+    first_row = 0;
+    index.clear();
+    instructions.clear();
+    present.clear();
+}
@@ -0,0 +1,131 @@
+//
+// Contains the program memory given by a hex file
+//
+
+#ifndef RASPICSP_MEMORYIMAGE_H
+#define RASPICSP_MEMORYIMAGE_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+
+/*
+ * Represents a 16 bit word of memory
+ */
+class MemoryWord {
+public:
+    uint32_t address;
+    uint32_t data;
+};
+
+/*
+ * Stores the program memory as rows of instructions (the unit in which the flash is written). Rows are
+ * only created once a word within them is set, all other instructions of a row remain erased.
+ *
+ * Addresses are given like everywhere else (in PC units): an even address contains the lower 16 bits of
+ * an instruction, the following odd address its upper 8 bits.
+ */
+class MemoryImage {
+public:
+
+    /*
+     * Contains the number of instructions per row
+     */
+    static const uint32_t ROW_SIZE = 64;
+
+    /*
+     * Contains the value of an erased instruction
+     */
+    static const uint32_t ERASED = 0xffffff;
+
+    MemoryImage();
+
+    /*
+     * Sets the 16 bit word at the given address
+     */
+    void set_word(uint32_t addr, uint32_t data);
+
+    /*
+     * Sets the words starting at the given address from the given bytes, laid out like in a hex file: two
+     * bytes (lower byte first) per word, i.e. four per instruction including the phantom byte
+     */
+    void set_bytes(uint32_t addr, const uint8_t *bytes, uint32_t length);
+
+    /*
+     * Returns the 16 bit word at the given address (erased if it wasn't set)
+     */
+    uint32_t get_word(uint32_t addr) const;
+
+    /*
+     * Determines if the word at the given address was set
+     */
+    bool has_word(uint32_t addr) const;
+
+    /*
+     * Determines if all words of the row starting at the given address were set
+     */
+    bool is_complete(uint32_t addr) const;
+
+    /*
+     * Returns the instruction at the given (even) address (erased if it wasn't set)
+     */
+    uint32_t get_instruction(uint32_t addr) const;
+
+    /*
+     * Returns the ROW_SIZE instructions of the row starting at the given address or NULL if no word of
+     * the row was set
+     */
+    const uint32_t *get_row(uint32_t addr) const;
+
+    /*
+     * Returns the row starting at the given address, which is created (erased) if necessary
+     */
+    uint32_t *add_row(uint32_t addr);
+
+    /*
+     * Stores the addresses of all rows between from (inclusive) and to (exclusive) in ascending order
+     */
+    void get_rows(std::vector<uint32_t> &rows, uint32_t from = 0, uint32_t to = 0xffffffffu) const;
+
+    /*
+     * Returns the number of rows
+     */
+    size_t row_count() const;
+
+    /*
+     * Removes all rows
+     */
+    void clear();
+
+private:
+
+    /*
+     * Contains the number of the row described by the first entry of the index
+     */
+    uint32_t first_row;
+
+    /*
+     * Contains the slot of each row from first_row on (plus one, 0 if the row doesn't exist)
+     */
+    std::vector<uint32_t> index;
+
+    /*
+     * Contains the instructions of all rows (ROW_SIZE per slot, in the order the rows were created)
+     */
+    std::vector<uint32_t> instructions;
+
+    /*
+     * Contains a bit for each word of the rows (2 * ROW_SIZE per slot), which is set if the word was set
+     */
+    std::vector<uint64_t> present;
+
+    /*
+     * Returns the slot of the given row or -1 if it doesn't exist
+     */
+    inline int32_t find_slot(uint32_t row) const {
+        uint32_t entry = row - first_row;
+        return entry < index.size() ? (int32_t) index[entry] - 1 : -1;
+    }
+};
+
+#endif //RASPICSP_MEMORYIMAGE_H
@@ -1,63 +1,299 @@
+#include <algorithm>
+#include <stdexcept>
 #include "PIC24.h"
 #include "Logger.h"
 
-uint32_t PIC24::upper8(uint32_t data) {
-    return (data >> 16) & 0xffu;
-}
+/*
+ * Contains the fixed parts of the transactions (see compile_transactions), which are encoded by the compiler
+ */
 
-uint32_t PIC24::lower16(uint32_t data) {
-    return data & 0xffffu;
-}
+/*
+ * Writes the four instructions packed into W0..W5 (W6 points to W0) to the write latches at [W7]
+ */
+static constexpr uint32_t WRITE_LATCHES[] = {
+        TBLWTL(W6, INDIRECT_POST_INC, W7, INDIRECT), NOP, NOP,
+        TBLWTHB(W6, INDIRECT_POST_INC, W7, INDIRECT_POST_INC), NOP, NOP,
+        TBLWTHB(W6, INDIRECT_POST_INC, W7, INDIRECT_PRE_INC), NOP, NOP,
+        TBLWTL(W6, INDIRECT_POST_INC, W7, INDIRECT_POST_INC), NOP, NOP,
+        TBLWTL(W6, INDIRECT_POST_INC, W7, INDIRECT), NOP, NOP,
+        TBLWTHB(W6, INDIRECT_POST_INC, W7, INDIRECT_POST_INC), NOP, NOP,
+        TBLWTHB(W6, INDIRECT_POST_INC, W7, INDIRECT_PRE_INC), NOP, NOP,
+        TBLWTL(W6, INDIRECT_POST_INC, W7, INDIRECT_POST_INC), NOP, NOP
+};
 
-uint32_t PIC24::STO(REG reg, uint32_t addr) {
-    return 0x880000u | ((addr & 0xfffeu) << 3) | reg;
-}
+/*
+ * Writes the config word given in W6 (lower 16 bits) and W8 (upper 8 bits) to the write latch at [W7]
+ */
+static constexpr uint32_t WRITE_CONFIG_LATCH[] = {
+        NOP,
+        TBLWTL(W6, DIRECT, W7, INDIRECT), NOP, NOP,
+        TBLWTH(W8, DIRECT, W7, INDIRECT_POST_INC), NOP, NOP
+};
 
-uint32_t PIC24::RET(uint32_t addr, REG reg) {
-    return 0x800000u | ((addr & 0xfffeu) << 3) | reg;
-}
+/*
+ * Writes the page address in W0:W1 to the write latch, which selects the page to erase
+ */
+static constexpr uint32_t ERASE_LATCH[] = {TBLWTL(W0, DIRECT, W1, INDIRECT), NOP, NOP};
 
-uint32_t PIC24::LDI(uint32_t data, REG reg) {
-    return 0x200000u | (data << 4) | reg;
-}
+/*
+ * Copies the lower 16 bits or the upper 8 bits of the instruction at [W6] to VISI (W7 points to it),
+ * the last one moves W6 to the next instruction
+ */
+static constexpr uint32_t READ_LOWER[] = {TBLRDL(W6, INDIRECT, W7, INDIRECT), NOP, NOP};
+static constexpr uint32_t READ_UPPER[] = {NOP, TBLRDH(W6, INDIRECT, W7, INDIRECT), NOP, NOP};
+static constexpr uint32_t READ_UPPER_NEXT[] = {NOP, TBLRDH(W6, INDIRECT_POST_INC, W7, INDIRECT), NOP, NOP};
 
-uint32_t PIC24::JMP(uint32_t addr) {
-    return 0x040000u | addr;
+/*
+ * Determines if the given packed words only contain erased instructions (so that writing them can be skipped)
+ */
+static int is_erased(const uint16_t *words, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (words[i] != 0xffff) {
+            return 0;
+        }
+    }
+    return 1;
 }
 
-uint32_t PIC24::BSET(uint32_t addr, uint8_t bit) {
-    return 0xA80000u | (addr & 0x1ffeu) | ((bit & 0xeu) << 12) | (bit & 0x1u);
-}
+PIC24::PIC24(HAL &hal, const DEVICE &device, Capture *capture) : device(device), icsp(hal, device, capture) {
+    Target target;
+    target.active = 1;
+    target.device_id = 0;
+    target.device_revision = 0;
+    target.mismatches = 0;
+    target.failure = NULL;
+    targets.resize(icsp.targets(), target);
+    for (int i = 0; i < 4; i++) {
+        nvm_timing[i].count = 0;
+        nvm_timing[i].min = 0xffffffffu;
+        nvm_timing[i].max = 0;
+        nvm_timing[i].total = 0;
+        nvm_timing[i].first_poll = 0;
+    }
+    compile_transactions();
 
-uint32_t PIC24::TBLRDL(REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode) {
-    return 0xBA0000u | (dest_mode << 11) | (dest << 7) | (src_mode << 4) | src;
+    icsp
+    << NOP
+    << JMP(device.START_ADDR)
+    << NOP;
 }
 
-uint32_t PIC24::TBLRDH(REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode) {
-    return 0xBA8000u | (dest_mode << 11) | (dest << 7) | (src_mode << 4) | src;
+void PIC24::compile_transactions() {
+    nvm_poll
+    << JMP(device.START_ADDR)
+    << NOP
+    << RET(device.NVMCON_ADDR, W2)
+    << STO(W2, device.VISI_ADDR)
+    << NOP;
+    nvm_poll.visi();
+    nvm_poll << NOP;
+
+    read_sequence
+    << NOP
+    << JMP(device.START_ADDR)
+    << NOP;
+    read_tblpag_step = read_sequence.six(LDI(0, W0));
+    read_sequence << STO(W0, device.TBLPAG_ADDR);
+    read_address_step = read_sequence.six(LDI(0, W6));
+    read_sequence
+    << LDI(device.VISI_ADDR, W7)
+    << NOP
+    << READ_LOWER;
+    read_sequence.visi();
+    read_sequence << READ_UPPER;
+    read_sequence.visi();
+    read_sequence << NOP;
+
+    // The table reads move W6 to the next instruction, so the setup is only required once per block
+    block_read_sequence
+    << NOP
+    << JMP(device.START_ADDR)
+    << NOP;
+    block_tblpag_step = block_read_sequence.six(LDI(0, W0));
+    block_read_sequence << STO(W0, device.TBLPAG_ADDR);
+    block_address_step = block_read_sequence.six(LDI(0, W6));
+    block_read_sequence
+    << LDI(device.VISI_ADDR, W7)
+    << NOP;
+    for (uint32_t i = 0; i < BLOCK_READ_SIZE; i++) {
+        block_read_sequence << READ_LOWER;
+        block_read_sequence.visi();
+        block_read_sequence << READ_UPPER_NEXT;
+        block_read_sequence.visi();
+        block_read_sequence << NOP;
+    }
+
+    write_block
+    << NOP
+    << JMP(device.START_ADDR)
+    << NOP
+    << LDI(0, W6);
+    for (int i = 0; i < 6; i++) {
+        write_data_steps[i] = write_block.six(LDI(0, (REG) i));
+    }
+    write_block << WRITE_LATCHES;
+
+    // Writing and erasing only differs in the addresses (and the data written with the config words)
+    row_write
+    << NOP
+    << JMP(device.START_ADDR)
+    << NOP
+    << LDI(device.NVMCON_WRITE_ROW, W10)
+    << STO(W10, device.NVMCON_ADDR);
+    row_tblpag_step = row_write.six(LDI(0, W0));
+    row_write << STO(W0, device.TBLPAG_ADDR);
+    row_address_step = row_write.six(LDI(0, W7));
+
+    page_erase
+    << NOP
+    << JMP(device.START_ADDR)
+    << NOP
+    << LDI(device.NVMCON_ERASE_PAGE, W10)
+    << STO(W10, device.NVMCON_ADDR);
+    erase_tblpag_step = page_erase.six(LDI(0, W0));
+    page_erase << STO(W0, device.TBLPAG_ADDR);
+    erase_address_step = page_erase.six(LDI(0, W1));
+    page_erase << ERASE_LATCH;
+
+    config_write
+    << NOP
+    << JMP(device.START_ADDR)
+    << NOP;
+    config_address_step = config_write.six(LDI(0, W7));
+    config_write
+    << LDI(device.NVMCON_WRITE_WORD, W10)
+    << STO(W10, device.NVMCON_ADDR);
+    config_tblpag_step = config_write.six(LDI(0, W0));
+    config_write << STO(W0, device.TBLPAG_ADDR);
+    config_data_steps[0] = config_write.six(LDI(0, W6));
+    config_data_steps[1] = config_write.six(LDI(0, W8));
+    config_write << WRITE_CONFIG_LATCH;
+
+    nvm_start
+    << BSET(device.NVMCON_ADDR, NVMCOM_WR_BIT)
+    << NOP
+    << NOP;
+
+    nvm_exit
+    << JMP(device.START_ADDR)
+    << NOP;
+
+    // Adds each instruction (copied into RAM by copy_to_ram) to W3:W2 and W3:W2 to W5:W4
+    uint32_t row = MemoryImage::ROW_SIZE;
+    digest_sequence
+    << LDI(device.RAM_ADDR, W1)
+    << LDI(device.RAM_ADDR + 2 * row, W8)
+    << LDI(0, W2)
+    << LDI(0, W3)
+    << LDI(0, W4)
+    << LDI(0, W5);
+    for (uint32_t i = 0; i < row; i++) {
+        digest_sequence
+        << ADD(W2, W1, INDIRECT_POST_INC, W2)
+        << ADDC(W3, W8, INDIRECT_POST_INC, W3)
+        << ADD(W4, W2, DIRECT, W4)
+        << ADDC(W5, W3, DIRECT, W5);
+    }
+    REG results[] = {W2, W3, W4, W5};
+    for (int i = 0; i < 4; i++) {
+        digest_sequence
+        << STO(results[i], device.VISI_ADDR)
+        << NOP;
+        digest_sequence.visi();
+        digest_sequence << NOP;
+    }
 }
 
-uint32_t PIC24::TBLWTL(REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode) {
-    return 0xBB0000u | (dest_mode << 11) | (dest << 7) | (src_mode << 4) | src;
+void PIC24::drop_target(int index, const char *reason) {
+    Logger::log("PIC24", "Dropping device %d: %s", index, reason);
+    targets[index].active = 0;
+    targets[index].failure = reason;
+
+    uint32_t mask = 0;
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i].active) {
+            mask |= 1u << i;
+        }
+    }
+    icsp.select_targets(mask);
 }
 
-uint32_t PIC24::TBLWTH(REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode) {
-    return 0xBB8000u | (dest_mode << 11) | (dest << 7) | (src_mode << 4) | src;
+const std::vector<Target> &PIC24::get_targets() {
+    return targets;
 }
 
-uint32_t PIC24::TBLWTHB(REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode) {
-    return 0xBBC000u | (dest_mode << 11) | (dest << 7) | (src_mode << 4) | src;
+int PIC24::active_targets() {
+    int result = 0;
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i].active) {
+            result++;
+        }
+    }
+    return result;
 }
 
+void PIC24::wait_for_nvm(NVM_OPERATION operation) {
+    uint32_t expected[] = {device.CHIP_ERASE_TIME, device.PAGE_ERASE_TIME, device.ROW_WRITE_TIME,
+                           device.WORD_WRITE_TIME};
+    uint32_t timeout = expected[operation] * NVM_TIMEOUT_FACTOR + NVM_TIMEOUT_MARGIN;
 
-PIC24::PIC24(HAL &hal, const DEVICE &device) : icsp(ICSP(hal, device)), device(device) {
-    icsp
-    << NOP
-    << JMP(device.START_ADDR)
-    << NOP;
+    // Polling doesn't speed up the operation, it only keeps the bus (and the CPU) busy
+    icsp.delay(expected[operation]);
+    uint32_t waited = expected[operation];
+    uint32_t interval = MIN_NVM_POLL_INTERVAL;
+    while (1) {
+        icsp.execute(nvm_poll);
+
+        int busy = 0;
+        for (size_t i = 0; i < targets.size(); i++) {
+            if (targets[i].active && (nvm_poll.result(0, (int) i) & device.NVMCON_WRITING)) {
+                busy = 1;
+            }
+        }
+        if (!busy) {
+            NvmTiming &timing = nvm_timing[operation];
+            timing.count++;
+            timing.min = waited < timing.min ? waited : timing.min;
+            timing.max = waited > timing.max ? waited : timing.max;
+            timing.total += waited;
+            if (waited == expected[operation]) {
+                timing.first_poll++;
+            }
+            return;
+        }
+        if (waited >= timeout) {
+            break;
+        }
+
+        icsp.delay(interval);
+        waited += interval;
+        interval = interval * 2 < MAX_NVM_POLL_INTERVAL ? interval * 2 : MAX_NVM_POLL_INTERVAL;
+    }
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i].active && (nvm_poll.result(0, (int) i) & device.NVMCON_WRITING)) {
+            drop_target((int) i, "NVM operation did not complete");
+        }
+    }
 }
 
-void PIC24::read_device_id(uint16_t &higher, uint16_t &lower) {
+void PIC24::report_nvm_timing() {
+    const char *names[] = {"Chip erase", "Page erase", "Row write", "Word write"};
+    uint32_t expected[] = {device.CHIP_ERASE_TIME, device.PAGE_ERASE_TIME, device.ROW_WRITE_TIME,
+                           device.WORD_WRITE_TIME};
+    for (int i = 0; i < 4; i++) {
+        const NvmTiming &timing = nvm_timing[i];
+        if (timing.count == 0) {
+            continue;
+        }
+        Logger::log("PIC24",
+                    "%s: %u operation(s) complete after %u..%u us (avg %u us, expected %u us, %u at first poll)",
+                    names[i], timing.count, timing.min, timing.max, (uint32_t) (timing.total / timing.count),
+                    expected[i], timing.first_poll);
+    }
+}
+
+void PIC24::read_device_id() {
     icsp
     << NOP
     << JMP(device.START_ADDR)
@@ -70,17 +306,104 @@ void PIC24::read_device_id(uint16_t &higher, uint16_t &lower) {
     << TBLRDL(W6, INDIRECT_POST_INC, W7, INDIRECT)
     << NOP
     << NOP
-    >> higher
-    << NOP
+    >> visi
+    << NOP;
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        targets[i].device_id = visi[i];
+    }
+
+    icsp
     << TBLRDL(W6, INDIRECT, W7, INDIRECT)
     << NOP
     << NOP
-    >> lower
+    >> visi
     << NOP;
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        targets[i].device_revision = visi[i];
+        // A floating or shorted PGD line yields all ones or all zeros
+        if (targets[i].active && (targets[i].device_id == 0x0000 || targets[i].device_id == 0xffff)) {
+            drop_target((int) i, "No device responding");
+        }
+    }
 }
 
-uint32_t PIC24::read_word(uint32_t addr) {
-    uint16_t higher, lower;
+void PIC24::read_word(uint32_t addr, std::vector<uint32_t> &words) {
+    read_sequence.patch(read_tblpag_step, LDI(upper8(addr), W0));
+    read_sequence.patch(read_address_step, LDI(lower16(addr), W6));
+    icsp.execute(read_sequence);
+
+    words.resize(targets.size());
+    for (size_t i = 0; i < targets.size(); i++) {
+        words[i] = ((read_sequence.result(1, (int) i) & 0xffu) << 16) | read_sequence.result(0, (int) i);
+    }
+}
+
+void PIC24::read_block(uint32_t addr, uint32_t count, std::vector<uint32_t> &words) {
+    size_t size = targets.size();
+    words.resize(count * size);
+    uint32_t block_size = 2 * BLOCK_READ_SIZE;
+    uint32_t end = addr + 2 * count;
+    for (uint32_t block = addr - addr % block_size; block < end; block += block_size) {
+        block_read_sequence.patch(block_tblpag_step, LDI(upper8(block), W0));
+        block_read_sequence.patch(block_address_step, LDI(lower16(block), W6));
+        icsp.execute(block_read_sequence);
+
+        // Only the requested part of the (aligned) block is copied
+        uint32_t first = block < addr ? (addr - block) / 2 : 0;
+        uint32_t last = block + block_size > end ? (end - block) / 2 : BLOCK_READ_SIZE;
+        for (uint32_t i = first; i < last; i++) {
+            uint32_t index = (block + 2 * i - addr) / 2;
+            for (size_t t = 0; t < size; t++) {
+                words[index * size + t] = ((block_read_sequence.result(2 * i + 1, (int) t) & 0xffu) << 16) |
+                                          block_read_sequence.result(2 * i, (int) t);
+            }
+        }
+    }
+}
+
+void PIC24::dump(HexWriter &out) {
+    if (targets.size() > 1) {
+        throw std::runtime_error("Only a single device can be dumped");
+    }
+
+    // The row containing the config words is only dumped up to them, the config words are written separately
+    uint32_t row_size = 2 * BLOCK_READ_SIZE;
+    std::vector<uint32_t> row;
+    int rows = 0, skipped = 0;
+    for (uint32_t addr = 0; addr < device.CONFIG_WORDS_START_ADDR; addr += row_size) {
+        uint32_t count = addr + row_size > device.CONFIG_WORDS_START_ADDR
+                         ? (device.CONFIG_WORDS_START_ADDR - addr) / 2 : BLOCK_READ_SIZE;
+        read_block(addr, count, row);
+
+        int erased = 1;
+        for (uint32_t i = 0; i < count && erased; i++) {
+            erased = (row[i] & 0xffffffu) == 0xffffffu;
+        }
+        if (erased) {
+            skipped++;
+        } else {
+            out.write(addr, &row[0], count);
+            rows++;
+        }
+    }
+
+    read_block(device.CONFIG_WORDS_START_ADDR, device.NO_CONFIG_WORDS, row);
+    for (int i = 0; i < device.NO_CONFIG_WORDS; i++) {
+        Logger::log("PIC24", "Config word 0x%06x: 0x%06x", device.CONFIG_WORDS_START_ADDR + i * 2, row[i]);
+    }
+    out.write(device.CONFIG_WORDS_START_ADDR, &row[0], device.NO_CONFIG_WORDS);
+
+    Logger::log("PIC24", "Dumped %d rows (%d erased rows skipped)", rows, skipped);
+}
+
+void PIC24::wait_for_repeat(uint32_t cycles) {
+    icsp.delay((uint32_t) (((uint64_t) cycles * device.INSTRUCTION_CYCLE_TIME + 999) / 1000) + 1);
+}
+
+void PIC24::copy_to_ram(uint32_t addr, uint32_t count) {
+    // A table read takes two cycles
     icsp
     << NOP
     << JMP(device.START_ADDR)
@@ -88,243 +411,366 @@ uint32_t PIC24::read_word(uint32_t addr) {
     << LDI(upper8(addr), W0)
     << STO(W0, device.TBLPAG_ADDR)
     << LDI(lower16(addr), W6)
-    << LDI(device.VISI_ADDR, W7)
-    << NOP
-    << TBLRDL(W6, INDIRECT, W7, INDIRECT)
+    << LDI(device.RAM_ADDR, W7)
     << NOP
+    << REPEAT(count)
+    << TBLRDL(W6, INDIRECT_POST_INC, W7, INDIRECT_POST_INC)
     << NOP
-    >> lower
-    << NOP
-    << TBLRDH(W6, INDIRECT, W7, INDIRECT)
-    << NOP
-    << NOP
-    >> higher
     << NOP;
+    wait_for_repeat(2 * count);
 
-    return ((higher & 0xffu) << 16) | (lower & 0xffffu);
+    icsp
+    << LDI(lower16(addr), W6)
+    << REPEAT(count)
+    << TBLRDH(W6, INDIRECT_POST_INC, W7, INDIRECT_POST_INC)
+    << NOP
+    << NOP;
+    wait_for_repeat(2 * count);
 }
 
-void PIC24::erase_chip() {
+uint32_t PIC24::target_blank(uint32_t addr, uint32_t count) {
+    copy_to_ram(addr, count);
+
+    // Combine all lower words and all upper bytes
     icsp
+    << LDI(device.RAM_ADDR, W1)
+    << LDI(0xffff, W4)
+    << LDI(0xffff, W5)
+    << REPEAT(count)
+    << AND(W4, W1, INDIRECT_POST_INC, W4);
+    wait_for_repeat(count);
+
+    icsp
+    << REPEAT(count)
+    << AND(W5, W1, INDIRECT_POST_INC, W5);
+    wait_for_repeat(count);
+
+    size_t size = targets.size();
+    std::vector<uint16_t> low(size), high(size);
+    icsp
+    << STO(W4, device.VISI_ADDR)
     << NOP
-    << JMP(device.START_ADDR)
-    << NOP
-    << LDI(device.NVMCON_ERASE_ALL, W10)
-    << STO(W10, device.NVMCON_ADDR)
-    << LDI(0x0, W0)
-    << STO(W0, device.TBLPAG_ADDR)
-    << LDI(0x0, W0)
-    << TBLWTL(W0, DIRECT, W0, INDIRECT)
-    << NOP
-    << NOP
-    << BSET(device.NVMCON_ADDR, NVMCOM_WR_BIT)
+    >> visi
+    << NOP;
+    for (size_t t = 0; t < size; t++) {
+        low[t] = visi[t];
+    }
+    icsp
+    << STO(W5, device.VISI_ADDR)
     << NOP
+    >> visi
     << NOP;
+    for (size_t t = 0; t < size; t++) {
+        high[t] = visi[t];
+    }
 
-    while (1) {
-        uint16_t visi = 0;
-
-        icsp
-        << JMP(device.START_ADDR)
-        << NOP
-        << RET(device.NVMCON_ADDR, W2)
-        << STO(W2, device.VISI_ADDR)
-        << NOP
-        >> visi
-        << NOP;
+    uint32_t failed = 0;
+    for (size_t t = 0; t < size; t++) {
+        if (targets[t].active && (low[t] != 0xffff || high[t] != 0x00ff)) {
+            failed |= 1u << t;
+        }
+    }
+    return failed;
+}
 
-        if (!(visi & device.NVMCON_WRITING)) {
-            return;
+void PIC24::target_digest(uint32_t addr, std::vector<uint32_t> &values) {
+    copy_to_ram(addr, MemoryImage::ROW_SIZE);
+    icsp.execute(digest_sequence);
+
+    size_t size = targets.size();
+    values.resize(DIGEST_VALUES * size);
+    for (int v = 0; v < DIGEST_VALUES; v++) {
+        for (size_t t = 0; t < size; t++) {
+            values[v * size + t] = ((uint32_t) digest_sequence.result(2 * v + 1, (int) t) << 16) |
+                                   digest_sequence.result(2 * v, (int) t);
         }
     }
 }
 
+uint32_t PIC24::compare_range(const MemoryImage &image, uint32_t addr, uint32_t count) {
+    size_t size = targets.size();
+    uint32_t row_size = 2 * MemoryImage::ROW_SIZE;
+    uint32_t end = addr + 2 * count;
+    std::vector<uint32_t> values;
+    uint32_t differs = 0;
+
+    // Erased rows are collected and checked together
+    uint32_t blank_start = addr, blank_count = 0;
+    for (uint32_t row = addr; row < end; row += row_size) {
+        uint32_t row_count = (end - row < row_size ? end - row : row_size) / 2;
+        const uint32_t *instructions = image.get_row(row);
+        int erased = 1;
+        for (uint32_t i = 0; instructions != NULL && i < row_count && erased; i++) {
+            erased = instructions[i] == MemoryImage::ERASED;
+        }
+        if (erased && blank_count + row_count <= BLANK_BLOCK_SIZE) {
+            blank_count += row_count;
+            continue;
+        }
+        if (blank_count > 0) {
+            differs |= target_blank(blank_start, blank_count);
+        }
+        blank_start = row;
+        blank_count = 0;
+        if (erased) {
+            blank_count = row_count;
+            continue;
+        }
+        blank_start = row + row_size;
 
-void PIC24::write_code_words(std::vector<uint32_t> &data) {
-    std::vector<uint32_t>::const_iterator iter = data.begin();
-    uint32_t addr = 0;
-    while (iter != data.end()) {
-        addr = write_128words(addr, iter, data.end());
+        if (row_count == MemoryImage::ROW_SIZE) {
+            uint32_t sum, weighted_sum;
+            Bundle::digest(instructions, MemoryImage::ROW_SIZE, sum, weighted_sum);
+            target_digest(row, values);
+            for (size_t t = 0; t < size; t++) {
+                if (targets[t].active && (values[DIGEST_SUM * size + t] != sum ||
+                                          values[DIGEST_WEIGHTED_SUM * size + t] != weighted_sum)) {
+                    differs |= 1u << t;
+                }
+            }
+            continue;
+        }
+
+        // The digest always covers a complete row, so the end of a range is read back
+        read_block(row, row_count, values);
+        for (uint32_t i = 0; i < row_count; i++) {
+            for (size_t t = 0; t < size; t++) {
+                if (targets[t].active && (values[i * size + t] & 0xffffffu) != instructions[i]) {
+                    differs |= 1u << t;
+                }
+            }
+        }
     }
+    if (blank_count > 0) {
+        differs |= target_blank(blank_start, blank_count);
+    }
+
+    return differs;
 }
 
-uint32_t PIC24::write_128words(uint32_t addr,
-                               std::vector<uint32_t>::const_iterator &iter,
-                               std::vector<uint32_t>::iterator end) {
-    icsp
-    << NOP
-    << JMP(device.START_ADDR)
-    << NOP
-    << LDI(device.NVMCON_WRITE_ROW, W10)
-    << STO(W10, device.NVMCON_ADDR)
-    << LDI(upper8(addr), W0)
-    << STO(W0, device.TBLPAG_ADDR)
-    << LDI(lower16(addr), W7);
-
-    for (uint8_t i = 0; i < 16; i++) {
-        uint32_t data1 = fetch_next(iter, end);
-        uint32_t data2 = fetch_next(iter, end);
-        uint32_t data3 = fetch_next(iter, end);
-        uint32_t data4 = fetch_next(iter, end);
-        uint32_t data5 = fetch_next(iter, end);
-        uint32_t data6 = fetch_next(iter, end);
-        uint32_t data7 = fetch_next(iter, end);
-        uint32_t data8 = fetch_next(iter, end);
-        if (Logger::is_tracing()) {
-            Logger::trace("PIC24",
-                          "Writing (0x%06x, 0x%06x, 0x%06x, 0x%06x, 0x%06x, 0x%06x, 0x%06x, 0x%06x) to: 0x%06x", data1,
-                          data2, data3, data4, data5, data6, data7, data8,
-                          addr + (i * 8));
-        }
-
-        uint32_t word1 = data1;
-        uint32_t word2 = ((data4 & 0xffu) << 8) | (data2 & 0xffu);
-        uint32_t word3 = data3;
-        uint32_t word4 = data5;
-        uint32_t word5 = ((data8 & 0xffu) << 8) | (data6 & 0xffu);
-        uint32_t word6 = data7;
-
-        icsp
-        << NOP
-        << JMP(device.START_ADDR)
-        << NOP
-        << LDI(0, W6)
-        << LDI(word1, W0)
-        << LDI(word2, W1)
-        << LDI(word3, W2)
-        << LDI(word4, W3)
-        << LDI(word5, W4)
-        << LDI(word6, W5)
-        << TBLWTL(W6, INDIRECT_POST_INC, W7, INDIRECT)
-        << NOP
-        << NOP
-        << TBLWTHB(W6, INDIRECT_POST_INC, W7, INDIRECT_POST_INC)
-        << NOP
-        << NOP
-        << TBLWTHB(W6, INDIRECT_POST_INC, W7, INDIRECT_PRE_INC)
-        << NOP
-        << NOP
-        << TBLWTL(W6, INDIRECT_POST_INC, W7, INDIRECT_POST_INC)
-        << NOP
-        << NOP
-        << TBLWTL(W6, INDIRECT_POST_INC, W7, INDIRECT)
-        << NOP
-        << NOP
-        << TBLWTHB(W6, INDIRECT_POST_INC, W7, INDIRECT_POST_INC)
-        << NOP
-        << NOP
-        << TBLWTHB(W6, INDIRECT_POST_INC, W7, INDIRECT_PRE_INC)
-        << NOP
-        << NOP
-        << TBLWTL(W6, INDIRECT_POST_INC, W7, INDIRECT_POST_INC)
-        << NOP
-        << NOP;
+int PIC24::verify_code(const Bundle &bundle) {
+    int mismatches = 0;
+    for (size_t row = 0; row < bundle.row_count(); row++) {
+        uint32_t failed = check_row(bundle, row);
+        if (failed == 0) {
+            continue;
+        }
+
+        Logger::log("PIC24", "Digest of the row at 0x%06x does not match, reading it back", bundle.row_address(row));
+        mismatches += read_back_row(bundle, row, failed);
     }
 
-    icsp
-    << BSET(device.NVMCON_ADDR, NVMCOM_WR_BIT)
-    << NOP
-    << NOP;
+    return mismatches;
+}
 
-    while (1) {
-        uint16_t visi = 0;
-
-        icsp
-        << JMP(device.START_ADDR)
-        << NOP
-        << RET(device.NVMCON_ADDR, W2)
-        << STO(W2, device.VISI_ADDR)
-        << NOP
-        >> visi
-        << NOP;
+uint32_t PIC24::check_row(const Bundle &bundle, size_t row) {
+    size_t size = targets.size();
+    const Bundle::Row &expected = bundle.get_row(row);
+    std::vector<uint32_t> values;
+    target_digest(bundle.row_address(row), values);
 
-        if (!(visi & device.NVMCON_WRITING)) {
-            break;
+    uint32_t failed = 0;
+    for (size_t t = 0; t < size; t++) {
+        if (targets[t].active && (values[DIGEST_SUM * size + t] != expected.sum ||
+                                  values[DIGEST_WEIGHTED_SUM * size + t] != expected.weighted_sum)) {
+            failed |= 1u << t;
         }
     }
+    return failed;
+}
 
-    icsp
-    << JMP(device.START_ADDR)
-    << NOP;
+int PIC24::read_back_row(const Bundle &bundle, size_t row, uint32_t failed) {
+    size_t size = targets.size();
+    uint32_t row_addr = bundle.row_address(row);
+    std::vector<uint32_t> data;
+    int mismatches = 0;
+    read_block(row_addr, BLOCK_READ_SIZE, data);
+    for (uint32_t i = 0; i < BLOCK_READ_SIZE; i++) {
+        uint32_t index = row_addr + 2 * i;
+        uint32_t instruction = bundle.get_instruction(row, i);
+        uint32_t low = instruction & 0xffffu;
+        uint32_t high = instruction >> 16;
+        for (size_t t = 0; t < size; t++) {
+            uint32_t word = data[i * size + t];
+            if (!(failed & (1u << t))) {
+                continue;
+            }
+            if ((word & 0xffffu) != low) {
+                report_mismatch((int) t, index, low, word & 0xffffu);
+                mismatches++;
+            }
+            if (((word >> 16) & 0xffu) != high) {
+                report_mismatch((int) t, index + 1, high, (word >> 16) & 0xffu);
+                mismatches++;
+            }
+        }
+    }
+    return mismatches;
+}
+
+int PIC24::verify_words(const Bundle &bundle) {
+    uint32_t block_size = 2 * BLOCK_READ_SIZE;
+    uint32_t current_block = 0xffffffffu;
+    std::vector<uint32_t> current_data;
+    int mismatches = 0;
+    for (size_t w = 0; w < bundle.word_count(); w++) {
+        const MemoryWord &expected = bundle.get_word(w);
+        uint32_t block = expected.address - expected.address % block_size;
+        if (block != current_block) {
+            read_block(block, BLOCK_READ_SIZE, current_data);
+            current_block = block;
+        }
 
-    return addr + 128;
+        uint32_t index = (expected.address - block) / 2;
+        for (size_t i = 0; i < targets.size(); i++) {
+            if (!targets[i].active) {
+                continue;
+            }
+            uint32_t word = current_data[index * targets.size() + i];
+            uint32_t data = expected.address % 2 == 1 ? (word >> 16) & 0xffu : word & 0xffffu;
+            if (data != expected.data) {
+                report_mismatch((int) i, expected.address, expected.data, data);
+                mismatches++;
+            }
+        }
+    }
+
+    return mismatches;
 }
 
-uint32_t PIC24::fetch_next(std::vector<uint32_t>::const_iterator &iter,
-                           const std::vector<uint32_t>::iterator &end) {
-    uint32_t result = 0;
-    if (iter != end) {
-        result = *iter;
-        iter++;
+int PIC24::blank_check() {
+    uint32_t instructions = device.CONFIG_WORDS_START_ADDR / 2 + device.NO_CONFIG_WORDS;
+    for (uint32_t first = 0; first < instructions; first += BLANK_BLOCK_SIZE) {
+        uint32_t count = instructions - first < BLANK_BLOCK_SIZE ? instructions - first : BLANK_BLOCK_SIZE;
+        uint32_t failed = target_blank(2 * first, count);
+        for (size_t t = 0; t < targets.size(); t++) {
+            if (failed & (1u << t)) {
+                Logger::log("PIC24", "Device %d is not blank between 0x%06x and 0x%06x", (int) t, 2 * first,
+                            2 * (first + count) - 1);
+                drop_target((int) t, "Program memory is not blank");
+            }
+        }
     }
-    return result;
+
+    return active_targets();
 }
 
-void PIC24::write_config_word(uint32_t addr, uint32_t data) {
+void PIC24::erase_chip() {
     icsp
     << NOP
     << JMP(device.START_ADDR)
     << NOP
-    << LDI(lower16(addr), W7)
-    << LDI(device.NVMCON_WRITE_WORD, W10)
+    << LDI(device.NVMCON_ERASE_ALL, W10)
     << STO(W10, device.NVMCON_ADDR)
-    << LDI(upper8(addr), W0)
+    << LDI(0x0, W0)
     << STO(W0, device.TBLPAG_ADDR)
-    << LDI(data & 0xffffu, W6)
-    << NOP
-    << TBLWTL(W6, DIRECT, W7, INDIRECT_POST_INC)
+    << LDI(0x0, W0)
+    << TBLWTL(W0, DIRECT, W0, INDIRECT)
     << NOP
     << NOP
     << BSET(device.NVMCON_ADDR, NVMCOM_WR_BIT)
     << NOP
     << NOP;
 
-    while (1) {
-        uint16_t visi = 0;
-
-        icsp
-        << JMP(device.START_ADDR)
-        << NOP
-        << RET(device.NVMCON_ADDR, W2)
-        << STO(W2, device.VISI_ADDR)
-        << NOP
-        >> visi
-        << NOP;
+    wait_for_nvm(NVM_CHIP_ERASE);
+}
 
-        if (!(visi & device.NVMCON_WRITING)) {
-            break;
+
+void PIC24::program_row(uint32_t addr, const uint32_t *instructions) {
+    if (device.ROW_SIZE > MemoryImage::ROW_SIZE) {
+        throw std::runtime_error("Rows of the device can't be written one row of the image at a time");
+    }
+    uint16_t words[Bundle::ROW_WORDS];
+    Bundle::pack(instructions, words);
+
+    uint32_t row_words = device.ROW_SIZE / 4 * 6;
+    for (uint32_t offset = 0; offset < Bundle::ROW_WORDS; offset += row_words) {
+        if (!is_erased(words + offset, row_words)) {
+            write_row(addr + offset / 3 * 4, words + offset);
         }
     }
+}
 
-    icsp
-    << JMP(device.START_ADDR)
-    << NOP;
+size_t PIC24::next_device_row(const Bundle &bundle, size_t first) {
+    uint32_t row_size = 2 * device.ROW_SIZE;
+    uint32_t end = bundle.row_address(first) - bundle.row_address(first) % row_size + row_size;
+    size_t next = first + 1;
+    while (next < bundle.row_count() && bundle.row_address(next) < end) {
+        next++;
+    }
+    return next;
 }
 
-void PIC24::prepare_program(std::list<MemoryWord> &memory, std::vector<uint32_t> &code,
-                            std::vector<MemoryWord> &configWords) {
-    // We can only program rows of 128 words. So we have to stay away from the row containing the config registers.
-    uint32_t upper_memory_limit = device.CONFIG_WORDS_START_ADDR - (device.CONFIG_WORDS_START_ADDR % 128);
-    uint32_t max_memory_location = 0;
-    std::list<MemoryWord>::const_iterator iter = memory.begin();
-    while (iter != memory.end()) {
-        if (iter->address < upper_memory_limit) {
-            if (iter->address > max_memory_location) {
-                max_memory_location = iter->address;
+void PIC24::write_rows(const Bundle &bundle, size_t first, size_t last) {
+    if (device.ROW_SIZE <= MemoryImage::ROW_SIZE) {
+        uint32_t row_words = device.ROW_SIZE / 4 * 6;
+        for (size_t i = first; i < last; i++) {
+            const uint16_t *words = bundle.get_row(i).words;
+            for (uint32_t offset = 0; offset < Bundle::ROW_WORDS; offset += row_words) {
+                if (!is_erased(words + offset, row_words)) {
+                    write_row(bundle.row_address(i) + offset / 3 * 4, words + offset);
+                }
             }
-        } else if (iter->address < device.CONFIG_WORDS_START_ADDR) {
-            Logger::log("PIC24F",
-                        "Warning: Cannot program at 0x%06x! This within less than 128 words of the config registers! Verification will most probably fail.",
-                        iter->address);
         }
-        iter++;
+        return;
     }
 
-    // Fill all available and programmable code with 0x000000 which is NOP
-    for (uint32_t i = 0; i <= max_memory_location; i++) {
-        code.push_back(0);
+    // The rows of the bundle are collected into a row of the device, the gaps remain erased
+    uint32_t row_size = 2 * device.ROW_SIZE;
+    std::vector<uint16_t> words(device.ROW_SIZE / 4 * 6);
+    for (size_t i = first; i < last;) {
+        uint32_t row = bundle.row_address(i) - bundle.row_address(i) % row_size;
+        size_t next = std::min(next_device_row(bundle, i), last);
+        std::fill(words.begin(), words.end(), 0xffff);
+        for (; i < next; i++) {
+            const uint16_t *data = bundle.get_row(i).words;
+            std::copy(data, data + Bundle::ROW_WORDS,
+                      &words[(bundle.row_address(i) - row) / (2 * MemoryImage::ROW_SIZE) * Bundle::ROW_WORDS]);
+        }
+        write_row(row, &words[0]);
     }
+}
+
+void PIC24::write_row(uint32_t addr, const uint16_t *words) {
+    row_write.patch(row_tblpag_step, LDI(upper8(addr), W0));
+    row_write.patch(row_address_step, LDI(lower16(addr), W7));
+    icsp.execute(row_write);
 
+    // Each block writes four instructions, packed into six words
+    for (uint32_t i = 0; i < device.ROW_SIZE / 4; i++) {
+        const uint16_t *data = words + 6 * i;
+        if (Logger::is_tracing()) {
+            Logger::trace("PIC24", "Writing (0x%04x, 0x%04x, 0x%04x, 0x%04x, 0x%04x, 0x%04x) to: 0x%06x", data[0],
+                          data[1], data[2], data[3], data[4], data[5], addr + (i * 8));
+        }
+
+        write_block.patch(write_data_steps[0], LDI(data[0], W0));
+        write_block.patch(write_data_steps[1], LDI(data[1], W1));
+        write_block.patch(write_data_steps[2], LDI(data[2], W2));
+        write_block.patch(write_data_steps[3], LDI(data[3], W3));
+        write_block.patch(write_data_steps[4], LDI(data[4], W4));
+        write_block.patch(write_data_steps[5], LDI(data[5], W5));
+        icsp.execute(write_block);
+    }
+
+    icsp.execute(nvm_start);
+    wait_for_nvm(NVM_ROW_WRITE);
+    icsp.execute(nvm_exit);
+}
+
+void PIC24::write_config_word(uint32_t addr, uint32_t data) {
+    config_write.patch(config_address_step, LDI(lower16(addr), W7));
+    config_write.patch(config_tblpag_step, LDI(upper8(addr), W0));
+    config_write.patch(config_data_steps[0], LDI(lower16(data), W6));
+    config_write.patch(config_data_steps[1], LDI(upper8(data), W8));
+    icsp.execute(config_write);
+    icsp.execute(nvm_start);
+
+    wait_for_nvm(NVM_WORD_WRITE);
+    icsp.execute(nvm_exit);
+}
+
+void PIC24::prepare_config(const Bundle &bundle, std::vector<MemoryWord> &configWords) {
     for (int i = 0; i < device.NO_CONFIG_WORDS; i++) {
         MemoryWord configWord;
         configWord.address = device.CONFIG_WORDS_START_ADDR + i * 2;
@@ -332,78 +778,449 @@ void PIC24::prepare_program(std::list<MemoryWord> &memory, std::vector<uint32_t>
         configWords.push_back(configWord);
     }
 
-    // Fill code and config registers as given in the hex file...
-    iter = memory.begin();
-    while (iter != memory.end()) {
-        if (iter->address >= device.CONFIG_WORDS_START_ADDR &&
-            iter->address <= (device.CONFIG_WORDS_START_ADDR + 2 * device.NO_CONFIG_WORDS)) {
-            uint32_t offset = iter->address - device.CONFIG_WORDS_START_ADDR;
-            uint32_t data = iter->data;
+    // Fill the config registers as given in the hex file...
+    for (size_t w = 0; w < bundle.word_count(); w++) {
+        const MemoryWord &word = bundle.get_word(w);
+        if (word.address >= device.CONFIG_WORDS_START_ADDR &&
+            word.address < device.CONFIG_WORDS_START_ADDR + 2 * device.NO_CONFIG_WORDS) {
+            uint32_t offset = word.address - device.CONFIG_WORDS_START_ADDR;
             if (offset % 2 == 0) {
-                configWords[offset >> 1].data |= (data & 0xffffu);
+                configWords[offset >> 1].data |= word.data & 0xffffu;
             } else {
                 // This is most probably not used, as the config registers only use the lower 16 bits...
-                configWords[offset >> 1].data |= (data & 0xffffu) << 16;
+                configWords[offset >> 1].data |= (word.data & 0xffffu) << 16;
             }
-        } else {
-            code[iter->address] = iter->data;
         }
-        iter++;
     }
 }
 
-void PIC24::program(std::list<MemoryWord> &memory) {
+void PIC24::program(const Bundle &bundle) {
+    program(bundle, std::vector<uint32_t>());
+}
+
+void PIC24::program(const Bundle &bundle, const std::vector<uint32_t> &written) {
+    std::vector<MemoryWord> configWords;
+    prepare_config(bundle, configWords);
+
+    size_t rows = bundle.row_count();
+    Logger::log("PIC24", "Programming device (%i of %i rows and %i config words)...", (int) (rows - written.size()),
+                rows == 0 ? 0 : (int) (bundle.row_address(rows - 1) / (2 * BLOCK_READ_SIZE) + 1),
+                (int) configWords.size());
+    for (size_t i = 0; i < rows;) {
+        if (std::binary_search(written.begin(), written.end(), bundle.row_address(i))) {
+            i++;
+            continue;
+        }
+        size_t last = i + 1;
+        while (last < rows && !std::binary_search(written.begin(), written.end(), bundle.row_address(last))) {
+            last++;
+        }
+        write_rows(bundle, i, last);
+        i = last;
+    }
+
+    for (size_t i = 0; i < configWords.size(); i++) {
+        Logger::log("PIC24", "Config word 0x%06x: 0x%06x", configWords[i].address, configWords[i].data);
+        write_config_word(configWords[i].address, configWords[i].data);
+    }
+}
+
+int PIC24::program_verified(const Bundle &bundle, int retries) {
     std::vector<MemoryWord> configWords;
-    std::vector<uint32_t> code;
+    prepare_config(bundle, configWords);
 
-    prepare_program(memory, code, configWords);
+    size_t rows = bundle.row_count();
+    Logger::log("PIC24", "Programming and verifying device (%i rows and %i config words)...", (int) rows,
+                (int) configWords.size());
+    uint32_t page_size = 2 * device.PAGE_SIZE;
+    size_t page_first = 0;
+    int rewritten = 0, failures = 0;
+    for (size_t i = 0; i < rows;) {
+        // The rows of the bundle within a row of the device are written (and checked) together
+        uint32_t addr = bundle.row_address(i);
+        uint32_t page = addr - addr % page_size;
+        size_t next = next_device_row(bundle, i);
+        while (bundle.row_address(page_first) < page) {
+            page_first++;
+        }
 
-    Logger::log("PIC24", "Programming device (%i code words and %i config words)...", code.size(), configWords.size());
-    write_code_words(code);
+        // Contains the devices on which each row of the page doesn't match (as found by the last check)
+        std::vector<uint32_t> row_failed(next - page_first, 0);
+        write_rows(bundle, i, next);
+        uint32_t failed = 0;
+        for (size_t row = i; row < next; row++) {
+            row_failed[row - page_first] = check_row(bundle, row);
+            failed |= row_failed[row - page_first];
+        }
 
-    for (int i = 0; i < configWords.size(); i++) {
+        // Erasing the page also erases the rows of the page which were written before
+        for (int attempt = 1; failed != 0 && attempt <= retries; attempt++) {
+            Logger::log("PIC24", "Row at 0x%06x does not match, writing page 0x%06x again (attempt %d of %d)", addr,
+                        page, attempt, retries);
+            erase_page(page);
+            write_rows(bundle, page_first, next);
+            rewritten++;
+            failed = 0;
+            for (size_t row = page_first; row < next; row++) {
+                row_failed[row - page_first] = check_row(bundle, row);
+                failed |= row_failed[row - page_first];
+            }
+        }
+        i = next;
+        if (failed == 0) {
+            continue;
+        }
+
+        for (size_t row = page_first; row < next; row++) {
+            if (row_failed[row - page_first] != 0) {
+                Logger::log("PIC24", "Row at 0x%06x could not be written", bundle.row_address(row));
+                read_back_row(bundle, row, row_failed[row - page_first]);
+                failures++;
+            }
+        }
+        for (size_t t = 0; t < targets.size(); t++) {
+            if (failed & (1u << t)) {
+                drop_target((int) t, "Writing a row failed");
+            }
+        }
+        if (active_targets() == 0) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < configWords.size(); i++) {
         Logger::log("PIC24", "Config word 0x%06x: 0x%06x", configWords[i].address, configWords[i].data);
         write_config_word(configWords[i].address, configWords[i].data);
     }
+    int mismatches = verify_words(bundle);
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i].active && targets[i].mismatches > 0) {
+            drop_target((int) i, "Verification failed");
+        }
+    }
+
+    Logger::log("PIC24", "%i rows written, %i pages written again, %i rows and %i words do not match", (int) rows,
+                rewritten, failures, mismatches);
+    return failures + mismatches;
 }
 
-void PIC24::verify(std::list<MemoryWord> &memory) {
-    Logger::log("PIC24", "Verifying %i words of memory...", memory.size());
-    std::list<MemoryWord>::const_iterator iter = memory.begin();
-    uint32_t current_address = 0;
-    uint32_t current_data = 0;
+int PIC24::program_differential(const Bundle &bundle) {
+    std::vector<MemoryWord> configWords;
+    prepare_config(bundle, configWords);
+
+    // Build the contents of the whole program memory as program() leaves it
+    uint32_t page_size = 2 * device.PAGE_SIZE;
+    uint32_t end = device.CONFIG_WORDS_START_ADDR + 2 * device.NO_CONFIG_WORDS;
+    MemoryImage image;
+    bundle.unpack(image);
+    for (size_t i = 0; i < configWords.size(); i++) {
+        image.set_word(configWords[i].address, configWords[i].data & 0xffffu);
+        image.set_word(configWords[i].address + 1, 0);
+    }
 
-    while (iter != memory.end()) {
-        uint32_t data = 0;
-        if (iter->address % 2 == 1) {
-            if (iter != memory.begin() && iter->address - 1 == current_address) {
-                data = (current_data >> 16) & 0xffu;
-            } else {
-                data = (read_word(iter->address - 1) >> 16) & 0xffu;
+    int pages = 0, written = 0;
+    size_t next = 0;
+    for (uint32_t page = 0; page < end; page += page_size) {
+        uint32_t count = (end - page < page_size ? end - page : page_size) / 2;
+        pages++;
+
+        // All devices receive the same commands, so a page is written if it differs on any device
+        int changed = compare_range(image, page, count) != 0;
+        size_t first = next;
+        while (next < bundle.row_count() && bundle.row_address(next) < page + page_size) {
+            next++;
+        }
+        if (!changed) {
+            continue;
+        }
+
+        Logger::log("PIC24", "Page at 0x%06x has changed", page);
+        erase_page(page);
+        written++;
+        write_rows(bundle, first, next);
+        // Erasing the last page also erased the config words
+        if (page + page_size >= end) {
+            for (size_t i = 0; i < configWords.size(); i++) {
+                Logger::log("PIC24", "Config word 0x%06x: 0x%06x", configWords[i].address, configWords[i].data);
+                write_config_word(configWords[i].address, configWords[i].data);
             }
-        } else {
-            current_address = iter->address;
-            current_data = data = read_word(current_address);
         }
+    }
+
+    Logger::log("PIC24", "%d of %d pages written", written, pages);
+    return written;
+}
+
+void PIC24::report_mismatch(int target, uint32_t addr, uint32_t expected, uint32_t data) {
+    if (targets.size() == 1) {
+        Logger::log("PIC24",
+                    "Warning, memory does not match expected value!. Address: 0x%06x, Expected: 0x%04x, Read: 0x%04x",
+                    addr, expected, data);
+    } else {
+        Logger::log("PIC24",
+                    "Warning, memory of device %d does not match expected value!. Address: 0x%06x, Expected: 0x%04x, Read: 0x%04x",
+                    target, addr, expected, data);
+    }
+    targets[target].mismatches++;
+}
 
-        if ((data & 0xffffu) != iter->data) {
-            Logger::log("PIC24",
-                        "Warning, memory does not match expected value!. Address: 0x%06x, Expected: 0x%04x, Read: 0x%04x",
-                        iter->address, iter->data, data & 0xffffu);
+int PIC24::verify(const Bundle &bundle) {
+    Logger::log("PIC24", "Verifying %i rows and %i words of memory...", (int) bundle.row_count(),
+                (int) bundle.word_count());
+    int mismatches = verify_code(bundle);
+
+    // Everything beyond the code (like the config words) is read back
+    mismatches += verify_words(bundle);
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i].active && targets[i].mismatches > 0) {
+            drop_target((int) i, "Verification failed");
         }
-        iter++;
     }
 
-    Logger::log("PIC24", "Verification Completed...");
+    Logger::log("PIC24", "Verification Completed (%i mismatches)...", mismatches);
+    return mismatches;
 }
 
+int PIC24::has_executive() {
+    std::vector<uint32_t> words;
+    read_word(device.APP_ID_ADDR, words);
 
+    int result = 1;
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i].active && (words[i] & 0xffu) != device.APP_ID) {
+            Logger::log("PIC24", "Device %d contains no programming executive (application id: 0x%02x)", (int) i,
+                        words[i] & 0xffu);
+            result = 0;
+        }
+    }
+    return result;
+}
 
+void PIC24::erase_page(uint32_t addr) {
+    page_erase.patch(erase_tblpag_step, LDI(upper8(addr), W0));
+    page_erase.patch(erase_address_step, LDI(lower16(addr), W1));
+    icsp.execute(page_erase);
+    icsp.execute(nvm_start);
+
+    wait_for_nvm(NVM_PAGE_ERASE);
+}
+
+void PIC24::erase_executive() {
+    for (uint32_t page = device.EXECUTIVE_ADDR; page < device.EXECUTIVE_ADDR + device.EXECUTIVE_SIZE;
+         page += 2 * device.PAGE_SIZE) {
+        erase_page(page);
+    }
+}
 
+void PIC24::program_executive(const MemoryImage &executive) {
+    // Unused locations remain erased
+    std::vector<uint32_t> rows;
+    executive.get_rows(rows);
+    for (size_t i = 0; i < rows.size(); i++) {
+        if (rows[i] < device.EXECUTIVE_ADDR || rows[i] >= device.EXECUTIVE_ADDR + device.EXECUTIVE_SIZE) {
+            throw std::runtime_error("The programming executive contains data outside of the executive memory");
+        }
+    }
+    Bundle bundle;
+    bundle.build(executive, device.EXECUTIVE_ADDR, device.EXECUTIVE_ADDR + device.EXECUTIVE_SIZE);
 
+    Logger::log("PIC24", "Programming the programming executive...");
+    erase_executive();
+    write_rows(bundle, 0, bundle.row_count());
 
+    int mismatches = verify_code(bundle);
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i].active && targets[i].mismatches > 0) {
+            drop_target((int) i, "Verification of the programming executive failed");
+        }
+    }
+    Logger::log("PIC24", "Verification of the programming executive completed (%i mismatches)...", mismatches);
+}
 
+void PIC24::pe_command(const uint16_t *command, int count, int response_length) {
+    uint32_t missing = icsp.send_command(command, count, PE_TIMEOUT);
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i].active && (missing & (1u << i))) {
+            drop_target((int) i, "The programming executive does not respond");
+        }
+    }
 
+    icsp.receive_response(response_length, pe_response);
+    uint16_t opcode = command[0] >> 12;
+    for (size_t i = 0; i < targets.size(); i++) {
+        uint16_t status = pe_word(0, (int) i);
+        if (targets[i].active && ((status >> 12) != 0x1 || ((status >> 8) & 0xfu) != opcode)) {
+            Logger::log("PIC24", "Device %d answered 0x%04x to command 0x%04x", (int) i, status, command[0]);
+            drop_target((int) i, "The programming executive reported an error");
+        }
+    }
+}
 
+uint16_t PIC24::pe_word(int index, int target) {
+    return pe_response[index * targets.size() + target];
+}
 
+void PIC24::read_enhanced(uint32_t addr, std::vector<uint32_t> &words) {
+    uint16_t readp[] = {(uint16_t) (PE_READP << 12 | 4), (uint16_t) PE_READ_SIZE, (uint16_t) upper8(addr),
+                        (uint16_t) lower16(addr)};
+    pe_command(readp, 4, 2 + PE_READ_SIZE * 3 / 2);
 
+    // Two instructions are packed into three words
+    words.resize(targets.size() * PE_READ_SIZE);
+    for (size_t t = 0; t < targets.size(); t++) {
+        for (uint32_t i = 0; i < PE_READ_SIZE; i += 2) {
+            uint16_t low1 = pe_word(2 + i * 3 / 2, (int) t);
+            uint16_t high = pe_word(3 + i * 3 / 2, (int) t);
+            uint16_t low2 = pe_word(4 + i * 3 / 2, (int) t);
+            words[t * PE_READ_SIZE + i] = ((uint32_t) (high & 0xffu) << 16) | low1;
+            words[t * PE_READ_SIZE + i + 1] = ((uint32_t) (high & 0xff00u) << 8) | low2;
+        }
+    }
+}
+
+void PIC24::enter_enhanced() {
+    icsp.enter_enhanced();
+
+    uint16_t scheck[] = {(uint16_t) (PE_SCHECK << 12 | 1)};
+    pe_command(scheck, 1, 2);
+
+    uint16_t qver[] = {(uint16_t) (PE_QVER << 12 | 1)};
+    pe_command(qver, 1, 2);
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i].active) {
+            Logger::log("PIC24", "Programming executive version: 0x%02x", pe_word(0, (int) i) & 0xffu);
+            break;
+        }
+    }
+}
+
+void PIC24::program_enhanced(const Bundle &bundle) {
+    std::vector<MemoryWord> configWords;
+    prepare_config(bundle, configWords);
+    uint32_t instructions = bundle.get_instructions();
+
+    uint16_t qblank[] = {(uint16_t) (PE_QBLANK << 12 | 5), (uint16_t) (instructions >> 16),
+                         (uint16_t) (instructions & 0xffffu), 0, 0};
+    pe_command(qblank, 5, 2);
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i].active && (pe_word(0, (int) i) & 0xffu) != 0xf0) {
+            drop_target((int) i, "Program memory is not blank");
+        }
+    }
+
+    Logger::log("PIC24", "Programming device (%i of %i rows and %i config words)...", (int) bundle.row_count(),
+                (int) (instructions / BLOCK_READ_SIZE), (int) configWords.size());
+    // The packed rows already use the layout of PROGP (two instructions in three words)
+    uint16_t progp[3 + Bundle::ROW_WORDS];
+    progp[0] = PE_PROGP << 12 | (3 + Bundle::ROW_WORDS);
+    for (size_t row = 0; row < bundle.row_count(); row++) {
+        uint32_t addr = bundle.row_address(row);
+        progp[1] = (uint16_t) upper8(addr);
+        progp[2] = (uint16_t) lower16(addr);
+        std::copy(bundle.get_row(row).words, bundle.get_row(row).words + Bundle::ROW_WORDS, progp + 3);
+        pe_command(progp, 3 + Bundle::ROW_WORDS, 2);
+    }
+
+    for (size_t i = 0; i < configWords.size(); i++) {
+        uint32_t addr = configWords[i].address;
+        uint32_t data = configWords[i].data;
+        Logger::log("PIC24", "Config word 0x%06x: 0x%06x", addr, data);
+        uint16_t progw[] = {(uint16_t) (PE_PROGW << 12 | 4), (uint16_t) ((upper8(data) << 8) | upper8(addr)),
+                            (uint16_t) lower16(addr), (uint16_t) lower16(data)};
+        pe_command(progw, 4, 2);
+    }
+}
+
+int PIC24::verify_enhanced(const Bundle &bundle) {
+    Logger::log("PIC24", "Verifying %i rows and %i words of memory...", (int) bundle.row_count(),
+                (int) bundle.word_count());
+
+    // Devices whose CRC matches don't need to check the rows (only the other words)
+    uint32_t instructions = bundle.get_instructions();
+    uint16_t expected = bundle.get_crc();
+    uint16_t crcp[] = {(uint16_t) (PE_CRCP << 12 | 5), 0, 0, (uint16_t) (instructions >> 16),
+                       (uint16_t) (instructions & 0xffffu)};
+    pe_command(crcp, 5, 3);
+    uint32_t failed = 0;
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i].active && pe_word(2, (int) i) != expected) {
+            Logger::log("PIC24", "CRC of device %d is 0x%04x instead of 0x%04x", (int) i, pe_word(2, (int) i), expected);
+            failed |= 1u << i;
+        }
+    }
+
+    std::vector<uint32_t> words;
+    int mismatches = 0;
+    for (size_t row = 0; failed != 0 && row < bundle.row_count(); row++) {
+        uint32_t addr = bundle.row_address(row);
+        crcp[1] = (uint16_t) upper8(addr);
+        crcp[2] = (uint16_t) lower16(addr);
+        crcp[3] = 0;
+        crcp[4] = (uint16_t) MemoryImage::ROW_SIZE;
+        pe_command(crcp, 5, 3);
+        uint32_t row_failed = 0;
+        for (size_t i = 0; i < targets.size(); i++) {
+            if ((failed & (1u << i)) && targets[i].active && pe_word(2, (int) i) != bundle.get_row(row).crc) {
+                row_failed |= 1u << i;
+            }
+        }
+        if (row_failed == 0) {
+            continue;
+        }
+
+        Logger::log("PIC24", "CRC of the row at 0x%06x does not match, reading it back", addr);
+        for (uint32_t block = 0; block < MemoryImage::ROW_SIZE; block += PE_READ_SIZE) {
+            read_enhanced(addr + 2 * block, words);
+            for (uint32_t i = 0; i < PE_READ_SIZE; i++) {
+                uint32_t instruction = bundle.get_instruction(row, block + i);
+                for (size_t t = 0; t < targets.size(); t++) {
+                    uint32_t word = words[t * PE_READ_SIZE + i];
+                    if (!(row_failed & (1u << t))) {
+                        continue;
+                    }
+                    if ((word & 0xffffu) != (instruction & 0xffffu)) {
+                        report_mismatch((int) t, addr + 2 * (block + i), instruction & 0xffffu, word & 0xffffu);
+                        mismatches++;
+                    }
+                    if ((word >> 16) != (instruction >> 16)) {
+                        report_mismatch((int) t, addr + 2 * (block + i) + 1, instruction >> 16, word >> 16);
+                        mismatches++;
+                    }
+                }
+            }
+        }
+    }
+
+    // Everything beyond the code (like the config words) is read back
+    uint32_t current_block = 0xffffffffu;
+    for (size_t w = 0; w < bundle.word_count(); w++) {
+        const MemoryWord &word = bundle.get_word(w);
+        uint32_t block = word.address - word.address % (2 * PE_READ_SIZE);
+        if (block != current_block) {
+            read_enhanced(block, words);
+            current_block = block;
+        }
+
+        for (size_t i = 0; i < targets.size(); i++) {
+            if (!targets[i].active) {
+                continue;
+            }
+            uint32_t instruction = words[i * PE_READ_SIZE + (word.address - block) / 2];
+            uint32_t data = word.address % 2 == 1 ? (instruction >> 16) & 0xffu : instruction & 0xffffu;
+            if (data != word.data) {
+                report_mismatch((int) i, word.address, word.data, data);
+                mismatches++;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i].active && targets[i].mismatches > 0) {
+            drop_target((int) i, "Verification failed");
+        }
+    }
+
+    Logger::log("PIC24", "Verification Completed (%i mismatches)...", mismatches);
+    return mismatches;
+}
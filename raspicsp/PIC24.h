@@ -5,47 +5,54 @@
 #ifndef RASPICSP_PIC24_H
 #define RASPICSP_PIC24_H
 
-#include <list>
 #include "HAL.h"
 #include "devices.h"
 #include "ICSP.h"
+#include "Instructions.h"
+#include "Bundle.h"
 #include "HexFile.h"
+#include "HexWriter.h"
 
 /*
- * Enumerates all working registers supported by a PIC24
+ * Represents the state of one of the devices which are programmed in parallel
  */
-enum REG {
-    W0 = 0,
-    W1 = 1,
-    W2 = 2,
-    W3 = 3,
-    W4 = 4,
-    W5 = 5,
-    W6 = 6,
-    W7 = 7,
-    W8 = 8,
-    W9 = 9,
-    W10 = 10,
-    W11 = 11,
-    W12 = 12,
-    W13 = 13,
-    W14 = 14,
-    W15 = 15,
+class Target {
+public:
+    int active;
+    uint16_t device_id;
+    uint16_t device_revision;
+    int mismatches;
+
+    /*
+     * Contains the reason why the device was dropped (if it is no longer active)
+     */
+    const char *failure;
+};
+
+/*
+ * Enumerates the NVM operations whose completion times are tracked
+ */
+enum NVM_OPERATION {
+    NVM_CHIP_ERASE = 0,
+    NVM_PAGE_ERASE = 1,
+    NVM_ROW_WRITE = 2,
+    NVM_WORD_WRITE = 3
 };
 
 /*
- * Enumerates the modes when accessing registers in TBLRD* and TBLWT* instructions
- *
- * The 16-bit MCU and DSC Programmer’s Reference Manual (DS70157F) gets this wrong!
- * This seems more accurate: https://en.wikipedia.org/wiki/PIC_instruction_listings
+ * Collects the times (in microseconds) after which NVM operations of one kind were found to be complete
  */
-enum TBL_MODE {
-    DIRECT = 0,
-    INDIRECT = 1,
-    INDIRECT_POST_DEC = 2,
-    INDIRECT_POST_INC = 3,
-    INDIRECT_PRE_DEC = 4,
-    INDIRECT_PRE_INC = 5
+class NvmTiming {
+public:
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+
+    /*
+     * Counts the operations which were already complete when NVMCON was polled for the first time
+     */
+    uint32_t first_poll;
 };
 
 /*
@@ -56,106 +63,241 @@ class PIC24 {
 private:
 
     /*
-     * Represent the NOP instruction
+     * Contains the bit index of the WR bit which is set to initiate a write to the flash memory
+     */
+    static const uint32_t NVMCOM_WR_BIT = 15;
+
+    /*
+     * Contains the interval (in microseconds) in which NVMCON is polled once the expected duration
+     * of an NVM operation has elapsed. The interval doubles with every poll up to the maximum.
      */
-    static const uint32_t NOP = 0;
+    static const uint32_t MIN_NVM_POLL_INTERVAL = 10;
+    static const uint32_t MAX_NVM_POLL_INTERVAL = 5000;
 
     /*
-     * Contains the bit index of the WR bit which is set to initiate a write to the flash memory
+     * Determines how long to wait for an NVM operation before a device is considered dead: the
+     * expected duration times the factor plus the margin (in microseconds)
      */
-    static const uint32_t NVMCOM_WR_BIT = 15;
+    static const uint32_t NVM_TIMEOUT_FACTOR = 10;
+    static const uint32_t NVM_TIMEOUT_MARGIN = 10000;
+
+    /*
+     * Contains the op codes of the commands of the programming executive
+     */
+    static const uint16_t PE_SCHECK = 0x0;
+    static const uint16_t PE_READP = 0x2;
+    static const uint16_t PE_PROGP = 0x5;
+    static const uint16_t PE_QBLANK = 0xA;
+    static const uint16_t PE_QVER = 0xB;
+    static const uint16_t PE_CRCP = 0xC;
+    static const uint16_t PE_PROGW = 0xD;
+
+    /*
+     * Contains the number of instructions read by a single execution of block_read_sequence. Blocks
+     * are aligned, so that they never cross a boundary of TBLPAG.
+     */
+    static const uint32_t BLOCK_READ_SIZE = 64;
+
+    /*
+     * Contains the maximal number of instructions checked by a single run of target_blank (which copies
+     * them into RAM first)
+     */
+    static const uint32_t BLANK_BLOCK_SIZE = 512;
+
+    /*
+     * Enumerates the values of the digest computed by target_digest (see Bundle::digest)
+     */
+    static const int DIGEST_SUM = 0;
+    static const int DIGEST_WEIGHTED_SUM = 1;
+    static const int DIGEST_VALUES = 2;
+
+    /*
+     * Contains the time (in microseconds) the programming executive may take to process a command
+     */
+    static const uint32_t PE_TIMEOUT = 1000000;
+
+    /*
+     * Contains the number of instructions read at once via READP
+     */
+    static const uint32_t PE_READ_SIZE = 64;
 
     const DEVICE &device;
     ICSP icsp;
 
     /*
-     * Returns the upper 8 bits of a 24 bit word
+     * Contains the state of each connected device. All devices receive the same commands (SIX) but
+     * answer individually (VISI).
+     */
+    std::vector<Target> targets;
+    std::vector<uint16_t> visi;
+
+    /*
+     * Contains the completion times of each NVM_OPERATION
+     */
+    NvmTiming nvm_timing[4];
+
+    /*
+     * Contains the sequences which are executed over and over again. These are compiled once and
+     * only the operands (given by the step indices below) are patched before each execution.
+     */
+    Transaction nvm_poll;
+    Transaction read_sequence;
+    int read_tblpag_step;
+    int read_address_step;
+    Transaction block_read_sequence;
+    int block_tblpag_step;
+    int block_address_step;
+    Transaction write_block;
+    int write_data_steps[6];
+    Transaction row_write;
+    int row_tblpag_step;
+    int row_address_step;
+    Transaction page_erase;
+    int erase_tblpag_step;
+    int erase_address_step;
+    Transaction config_write;
+    int config_address_step;
+    int config_tblpag_step;
+    int config_data_steps[2];
+    Transaction nvm_start;
+    Transaction nvm_exit;
+    Transaction digest_sequence;
+
+    /*
+     * Contains the response of the last command of the programming executive
+     */
+    std::vector<uint16_t> pe_response;
+
+    /*
+     * Compiles the transactions above
      */
-    uint32_t upper8(uint32_t data);
+    void compile_transactions();
 
     /*
-     * Returns the lower 16 bits of a 24 bit word
+     * Sends the given command to the programming executive of all devices and receives the response
+     * (of the given length in words). Devices which don't respond or report an error are dropped.
      */
-    uint32_t lower16(uint32_t data);
+    void pe_command(const uint16_t *command, int count, int response_length);
 
     /*
-     * Creates a STO instruction which writes the value of the register to the given address
+     * Returns the given word of the response of the programming executive of the given device
      */
-    uint32_t STO(REG reg, uint32_t addr);
+    uint16_t pe_word(int index, int target);
 
     /*
-     * Creates a RET instruction which writes the value at the given address into the given register
+     * Reads PE_READ_SIZE instructions starting at the given address using the programming executive.
+     * words[t * PE_READ_SIZE + i] receives instruction i of target t.
      */
-    uint32_t RET(uint32_t addr, REG reg);
+    void read_enhanced(uint32_t addr, std::vector<uint32_t> &words);
 
     /*
-     * Creates a LDI instruction which loads the given data into the given register
+     * Copies count instructions starting at the given address into the RAM of each device: first the lower
+     * words, then the upper bytes
      */
-    uint32_t LDI(uint32_t data, REG reg);
+    void copy_to_ram(uint32_t addr, uint32_t count);
 
     /*
-     * Sets the given bit at the given address
+     * Checks on each device that count instructions (at most BLANK_BLOCK_SIZE) starting at the given address
+     * are erased. The instructions are copied into RAM and combined by REPEAT AND loops, so that only the
+     * results are transferred. Returns a bit mask of the active devices on which they are not erased.
      */
-    uint32_t BSET(uint32_t addr, uint8_t bit);
+    uint32_t target_blank(uint32_t addr, uint32_t count);
 
     /*
-     * Creates a TBLRDL instruction which transfers the lower 16 bits of the given memory source
-     * to the given destination register. The addressing modes are determined by src_mode and dest_mode.
+     * Computes the digest (see Bundle::digest) of the row of the image (MemoryImage::ROW_SIZE instructions)
+     * at the given address on each device. The sums are built by a precompiled sequence of ADD and ADDC
+     * instructions (a REPEAT loop of a single instruction can't weight the instructions by their position).
+     * values[v * targets + t] receives value v (see DIGEST_*) of target t.
      */
-    uint32_t TBLRDL(REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode);
+    void target_digest(uint32_t addr, std::vector<uint32_t> &values);
 
     /*
-     * Creates a TBLRDL instruction which transfers the upper 8 bits of the given memory source
-     * to the given destination register. The addressing modes are determined by src_mode and dest_mode.
+     * Compares count instructions of the image starting at the given (row aligned) address with the program
+     * memory of the devices. Instructions which are erased in the image are checked by target_blank, complete
+     * rows by their digest and the remaining ones are read back. Returns a bit mask of the active devices
+     * whose memory differs.
      */
-    uint32_t TBLRDH(REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode);
+    uint32_t compare_range(const MemoryImage &image, uint32_t addr, uint32_t count);
 
     /*
-     * Creates a TBLRDL instruction which transfers the lower 16 bits of the given source register
-     * to the given memory destination. The addressing modes are determined by src_mode and dest_mode.
+     * Waits until the device has executed the given number of cycles of a REPEAT loop
      */
-    uint32_t TBLWTL(REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode);
+    void wait_for_repeat(uint32_t cycles);
 
     /*
-     * Creates a TBLWTH instruction which transfers the upper 8 bits of the given source register
-     * to the given memory destination. The addressing modes are determined by src_mode and dest_mode.
+     * Verifies the rows of the bundle (as written by write_rows) using the digests computed by the devices.
+     * Rows whose digest doesn't match are read back to report the differences. Returns the number of
+     * mismatches.
      */
-    uint32_t TBLWTH(REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode);
+    int verify_code(const Bundle &bundle);
 
     /*
-     * Creates a TBLWTHB instruction which transfers the upper 8 bits of the given source register
-     * to the given memory destination - in byte mode. The addressing modes are determined by src_mode and dest_mode.
+     * Reads back the words of the bundle which are not part of its rows. Returns the number of mismatches.
      */
-    uint32_t TBLWTHB(REG src, TBL_MODE src_mode, REG dest, TBL_MODE dest_mode);
+    int verify_words(const Bundle &bundle);
 
     /*
-     * Creates a JMP instruction which which basically updates the program counter.
+     * Compares the given row of the bundle with the digests computed by the devices. Returns a bit mask
+     * of the active devices whose row doesn't match.
      */
-    uint32_t JMP(uint32_t addr);
+    uint32_t check_row(const Bundle &bundle, size_t row);
 
     /*
-     * Reads the given memory location.
+     * Reads back the given row from the given devices (bit mask) and reports the differences. Returns the
+     * number of mismatches.
      */
-    uint32_t read_word(uint32_t addr);
+    int read_back_row(const Bundle &bundle, size_t row, uint32_t failed);
 
     /*
-     * Writes up to 128 words at once.
+     * Erases the page starting at the given address
      */
-    uint32_t write_128words(uint32_t addr,
-                            std::vector<uint32_t>::const_iterator &iter,
-                            std::vector<uint32_t>::iterator end);
+    void erase_page(uint32_t addr);
 
     /*
-     * Fetches the next value to write. Defaults to 0 (NOP) if the end of the iterator is reached.
+     * Erases the executive memory
      */
-    uint32_t fetch_next(std::vector<uint32_t>::const_iterator &iter,
-                        const std::vector<uint32_t>::iterator &end);
+    void erase_executive();
 
+    /*
+     * Stops programming the given device as it failed for the given reason
+     */
+    void drop_target(int index, const char *reason);
 
     /*
-     * Writes the config words (which have to be written as single words)
+     * Logs (and counts) a word which doesn't contain the expected data
      */
-    void write_code_words(std::vector<uint32_t> &data);
+    void report_mismatch(int target, uint32_t addr, uint32_t expected, uint32_t data);
+
+    /*
+     * Waits until all active devices have completed the running NVM operation: first for the
+     * duration given by the device, then NVMCON is polled with increasing intervals.
+     */
+    void wait_for_nvm(NVM_OPERATION operation);
+
+    /*
+     * Reads the given memory location of each device
+     */
+    void read_word(uint32_t addr, std::vector<uint32_t> &words);
+
+    /*
+     * Writes a row of the device (device.ROW_SIZE instructions) at once, given as packed words (six words per
+     * four instructions, like the rows of a bundle).
+     */
+    void write_row(uint32_t addr, const uint16_t *words);
+
+    /*
+     * Writes the rows of the bundle from first (inclusive) to last (exclusive). The rows of the bundle are
+     * mapped onto the rows of the device: if those are larger, all rows of the bundle within a row of the
+     * device are written at once (everything else remains erased). If they are smaller, only the parts of
+     * the rows of the bundle which aren't erased are written.
+     */
+    void write_rows(const Bundle &bundle, size_t first, size_t last);
+
+    /*
+     * Returns the index of the first row of the bundle (starting at first) which is not within the same row of
+     * the device as the row at first
+     */
+    size_t next_device_row(const Bundle &bundle, size_t first);
 
     /*
      * Writes a single config word at the given adress
@@ -163,22 +305,45 @@ private:
     void write_config_word(uint32_t addr, uint32_t data);
 
     /*
-     * Splits the given memory into program code and config words
+     * Collects the config words to write for the given bundle. Config words which it doesn't contain
+     * are written as 0.
      */
-    void prepare_program(std::list<MemoryWord> &memory, std::vector<uint32_t> &code,
-                         std::vector<MemoryWord> &configWords);
+    void prepare_config(const Bundle &bundle, std::vector<MemoryWord> &configWords);
 
 public:
 
     /*
-     * Creates a new programmer for the given HAL and device.
+     * Creates a new programmer for the given HAL and device. If a capture is given, the whole
+     * session is recorded into it.
+     */
+    PIC24(HAL &hal, const DEVICE &device, Capture *capture = NULL);
+
+    /*
+     * Reads the device id and revision of each device. Devices which don't respond are dropped.
+     */
+    void read_device_id();
+
+    /*
+     * Returns the state of all connected devices
+     */
+    const std::vector<Target> &get_targets();
+
+    /*
+     * Returns the number of devices which have not been dropped
+     */
+    int active_targets();
+
+    /*
+     * Reads count instructions starting at the given address from each device. words[i * targets + t]
+     * receives instruction i of target t (with the upper 8 bits in bits 16 to 23).
      */
-    PIC24(HAL &hal, const DEVICE &device);
+    void read_block(uint32_t addr, uint32_t count, std::vector<uint32_t> &words);
 
     /*
-     * Reads the device id
+     * Reads the program memory and the config words of the first device and writes them to the given
+     * writer (row by row, as they are read). Rows which are erased completely are skipped.
      */
-    void read_device_id(uint16_t &higher, uint16_t &lower);
+    void dump(HexWriter &out);
 
     /*
      * Erases the complete program memory
@@ -186,14 +351,85 @@ public:
     void erase_chip();
 
     /*
-     * Writes the given memory contents to the device
+     * Writes the given bundle to a device which has already been programmed: only the pages
+     * which differ from the new contents (see compare_range) are erased and written again.
+     * Returns the number of pages written.
+     */
+    int program_differential(const Bundle &bundle);
+
+    /*
+     * Checks (using target_blank) that the program memory of all devices is erased.
+     * Devices which are not blank are dropped. Returns the number of devices which are blank.
+     */
+    int blank_check();
+
+    /*
+     * Writes the given bundle to the device
+     */
+    void program(const Bundle &bundle);
+
+    /*
+     * Writes the given bundle to the device, except for the rows which were already written (given by
+     * their addresses in ascending order)
+     */
+    void program(const Bundle &bundle, const std::vector<uint32_t> &written);
+
+    /*
+     * Writes the given bundle to the device like program, but checks each row right after it was written
+     * (using the digests computed by the devices, see check_row). If a row doesn't match, its page is erased
+     * and the rows written so far are written again, up to the given number of times. Devices on which a row
+     * still doesn't match are dropped (the differences are reported). The config words (and all other words) are
+     * read back at the end. Returns the number of rows and words which don't match.
+     */
+    int program_verified(const Bundle &bundle, int retries);
+
+    /*
+     * Writes a single row (MemoryImage::ROW_SIZE instructions) of program code to an erased device.
+     * This allows to program rows while the rest of the firmware is still being received. It requires
+     * a device whose rows aren't larger than the ones of the image.
+     */
+    void program_row(uint32_t addr, const uint32_t *instructions);
+
+    /*
+     * Verifies the contents on the chip against the given bundle. The code is verified using the
+     * digests computed by the devices, everything else is read back. Returns the number of mismatches
+     * found (on all devices). Devices with mismatches are dropped.
+     */
+    int verify(const Bundle &bundle);
+
+    /*
+     * Logs the measured completion times of the NVM operations, which can be used to tune the
+     * timing parameters of the device
+     */
+    void report_nvm_timing();
+
+    /*
+     * Determines if all devices contain a programming executive
+     */
+    int has_executive();
+
+    /*
+     * Writes the given programming executive into the executive memory of all devices
+     */
+    void program_executive(const MemoryImage &executive);
+
+    /*
+     * Switches into enhanced ICSP mode, so that commands are processed by the programming executive.
+     * Afterwards only the methods using the programming executive (*_enhanced) can be used.
+     */
+    void enter_enhanced();
+
+    /*
+     * Writes the given bundle to the device using the programming executive. The device has to be erased
+     * and its rows have to contain MemoryImage::ROW_SIZE instructions (which are written by a PROGP command).
      */
-    void program(std::list<MemoryWord> &memory);
+    void program_enhanced(const Bundle &bundle);
 
     /*
-     * Verifies the contents on the chip against the given memory contents
+     * Verifies the contents on the chip (like verify) using the programming executive. Devices whose CRC
+     * of the code doesn't match compare the CRCs of the rows and read back only the mismatching ones.
      */
-    void verify(std::list<MemoryWord> &memory);
+    int verify_enhanced(const Bundle &bundle);
 
 };
 
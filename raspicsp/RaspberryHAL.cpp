@@ -0,0 +1,350 @@
+#include <sys/fcntl.h>
+#include <sys/mman.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <exception>
+#include <stdexcept>
+#include "RaspberryHAL.h"
+#include "Logger.h"
+
+RaspberryHAL::RaspberryHAL(uint8_t mclr_pin, uint8_t pgd_pin, uint8_t pgc_pin,
+                           Delay::SOURCE delay_source, uint32_t half_period_ns) :
+        RaspberryHAL(std::vector<uint8_t>(1, mclr_pin), std::vector<uint8_t>(1, pgd_pin),
+                     std::vector<uint8_t>(1, pgc_pin), delay_source, half_period_ns) {
+}
+
+RaspberryHAL::RaspberryHAL(const std::vector<uint8_t> &mclr_pins, const std::vector<uint8_t> &pgd_pins,
+                           const std::vector<uint8_t> &pgc_pins, Delay::SOURCE delay_source,
+                           uint32_t half_period_ns) :
+        mclr_pins(mclr_pins), pgd_pins(pgd_pins), pgc_pins(pgc_pins), clock(delay_source, BCM2708_PERI_BASE) {
+    check_pins();
+    if (pgd_pins.size() == 1) {
+        Logger::log("HAL", "Starting HAL on pins %d (MCRL), %d (PGD) and %d (PGC)", mclr_pins[0], pgd_pins[0],
+                    pgc_pins[0]);
+    } else {
+        Logger::log("HAL", "Starting HAL for %d targets", (int) pgd_pins.size());
+        for (size_t i = 0; i < pgd_pins.size(); i++) {
+            Logger::log("HAL", "Target %d: pins %d (MCRL), %d (PGD) and %d (PGC)", (int) i,
+                        mclr_pins[mclr_pins.size() == 1 ? 0 : i], pgd_pins[i], pgc_pins[pgc_pins.size() == 1 ? 0 : i]);
+        }
+    }
+    Logger::log("HAL", "PGC half period: %d ns", half_period_ns);
+    half_period = clock.ticks_for(half_period_ns);
+#ifdef HAL_TIMING
+    timing.set_nominal_half_period(half_period_ns);
+#endif
+    selected = pgd_pins.size() == 32 ? 0xffffffffu : (1u << pgd_pins.size()) - 1;
+#ifndef DRYRUN
+    setup_io();
+    setup_pins();
+#else
+    gpio = dry_run_registers;
+#endif
+    setup_masks();
+}
+
+void RaspberryHAL::check_pins() {
+    if (pgd_pins.empty() || pgd_pins.size() > MAX_TARGETS) {
+        throw std::runtime_error("Between 1 and 32 PGD pins have to be given");
+    }
+    if ((mclr_pins.size() != 1 && mclr_pins.size() != pgd_pins.size()) ||
+        (pgc_pins.size() != 1 && pgc_pins.size() != pgd_pins.size())) {
+        throw std::runtime_error("MCLR and PGC have to be either shared or given once per target");
+    }
+
+    std::vector<uint8_t> pins(mclr_pins);
+    pins.insert(pins.end(), pgd_pins.begin(), pgd_pins.end());
+    pins.insert(pins.end(), pgc_pins.begin(), pgc_pins.end());
+    for (size_t i = 0; i < pins.size(); i++) {
+        if (pins[i] > 53) {
+            throw std::runtime_error("Invalid GPIO pin");
+        }
+        if (pins[i] / 32 != pins[0] / 32) {
+            throw std::runtime_error("All pins have to be in the same bank (either 0-31 or 32-53)");
+        }
+    }
+}
+
+void RaspberryHAL::setup_io() {
+    Logger::trace("HAL", "Mapping %d bytes starting at 0x%08x into address space", BLOCK_SIZE, GPIO_BASE);
+    int mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
+    if (mem_fd < 0) {
+        throw std::runtime_error("Cannot open /dev/mem");
+    }
+
+    void *gpio_map = mmap(
+            NULL,
+            BLOCK_SIZE,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED,
+            mem_fd,
+            GPIO_BASE
+    );
+
+    close(mem_fd);
+
+    if (gpio_map == MAP_FAILED) {
+        throw std::runtime_error("Cannot map GPIO registers into local address space");
+    }
+
+    gpio = (volatile unsigned *) gpio_map;
+}
+
+void RaspberryHAL::setup_pins() {
+    Logger::trace("HAL", "Setting all pins as output");
+    for (size_t i = 0; i < mclr_pins.size(); i++) {
+        make_input(mclr_pins[i]);
+        make_output(mclr_pins[i]);
+    }
+    for (size_t i = 0; i < pgc_pins.size(); i++) {
+        make_input(pgc_pins[i]);
+        make_output(pgc_pins[i]);
+    }
+    for (size_t i = 0; i < pgd_pins.size(); i++) {
+        make_input(pgd_pins[i]);
+        make_output(pgd_pins[i]);
+    }
+}
+
+uint32_t RaspberryHAL::selected_pins(const std::vector<uint8_t> &pins) {
+    if (pins.size() == 1) {
+        return 1u << (pins[0] % 32);
+    }
+
+    uint32_t mask = 0;
+    for (size_t i = 0; i < pins.size(); i++) {
+        if (selected & (1u << i)) {
+            mask |= 1u << (pins[i] % 32);
+        }
+    }
+    return mask;
+}
+
+void RaspberryHAL::setup_masks() {
+    uint8_t bank = (uint8_t) (pgd_pins[0] / 32);
+    set_register = gpio + GPSET0 + bank;
+    clear_register = gpio + GPCLR0 + bank;
+    level_register = gpio + GPLEV0 + bank;
+    pgd_registers[0] = clear_register;
+    pgd_registers[1] = set_register;
+    mclr_mask = selected_pins(mclr_pins);
+    pgc_mask = selected_pins(pgc_pins);
+    pgd_mask = 0;
+    first_selected = -1;
+    for (int i = 0; i < 6; i++) {
+        pgd_function_mask[i] = 0;
+        pgd_function_output[i] = 0;
+    }
+    for (size_t i = 0; i < pgd_pins.size(); i++) {
+        if (selected & (1u << i)) {
+            pgd_mask |= 1u << (pgd_pins[i] % 32);
+            pgd_function_mask[pgd_pins[i] / 10] |= 7u << ((pgd_pins[i] % 10) * 3);
+            pgd_function_output[pgd_pins[i] / 10] |= 1u << ((pgd_pins[i] % 10) * 3);
+            if (first_selected < 0) {
+                first_selected = (int) i;
+            }
+        }
+    }
+}
+
+void RaspberryHAL::make_input(uint8_t pin) {
+#ifndef DRYRUN
+    *(gpio + (pin / 10)) &= ~(7 << ((pin % 10) * 3));
+#else
+    (void) pin;
+#endif
+}
+
+void RaspberryHAL::make_output(uint8_t pin) {
+#ifndef DRYRUN
+    *(gpio + (pin / 10)) |= (1 << ((pin % 10) * 3));
+#else
+    (void) pin;
+#endif
+}
+
+void RaspberryHAL::set_pin(uint8_t pin) {
+#ifndef DRYRUN
+    *(gpio + GPSET0 + pin / 32) = 1u << (pin % 32);
+#else
+    (void) pin;
+#endif
+}
+
+void RaspberryHAL::clear_pin(uint8_t pin) {
+#ifndef DRYRUN
+    *(gpio + GPCLR0 + pin / 32) = 1u << (pin % 32);
+#else
+    (void) pin;
+#endif
+}
+
+void RaspberryHAL::mclr_up() {
+    *set_register = mclr_mask;
+}
+
+void RaspberryHAL::mclr_down() {
+    *clear_register = mclr_mask;
+}
+
+void RaspberryHAL::write_bit(int bit) {
+    shift_out(bit ? 1 : 0, 1, true);
+}
+
+int RaspberryHAL::read_bit() {
+    return shift_in(1, true);
+}
+
+void RaspberryHAL::write_mode() {
+    for (int i = 0; i < 6; i++) {
+        if (pgd_function_mask[i] != 0) {
+            *(gpio + i) = (*(gpio + i) & ~pgd_function_mask[i]) | pgd_function_output[i];
+        }
+    }
+}
+
+void RaspberryHAL::read_mode() {
+    for (int i = 0; i < 6; i++) {
+        if (pgd_function_mask[i] != 0) {
+            *(gpio + i) &= ~pgd_function_mask[i];
+        }
+    }
+}
+
+void RaspberryHAL::shift_out(uint32_t value, int nbits, bool lsb_first) {
+    if (!lsb_first) {
+        // Reverse the bits so that the loop below can always start with the LSB
+        uint32_t reversed = 0;
+        for (int i = 0; i < nbits; i++) {
+            reversed = (reversed << 1) | ((value >> i) & 1);
+        }
+        value = reversed;
+    }
+
+    // All targets receive the same bits, therefore PGD of all selected targets is changed at once
+    __sync_synchronize();
+    for (int i = 0; i < nbits; i++) {
+        *pgd_registers[value & 1] = pgd_mask;
+        value >>= 1;
+        clock.wait_ticks(half_period);
+        *set_register = pgc_mask;
+        TIMING_EDGE(timing);
+        clock.wait_ticks(half_period);
+        *clear_register = pgc_mask;
+        TIMING_EDGE(timing);
+    }
+    __sync_synchronize();
+}
+
+uint32_t RaspberryHAL::shift_in(int nbits, bool lsb_first) {
+    uint32_t values[MAX_TARGETS];
+    shift_in_all(nbits, lsb_first, values);
+    return first_selected < 0 ? 0 : values[first_selected];
+}
+
+int RaspberryHAL::targets() {
+    return (int) pgd_pins.size();
+}
+
+void RaspberryHAL::select_targets(uint32_t mask) {
+    mask &= pgd_pins.size() == 32 ? 0xffffffffu : (1u << pgd_pins.size()) - 1;
+    uint32_t dropped = selected & ~mask;
+    uint32_t added = mask & ~selected;
+    for (size_t i = 0; i < pgd_pins.size(); i++) {
+        if (dropped & (1u << i)) {
+            // Release PGD and keep the target in reset (or at least stop clocking it) if it has its own pins
+            make_input(pgd_pins[i]);
+            if (mclr_pins.size() > 1) {
+                clear_pin(mclr_pins[i]);
+            }
+            if (pgc_pins.size() > 1) {
+                clear_pin(pgc_pins[i]);
+            }
+        }
+        if (added & (1u << i)) {
+            // Drive the pins of the target again (low), it has to enter ICSP mode before it follows the others
+            if (mclr_pins.size() > 1) {
+                clear_pin(mclr_pins[i]);
+                make_input(mclr_pins[i]);
+                make_output(mclr_pins[i]);
+            }
+            if (pgc_pins.size() > 1) {
+                clear_pin(pgc_pins[i]);
+                make_input(pgc_pins[i]);
+                make_output(pgc_pins[i]);
+            }
+            clear_pin(pgd_pins[i]);
+            make_input(pgd_pins[i]);
+            make_output(pgd_pins[i]);
+        }
+    }
+    selected = mask;
+    setup_masks();
+}
+
+void RaspberryHAL::shift_in_all(int nbits, bool lsb_first, uint32_t *values) {
+    // Only the level registers are sampled while clocking. Distributing the bits to the
+    // targets is done afterwards so that the timing of PGC doesn't depend on the number of targets.
+    uint32_t levels[32];
+    __sync_synchronize();
+    for (int i = 0; i < nbits; i++) {
+        *set_register = pgc_mask;
+        TIMING_EDGE(timing);
+        clock.wait_ticks(half_period);
+        levels[i] = *level_register;
+        *clear_register = pgc_mask;
+        TIMING_EDGE(timing);
+        clock.wait_ticks(half_period);
+    }
+    __sync_synchronize();
+
+    decode_levels(levels, nbits, lsb_first, values);
+}
+
+void RaspberryHAL::decode_levels(const uint32_t *levels, int nbits, bool lsb_first, uint32_t *values) {
+    for (size_t target = 0; target < pgd_pins.size(); target++) {
+        if (!(selected & (1u << target))) {
+            continue;
+        }
+        uint8_t shift = (uint8_t) (pgd_pins[target] % 32);
+        uint32_t result = 0;
+        for (int i = 0; i < nbits; i++) {
+            result |= ((levels[i] >> shift) & 1) << (lsb_first ? i : nbits - 1 - i);
+        }
+        values[target] = result;
+    }
+}
+
+void RaspberryHAL::sample_all(uint32_t *values) {
+    uint32_t level = *level_register;
+    decode_levels(&level, 1, true, values);
+}
+
+void RaspberryHAL::replay(const uint8_t *cycles, size_t count, uint32_t *levels) {
+    __sync_synchronize();
+    for (size_t i = 0; i < count; i++) {
+        uint8_t cycle = cycles[i];
+        if (cycle <= CYCLE_HIGH) {
+            *pgd_registers[cycle] = pgd_mask;
+            clock.wait_ticks(half_period);
+            *set_register = pgc_mask;
+            TIMING_EDGE(timing);
+            clock.wait_ticks(half_period);
+            *clear_register = pgc_mask;
+            TIMING_EDGE(timing);
+        } else if (cycle == CYCLE_READ) {
+            *set_register = pgc_mask;
+            TIMING_EDGE(timing);
+            clock.wait_ticks(half_period);
+            *levels++ = *level_register;
+            *clear_register = pgc_mask;
+            TIMING_EDGE(timing);
+            clock.wait_ticks(half_period);
+        } else if (cycle == CYCLE_READ_MODE) {
+            read_mode();
+        } else {
+            write_mode();
+        }
+    }
+    __sync_synchronize();
+}
@@ -0,0 +1,171 @@
+//
+// Defines the HAL backend which drives the GPIOs of a raspberry PI.
+//
+
+#ifndef RASPICSP_RASPBERRYHAL_H
+#define RASPICSP_RASPBERRYHAL_H
+
+#include <vector>
+#include "HAL.h"
+#include "Delay.h"
+
+/*
+ * Contains raspberry PI specific code to drive the GPIO pins in order to behave as required
+ * for the pins MCLR (reset pin), PGC (clock), PGD (data).
+ */
+class RaspberryHAL : public HAL {
+private:
+
+    static const uint32_t BCM2708_PERI_BASE = 0x20000000;
+    static const uint32_t GPIO_BASE = BCM2708_PERI_BASE + 0x200000;
+    static const uint32_t BLOCK_SIZE = 4096;
+
+    /*
+     * Contains the register offsets (in words) of GPSET0, GPCLR0 and GPLEV0. Pins 32 and above
+     * are controlled by the next register (GPSET1...)
+     */
+    static const uint32_t GPSET0 = 7;
+    static const uint32_t GPCLR0 = 10;
+    static const uint32_t GPLEV0 = 13;
+
+    /*
+     * Contains one PGD pin per target. MCLR and PGC are either shared by all targets (a single pin)
+     * or there is one per target. All pins have to be in the same bank, so that a single write to
+     * GPSET or GPCLR can change all of them at once.
+     */
+    std::vector<uint8_t> mclr_pins;
+    std::vector<uint8_t> pgd_pins;
+    std::vector<uint8_t> pgc_pins;
+    uint32_t selected;
+    volatile unsigned *gpio;
+    Delay clock;
+    uint64_t half_period;
+
+    /*
+     * Contains the registers and masks used by shift_out and shift_in. pgd_registers contains
+     * the GPCLR register at index 0 and the GPSET register at index 1. The masks only contain the
+     * pins of the selected targets.
+     */
+    volatile unsigned *set_register;
+    volatile unsigned *clear_register;
+    volatile unsigned *level_register;
+    volatile unsigned *pgd_registers[2];
+    uint32_t mclr_mask;
+    uint32_t pgd_mask;
+    uint32_t pgc_mask;
+    int first_selected;
+
+    /*
+     * Contains the bits of the function select registers (GPFSEL0..5) which control the direction
+     * of the selected PGD pins, so that switching between read and write mode needs one access
+     * per register instead of one per pin.
+     */
+    uint32_t pgd_function_mask[6];
+    uint32_t pgd_function_output[6];
+
+#ifdef DRYRUN
+    unsigned dry_run_registers[BLOCK_SIZE / 4];
+#endif
+
+    /*
+     * Maps the GPIO pins into the address space of our process to gain control
+     */
+    void setup_io();
+
+    /*
+     * Initializes the GPIO pins as required
+     */
+    void setup_pins();
+
+    /*
+     * Computes the registers and masks used by shift_out and shift_in
+     */
+    void setup_masks();
+
+    /*
+     * Returns the mask of all pins in the given list which belong to the selected targets. A list
+     * containing a single pin is shared by all targets.
+     */
+    uint32_t selected_pins(const std::vector<uint8_t> &pins);
+
+    /*
+     * Ensures that all pins are located in the same bank
+     */
+    void check_pins();
+
+    /*
+     * Makes the given pin an input pin
+     */
+    void make_input(uint8_t pin);
+
+    /*
+     * Makes the given pin an output pin
+     */
+    void make_output(uint8_t pin);
+
+    /*
+     * Writes a 1 (high) to the given pin
+     */
+    void set_pin(uint8_t pin);
+
+    /*
+     * Writes a 0 (low) to the given pin
+     */
+    void clear_pin(uint8_t pin);
+
+public:
+
+    /*
+     * Contains the default half period of PGC in nanoseconds
+     */
+    static const uint32_t DEFAULT_HALF_PERIOD_NS = 1000;
+
+    /*
+     * Creates a new instance which uses the given GPIOs as MCLR, PGD und PGC. PGC is driven with
+     * the given half period which is timed using the given source.
+     */
+    RaspberryHAL(uint8_t mclr_pin, uint8_t pgd_pin, uint8_t pgc_pin,
+                 Delay::SOURCE delay_source = Delay::CLOCK,
+                 uint32_t half_period_ns = DEFAULT_HALF_PERIOD_NS);
+
+    /*
+     * Creates a new instance which drives one target per given PGD pin (gang programming). MCLR and
+     * PGC may either contain a single (shared) pin or one pin per target.
+     */
+    RaspberryHAL(const std::vector<uint8_t> &mclr_pins, const std::vector<uint8_t> &pgd_pins,
+                 const std::vector<uint8_t> &pgc_pins,
+                 Delay::SOURCE delay_source = Delay::CLOCK,
+                 uint32_t half_period_ns = DEFAULT_HALF_PERIOD_NS);
+
+    virtual void mclr_up();
+
+    virtual void mclr_down();
+
+    virtual void write_mode();
+
+    virtual void read_mode();
+
+    virtual void write_bit(int bit);
+
+    virtual int read_bit();
+
+    virtual void shift_out(uint32_t value, int nbits, bool lsb_first);
+
+    virtual uint32_t shift_in(int nbits, bool lsb_first);
+
+    virtual int targets();
+
+    virtual void select_targets(uint32_t mask);
+
+    virtual void shift_in_all(int nbits, bool lsb_first, uint32_t *values);
+
+    virtual void sample_all(uint32_t *values);
+
+    virtual void replay(const uint8_t *cycles, size_t count, uint32_t *levels);
+
+    virtual void decode_levels(const uint32_t *levels, int nbits, bool lsb_first, uint32_t *values);
+
+};
+
+
+#endif //RASPICSP_RASPBERRYHAL_H
@@ -0,0 +1,100 @@
+#include <sys/mman.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "RealtimeSession.h"
+#include "Delay.h"
+#include "Logger.h"
+
+RealtimeSession::RealtimeSession(int enabled, int cpu) : enabled(enabled), cpu(cpu) {
+    locked = 0;
+    scheduled = 0;
+    pinned = 0;
+    if (!enabled) {
+        return;
+    }
+
+    Logger::log("RT", "Entering real-time mode");
+    if (cpu >= 0) {
+        pin_cpu();
+    }
+
+    // All pages mapped later on (including new heap pages) are locked and faulted in right away as well
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+        locked = 1;
+    } else {
+        Logger::log("RT", "Warning: Cannot lock memory: %s", strerror(errno));
+    }
+    prefault_stack();
+
+    old_policy = sched_getscheduler(0);
+    sched_getparam(0, &old_param);
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = PRIORITY;
+    if (sched_setscheduler(0, SCHED_FIFO, &param) == 0) {
+        scheduled = 1;
+    } else {
+        Logger::log("RT", "Warning: Cannot switch to SCHED_FIFO: %s", strerror(errno));
+    }
+    Delay::reset_latencies();
+}
+
+void RealtimeSession::pin_cpu() {
+    char isolated[256] = "";
+    FILE *file = fopen("/sys/devices/system/cpu/isolated", "r");
+    if (file != NULL) {
+        if (fgets(isolated, sizeof(isolated), file) == NULL) {
+            isolated[0] = 0;
+        }
+        fclose(file);
+    }
+    isolated[strcspn(isolated, "\n")] = 0;
+    Logger::log("RT", "Pinning to CPU %d (isolated CPUs: %s)", cpu, isolated[0] ? isolated : "none");
+
+    sched_getaffinity(0, sizeof(old_affinity), &old_affinity);
+    cpu_set_t affinity;
+    CPU_ZERO(&affinity);
+    CPU_SET(cpu, &affinity);
+    if (sched_setaffinity(0, sizeof(affinity), &affinity) == 0) {
+        pinned = 1;
+    } else {
+        Logger::log("RT", "Warning: Cannot pin to CPU %d: %s", cpu, strerror(errno));
+    }
+}
+
+void RealtimeSession::prefault_stack() {
+    volatile char buffer[PREFAULT_STACK_SIZE];
+    for (int i = 0; i < PREFAULT_STACK_SIZE; i += 4096) {
+        buffer[i] = 0;
+    }
+    // Only touching the pages matters, the stores can't be dropped as the buffer is volatile
+    (void) buffer;
+}
+
+void RealtimeSession::report() {
+    if (!enabled) {
+        return;
+    }
+    Logger::log("RT", "Worst latency: %.1f us while clocking PGC, %.1f us when waking up from a delay",
+                Delay::worst_overrun() / 1000.0, Delay::worst_wakeup() / 1000.0);
+    Delay::reset_latencies();
+}
+
+RealtimeSession::~RealtimeSession() {
+    if (!enabled) {
+        return;
+    }
+
+    report();
+    if (scheduled) {
+        sched_setscheduler(0, old_policy, &old_param);
+    }
+    if (locked) {
+        munlockall();
+    }
+    if (pinned) {
+        sched_setaffinity(0, sizeof(old_affinity), &old_affinity);
+    }
+    Logger::log("RT", "Left real-time mode");
+}
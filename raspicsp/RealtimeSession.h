@@ -0,0 +1,74 @@
+//
+// Provides a real-time environment for the duration of a programming session
+//
+
+#ifndef RASPICSP_REALTIMESESSION_H
+#define RASPICSP_REALTIMESESSION_H
+
+#include <sched.h>
+#include <stdint.h>
+
+/*
+ * Switches the calling thread into a real-time mode while it exists.
+ *
+ * A single preemption while PGC is high stretches the clock pulse by milliseconds, therefore the thread
+ * is raised to SCHED_FIFO, all memory is locked (and the stack is prefaulted) so that no page fault
+ * can occur and the thread is optionally pinned to a (preferably isolated) CPU. While the session runs,
+ * the worst overrun of a PGC half period and the worst wake-up from a delay are recorded (see Delay), so
+ * that the latencies reported are the ones the session actually suffered. When the session ends,
+ * everything is restored.
+ */
+class RealtimeSession {
+private:
+
+    /*
+     * Contains the priority used for SCHED_FIFO
+     */
+    static const int PRIORITY = 80;
+
+    /*
+     * Contains the number of bytes of stack which are touched so that they are mapped (and locked)
+     */
+    static const int PREFAULT_STACK_SIZE = 256 * 1024;
+
+    int enabled;
+    int cpu;
+    int old_policy;
+    struct sched_param old_param;
+    cpu_set_t old_affinity;
+    int locked;
+    int scheduled;
+    int pinned;
+
+    /*
+     * Pins the thread to the given CPU
+     */
+    void pin_cpu();
+
+    /*
+     * Touches the given amount of stack so that it is mapped before the session starts
+     */
+    void prefault_stack();
+
+public:
+
+    /*
+     * Enters the real-time mode if enabled is non-zero. If cpu is not negative, the thread is
+     * pinned to the given CPU.
+     */
+    RealtimeSession(int enabled, int cpu);
+
+    /*
+     * Reports the latencies recorded since the session was entered (or since the last report) and starts
+     * recording them again
+     */
+    void report();
+
+    /*
+     * Reports the latencies and restores the previous settings
+     */
+    ~RealtimeSession();
+};
+
+
+#endif //RASPICSP_REALTIMESESSION_H
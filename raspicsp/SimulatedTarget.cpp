@@ -0,0 +1,663 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "SimulatedTarget.h"
+#include "Logger.h"
+
+const uint32_t SimulatedTarget::ERASED;
+
+SimulatedTarget::SimulatedTarget(const DEVICE &device, uint16_t device_id, uint16_t device_revision) :
+        device(device), device_id(device_id), device_revision(device_revision) {
+    // The program memory ends with the page containing the config words
+    uint32_t end = device.CONFIG_WORDS_START_ADDR + 2 * device.NO_CONFIG_WORDS;
+    uint32_t page_size = 2 * device.PAGE_SIZE;
+    end = (end + page_size - 1) / page_size * page_size;
+    flash.assign(end / 2, ERASED);
+    executive.assign(device.EXECUTIVE_SIZE / 2, ERASED);
+
+    memset(data, 0, sizeof(data));
+    latches.assign(device.WRITE_LATCHES, ERASED);
+    latch_addr = 0;
+    nvm_busy_until = 0;
+
+    state = RESET;
+    shift_register = 0;
+    bit_count = 0;
+    control_length = 4;
+    regout = 0;
+    now = 0;
+    pc = 0;
+    pending_goto = 0;
+    pending_nops = 0;
+    pending_repeat = 0;
+    cpu_busy_until = 0;
+    carry = 0;
+    pe_index = 0;
+    pe_ready = 0;
+
+    six_count = 0;
+    regout_count = 0;
+    nvm_count = 0;
+    pe_count = 0;
+    violations = 0;
+}
+
+void SimulatedTarget::violation(const char *format, ...) {
+    violations++;
+    if (violations <= 20) {
+        char buffer[256];
+        va_list argptr;
+        va_start(argptr, format);
+        vsnprintf(buffer, sizeof(buffer), format, argptr);
+        va_end(argptr);
+        Logger::log("SIM", "Violation at %.6f s: %s", now / 1e9, buffer);
+    } else if (violations == 21) {
+        Logger::log("SIM", "Too many violations - suppressing further messages...");
+    }
+}
+
+void SimulatedTarget::set_mclr(int level, uint64_t time) {
+    now = time;
+    if (!level) {
+        if (state != RESET) {
+            Logger::trace("SIM", "MCLR low - device is held in reset");
+        }
+        state = RESET;
+        shift_register = 0;
+        bit_count = 0;
+        return;
+    }
+
+    if (state != RESET) {
+        return;
+    }
+
+    if (bit_count >= device.ICSP_CODE_LENGTH && shift_register == device.ICSP_CODE) {
+        Logger::trace("SIM", "Entered ICSP mode");
+        state = CONTROL;
+        // Coming out of reset, the first control code is a forced SIX which requires 5 additional clocks
+        control_length = 9;
+        pc = 0;
+        pending_goto = 0;
+        pending_nops = 0;
+        pending_repeat = 0;
+        carry = 0;
+    } else if (bit_count >= device.ICSP_CODE_LENGTH && shift_register == device.EICSP_CODE) {
+        if (has_executive()) {
+            Logger::trace("SIM", "Entered enhanced ICSP mode");
+            state = PE_COMMAND;
+            pe_command.clear();
+        } else {
+            violation("Enhanced ICSP mode entered without a programming executive");
+            state = RUNNING;
+        }
+    } else {
+        Logger::trace("SIM", "MCLR high without a valid ICSP code (0x%08x) - running user code", shift_register);
+        state = RUNNING;
+    }
+    shift_register = 0;
+    bit_count = 0;
+}
+
+void SimulatedTarget::clock_in(int bit, uint64_t time) {
+    now = time;
+    switch (state) {
+        case RESET:
+            shift_register = (shift_register << 1) | (bit ? 1 : 0);
+            if (bit_count < 32) {
+                bit_count++;
+            }
+            return;
+        case RUNNING:
+            return;
+        case CONTROL:
+            shift_register |= (bit ? 1u : 0u) << bit_count;
+            if (++bit_count == control_length) {
+                uint32_t control_code = control_length == 4 ? shift_register : 0;
+                control_length = 4;
+                shift_register = 0;
+                bit_count = 0;
+                if (control_code == 0) {
+                    state = SIX;
+                } else if (control_code == 1) {
+                    state = REGOUT_IDLE;
+                } else {
+                    violation("Unknown control code: 0x%x", control_code);
+                }
+            }
+            return;
+        case SIX:
+            shift_register |= (bit ? 1u : 0u) << bit_count;
+            if (++bit_count == 24) {
+                uint32_t op_code = shift_register;
+                shift_register = 0;
+                bit_count = 0;
+                state = CONTROL;
+                six_count++;
+                execute(op_code);
+            }
+            return;
+        case REGOUT_IDLE:
+            if (++bit_count == 8) {
+                bit_count = 0;
+                regout = data[device.VISI_ADDR >> 1];
+                regout_count++;
+                state = REGOUT_DATA;
+            }
+            return;
+        case REGOUT_DATA:
+            violation("PGD driven by the host while the device outputs VISI");
+            clock_out(time);
+            return;
+        case PE_COMMAND:
+            // Commands of the programming executive are sent as 16 bit words, MSB first
+            shift_register = (shift_register << 1) | (bit ? 1 : 0);
+            if (++bit_count == 16) {
+                pe_command.push_back((uint16_t) shift_register);
+                shift_register = 0;
+                bit_count = 0;
+                if ((pe_command[0] & 0xfffu) == 0) {
+                    violation("Command 0x%04x of the programming executive has no length", pe_command[0]);
+                    pe_command.clear();
+                } else if (pe_command.size() == (pe_command[0] & 0xfffu)) {
+                    execute_pe_command();
+                }
+            }
+            return;
+        case PE_RESPONSE:
+            violation("PGD driven by the host while the programming executive responds");
+            return;
+    }
+}
+
+int SimulatedTarget::sample(uint64_t time) {
+    now = time;
+    if (state == PE_RESPONSE) {
+        if (pe_index == 0 && bit_count == 0) {
+            // Handshake: PGD is held high until the response is ready
+            return now < pe_ready ? 1 : 0;
+        }
+        return (pe_response[pe_index] >> (15 - bit_count)) & 1;
+    }
+    return 1;
+}
+
+int SimulatedTarget::clock_out(uint64_t time) {
+    now = time;
+    if (state == PE_RESPONSE) {
+        if (now < pe_ready) {
+            violation("Response of the programming executive clocked before it was ready");
+        }
+        int result = (pe_response[pe_index] >> (15 - bit_count)) & 1;
+        if (++bit_count == 16) {
+            bit_count = 0;
+            if (++pe_index == pe_response.size()) {
+                state = PE_COMMAND;
+                pe_command.clear();
+            }
+        }
+        return result;
+    }
+    if (state != REGOUT_DATA) {
+        violation("PGD read while the device is not driving it");
+        return 0;
+    }
+
+    int result = (regout >> bit_count) & 1;
+    if (++bit_count == 16) {
+        bit_count = 0;
+        state = CONTROL;
+    }
+    return result;
+}
+
+uint32_t SimulatedTarget::peek(uint32_t addr) {
+    return read_program(addr);
+}
+
+void SimulatedTarget::execute(uint32_t op_code) {
+    pc += 2;
+    if (pending_goto) {
+        // The second word of GOTO contains the upper 7 bits of the target address
+        pending_goto = 0;
+        if ((op_code & 0xffff80u) != 0) {
+            violation("Invalid second word of GOTO: 0x%06x", op_code);
+        }
+        pc |= (op_code & 0x7fu) << 16;
+        return;
+    }
+
+    int nop = op_code == 0 || (op_code & 0xff0000u) == 0xff0000u;
+    if (pending_nops > 0) {
+        pending_nops--;
+        if (!nop) {
+            violation("0x%06x was sent while the pipeline still requires a NOP", op_code);
+        }
+    }
+    if (nop) {
+        return;
+    }
+    if (now < cpu_busy_until) {
+        violation("0x%06x was sent while a REPEAT loop is still running", op_code);
+    }
+
+    if ((op_code & 0xffc000u) == 0x090000u) {
+        // REPEAT #lit14: the next instruction is executed lit14 + 1 times
+        pending_repeat = op_code & 0x3fffu;
+        return;
+    }
+
+    uint32_t count = pending_repeat + 1;
+    pending_repeat = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        execute_once(op_code);
+    }
+    if (count > 1) {
+        // Table operations take two cycles
+        uint32_t cycles = (op_code & 0xfe0000u) == 0xba0000u ? 2 : 1;
+        cpu_busy_until = now + (uint64_t) count * cycles * device.INSTRUCTION_CYCLE_TIME;
+    }
+}
+
+void SimulatedTarget::execute_once(uint32_t op_code) {
+    if ((op_code & 0xf00000u) == 0x200000u) {
+        // MOV #lit16, Wnd
+        data[op_code & 0xfu] = (uint16_t) ((op_code >> 4) & 0xffffu);
+    } else if ((op_code & 0xf80000u) == 0x880000u) {
+        // MOV Wns, f
+        write_data((uint16_t) ((op_code >> 3) & 0xfffeu), data[op_code & 0xfu], 0);
+    } else if ((op_code & 0xf80000u) == 0x800000u) {
+        // MOV f, Wnd
+        data[op_code & 0xfu] = read_data((uint16_t) ((op_code >> 3) & 0xfffeu), 0);
+    } else if ((op_code & 0xff0000u) == 0xa80000u) {
+        // BSET f, #bit4
+        uint16_t addr = (uint16_t) (op_code & 0x1ffeu);
+        uint8_t bit = (uint8_t) (((op_code >> 12) & 0xeu) | (op_code & 0x1u));
+        write_data(addr, read_data(addr, 0) | (uint16_t) (1u << bit), 0);
+        if (addr == device.NVMCON_ADDR) {
+            pending_nops = 2;
+        }
+    } else if ((op_code & 0xff0000u) == 0x040000u) {
+        // GOTO
+        pc = op_code & 0xfffeu;
+        pending_goto = 1;
+    } else if ((op_code & 0xfe0000u) == 0xba0000u) {
+        execute_table_op(op_code);
+        pending_nops = 2;
+    } else if ((op_code & 0xf80000u) == 0x400000u || (op_code & 0xf80000u) == 0x480000u ||
+               (op_code & 0xf80000u) == 0x600000u || (op_code & 0xf80000u) == 0x680000u) {
+        execute_alu_op(op_code);
+    } else {
+        violation("Unsupported instruction: 0x%06x", op_code);
+    }
+}
+
+uint16_t SimulatedTarget::effective_address(uint8_t reg, uint8_t mode, uint16_t step) {
+    uint16_t addr = data[reg];
+    switch (mode) {
+        case 1:
+            return addr;
+        case 2:
+            data[reg] = addr - step;
+            return addr;
+        case 3:
+            data[reg] = addr + step;
+            return addr;
+        case 4:
+            data[reg] = addr - step;
+            return data[reg];
+        case 5:
+            data[reg] = addr + step;
+            return data[reg];
+        default:
+            violation("Invalid addressing mode for an indirect operand: %d", mode);
+            return addr;
+    }
+}
+
+void SimulatedTarget::execute_alu_op(uint32_t op_code) {
+    if (op_code & 0x004000u) {
+        violation("Byte mode is not supported: 0x%06x", op_code);
+        return;
+    }
+    uint8_t base = (uint8_t) ((op_code >> 15) & 0xfu);
+    uint8_t dest_mode = (uint8_t) ((op_code >> 11) & 0x7u);
+    uint8_t dest = (uint8_t) ((op_code >> 7) & 0xfu);
+    uint8_t src_mode = (uint8_t) ((op_code >> 4) & 0x7u);
+    uint8_t src = (uint8_t) (op_code & 0xfu);
+
+    uint16_t value = src_mode == 0 ? data[src] : read_data(effective_address(src, src_mode, 2), 0);
+    uint16_t result;
+    switch (op_code & 0xf80000u) {
+        case 0x400000u:
+        case 0x480000u: {
+            uint32_t sum = (uint32_t) data[base] + value + ((op_code & 0xf80000u) == 0x480000u ? carry : 0);
+            result = (uint16_t) sum;
+            carry = sum > 0xffffu;
+            break;
+        }
+        case 0x600000u:
+            result = (uint16_t) (data[base] & value);
+            break;
+        default:
+            result = (uint16_t) (data[base] ^ value);
+            break;
+    }
+
+    if (dest_mode == 0) {
+        data[dest] = result;
+    } else {
+        write_data(effective_address(dest, dest_mode, 2), result, 0);
+    }
+}
+
+void SimulatedTarget::execute_table_op(uint32_t op_code) {
+    int write = (op_code & 0x010000u) != 0;
+    int high = (op_code & 0x008000u) != 0;
+    int byte_mode = (op_code & 0x004000u) != 0;
+    uint8_t dest_mode = (uint8_t) ((op_code >> 11) & 0x7u);
+    uint8_t dest = (uint8_t) ((op_code >> 7) & 0xfu);
+    uint8_t src_mode = (uint8_t) ((op_code >> 4) & 0x7u);
+    uint8_t src = (uint8_t) (op_code & 0xfu);
+    uint16_t step = (uint16_t) (byte_mode ? 1 : 2);
+    uint32_t page = (uint32_t) (data[device.TBLPAG_ADDR >> 1] & 0xffu) << 16;
+
+    if (!write) {
+        uint32_t addr = page | effective_address(src, src_mode, step);
+        uint32_t word = read_program(addr);
+        uint16_t value;
+        if (high) {
+            value = (uint16_t) (byte_mode && (addr & 1) ? 0 : (word >> 16) & 0xffu);
+        } else if (byte_mode) {
+            value = (uint16_t) ((addr & 1) ? (word >> 8) & 0xffu : word & 0xffu);
+        } else {
+            value = (uint16_t) (word & 0xffffu);
+        }
+
+        if (dest_mode == 0) {
+            data[dest] = byte_mode ? (uint16_t) ((data[dest] & 0xff00u) | value) : value;
+        } else {
+            write_data(effective_address(dest, dest_mode, step), value, byte_mode);
+        }
+        return;
+    }
+
+    uint16_t value = src_mode == 0 ? data[src] : read_data(effective_address(src, src_mode, step), byte_mode);
+    if (dest_mode == 0) {
+        violation("Table write requires an indirect destination: 0x%06x", op_code);
+        return;
+    }
+    uint32_t addr = page | effective_address(dest, dest_mode, step);
+    if (nvm_busy()) {
+        violation("Write latch 0x%06x written while the flash is busy", addr);
+    }
+
+    uint32_t &latch = latches[(addr >> 1) % latches.size()];
+    if (high) {
+        if (!byte_mode || !(addr & 1)) {
+            latch = (latch & 0x00ffffu) | ((uint32_t) (value & 0xffu) << 16);
+        }
+    } else if (byte_mode) {
+        if (addr & 1) {
+            latch = (latch & 0xff00ffu) | ((uint32_t) (value & 0xffu) << 8);
+        } else {
+            latch = (latch & 0xffff00u) | (value & 0xffu);
+        }
+    } else {
+        latch = (latch & 0xff0000u) | value;
+    }
+    latch_addr = addr & ~1u;
+}
+
+uint16_t SimulatedTarget::read_data(uint16_t addr, int byte_mode) {
+    if (addr >= DATA_MEMORY_SIZE) {
+        violation("Read from unimplemented data memory: 0x%04x", addr);
+        return 0;
+    }
+    if ((addr & ~1u) == device.NVMCON_ADDR && (data[addr >> 1] & NVMCON_WR) && !nvm_busy()) {
+        data[addr >> 1] &= ~NVMCON_WR;
+    }
+
+    uint16_t word = data[addr >> 1];
+    if (byte_mode) {
+        return (uint16_t) ((addr & 1) ? word >> 8 : word & 0xffu);
+    }
+    return word;
+}
+
+void SimulatedTarget::write_data(uint16_t addr, uint16_t value, int byte_mode) {
+    if (addr >= DATA_MEMORY_SIZE) {
+        violation("Write to unimplemented data memory: 0x%04x", addr);
+        return;
+    }
+
+    uint16_t &word = data[addr >> 1];
+    if (byte_mode) {
+        value = (addr & 1) ? (uint16_t) ((word & 0x00ffu) | (value << 8)) : (uint16_t) ((word & 0xff00u) | (value & 0xffu));
+    }
+
+    if ((addr & ~1u) == device.NVMCON_ADDR) {
+        if (nvm_busy()) {
+            violation("NVMCON written while the flash is busy");
+            return;
+        }
+        word = value;
+        if (value & NVMCON_WR) {
+            start_nvm_operation();
+        }
+        return;
+    }
+
+    word = value;
+}
+
+uint32_t *SimulatedTarget::program_word(uint32_t addr) {
+    addr &= ~1u;
+    if ((addr >> 1) < flash.size()) {
+        return &flash[addr >> 1];
+    }
+    if (addr >= device.EXECUTIVE_ADDR && addr < device.EXECUTIVE_ADDR + device.EXECUTIVE_SIZE) {
+        return &executive[(addr - device.EXECUTIVE_ADDR) >> 1];
+    }
+    return NULL;
+}
+
+uint32_t SimulatedTarget::read_program(uint32_t addr) {
+    addr &= ~1u;
+    uint32_t *word = program_word(addr);
+    if (word != NULL) {
+        return *word;
+    }
+    if (addr == device.DEVICE_ID_ADDR) {
+        return device_id;
+    }
+    if (addr == device.DEVICE_ID_ADDR + 2) {
+        return device_revision;
+    }
+    return 0;
+}
+
+int SimulatedTarget::has_executive() {
+    return (read_program(device.APP_ID_ADDR) & 0xffu) == device.APP_ID;
+}
+
+int SimulatedTarget::nvm_busy() {
+    return now < nvm_busy_until;
+}
+
+void SimulatedTarget::start_nvm_operation() {
+    uint16_t &nvmcon = data[device.NVMCON_ADDR >> 1];
+    if (!(nvmcon & NVMCON_WREN)) {
+        violation("WR set in NVMCON without WREN");
+        nvmcon &= ~NVMCON_WR;
+        return;
+    }
+
+    nvm_count++;
+    uint64_t duration = 0;
+    switch (nvmcon & NVMCON_OP) {
+        case 0x4f:
+            // The executive memory is not affected by a chip erase
+            Logger::trace("SIM", "Erasing chip");
+            flash.assign(flash.size(), ERASED);
+            duration = device.CHIP_ERASE_TIME * 1000ull;
+            break;
+        case 0x42: {
+            uint32_t page = latch_addr - latch_addr % (2 * device.PAGE_SIZE);
+            Logger::trace("SIM", "Erasing page at 0x%06x", page);
+            for (uint32_t i = 0; i < device.PAGE_SIZE; i++) {
+                uint32_t *word = program_word(page + 2 * i);
+                if (word != NULL) {
+                    *word = ERASED;
+                }
+            }
+            duration = device.PAGE_ERASE_TIME * 1000ull;
+            break;
+        }
+        case 0x01: {
+            uint32_t row = latch_addr - latch_addr % (2 * device.ROW_SIZE);
+            Logger::trace("SIM", "Writing row at 0x%06x", row);
+            if (program_word(row) == NULL) {
+                violation("Row write outside of the program memory: 0x%06x", row);
+            }
+            for (uint32_t i = 0; i < device.ROW_SIZE; i++) {
+                uint32_t *word = program_word(row + 2 * i);
+                if (word != NULL) {
+                    // Programming can only clear bits - everything else requires an erase
+                    *word &= latches[i];
+                }
+            }
+            duration = device.ROW_WRITE_TIME * 1000ull;
+            break;
+        }
+        case 0x03: {
+            Logger::trace("SIM", "Writing word at 0x%06x", latch_addr);
+            uint32_t *word = program_word(latch_addr);
+            if (word != NULL) {
+                *word &= latches[(latch_addr >> 1) % latches.size()];
+            } else {
+                violation("Word write outside of the program memory: 0x%06x", latch_addr);
+            }
+            duration = device.WORD_WRITE_TIME * 1000ull;
+            break;
+        }
+        default:
+            violation("Unsupported NVM operation: 0x%04x", nvmcon);
+            nvmcon &= ~NVMCON_WR;
+            return;
+    }
+
+    latches.assign(latches.size(), ERASED);
+    nvm_busy_until = now + duration;
+}
+
+uint16_t SimulatedTarget::pe_crc(uint32_t addr, uint32_t count) {
+    // CRC-16/CCITT over the three bytes of each instruction (LSB first)
+    uint16_t crc = 0xffff;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t word = read_program(addr + 2 * i);
+        for (int byte = 0; byte < 3; byte++) {
+            crc ^= (uint16_t) (((word >> (8 * byte)) & 0xffu) << 8);
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (uint16_t) (crc & 0x8000u ? (crc << 1) ^ 0x1021u : crc << 1);
+            }
+        }
+    }
+    return crc;
+}
+
+void SimulatedTarget::execute_pe_command() {
+    pe_count++;
+    const std::vector<uint16_t> &cmd = pe_command;
+    uint8_t opcode = (uint8_t) (cmd[0] >> 12);
+    uint16_t status = 0x1;
+    uint8_t qe = 0;
+    uint64_t duration = PE_COMMAND_TIME;
+    std::vector<uint16_t> data;
+
+    // Contains the expected length of each command (0 for unsupported ones)
+    static const uint16_t LENGTHS[16] = {1, 0, 4, 0, 0, 99, 0, 0, 0, 0, 5, 1, 5, 4, 0, 0};
+    if (LENGTHS[opcode] == 0 || cmd.size() != LENGTHS[opcode]) {
+        violation("Unsupported command of the programming executive: 0x%04x", cmd[0]);
+        status = 0x3;
+    } else if (opcode == 0x0) {
+        // SCHECK
+    } else if (opcode == 0xb) {
+        // QVER
+        qe = PE_VERSION;
+    } else if (opcode == 0x2) {
+        // READP: number of instructions, address - answered in packed format
+        uint32_t count = cmd[1];
+        uint32_t addr = ((uint32_t) (cmd[2] & 0xffu) << 16) | cmd[3];
+        for (uint32_t i = 0; i < count; i += 2) {
+            uint32_t first = read_program(addr + 2 * i);
+            if (i + 1 == count) {
+                data.push_back((uint16_t) (first & 0xffffu));
+                data.push_back((uint16_t) ((first >> 16) & 0xffu));
+                break;
+            }
+            uint32_t second = read_program(addr + 2 * i + 2);
+            data.push_back((uint16_t) (first & 0xffffu));
+            data.push_back((uint16_t) (((second >> 8) & 0xff00u) | ((first >> 16) & 0xffu)));
+            data.push_back((uint16_t) (second & 0xffffu));
+        }
+        duration += count * PE_INSTRUCTION_TIME;
+    } else if (opcode == 0x5 || opcode == 0xd) {
+        // PROGP (a row in packed format) or PROGW (a single instruction)
+        uint32_t addr;
+        std::vector<uint32_t> words;
+        if (opcode == 0x5) {
+            addr = ((uint32_t) (cmd[1] & 0xffu) << 16) | cmd[2];
+            for (uint32_t i = 3; i + 2 < cmd.size(); i += 3) {
+                words.push_back(((uint32_t) (cmd[i + 1] & 0xffu) << 16) | cmd[i]);
+                words.push_back(((uint32_t) (cmd[i + 1] & 0xff00u) << 8) | cmd[i + 2]);
+            }
+            if (addr % (2 * device.ROW_SIZE) != 0) {
+                violation("PROGP at 0x%06x which is not the start of a row", addr);
+            }
+            duration += device.ROW_WRITE_TIME * 1000ull;
+        } else {
+            addr = ((uint32_t) (cmd[1] & 0xffu) << 16) | cmd[2];
+            words.push_back(((uint32_t) (cmd[1] & 0xff00u) << 8) | cmd[3]);
+            duration += device.WORD_WRITE_TIME * 1000ull;
+        }
+        nvm_count++;
+        for (size_t i = 0; i < words.size(); i++) {
+            uint32_t target = addr + 2 * (uint32_t) i;
+            if ((target >> 1) < flash.size()) {
+                flash[target >> 1] &= words[i];
+            } else {
+                violation("Programming executive writes outside of the program memory: 0x%06x", target);
+                status = 0x2;
+                break;
+            }
+        }
+    } else if (opcode == 0xa) {
+        // QBLANK: size, address
+        uint32_t count = ((uint32_t) cmd[1] << 16) | cmd[2];
+        uint32_t addr = ((uint32_t) (cmd[3] & 0xffu) << 16) | cmd[4];
+        qe = 0xf0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (read_program(addr + 2 * i) != ERASED) {
+                qe = 0x0f;
+                break;
+            }
+        }
+        duration += count * PE_INSTRUCTION_TIME;
+    } else if (opcode == 0xc) {
+        // CRCP: address, size
+        uint32_t addr = ((uint32_t) (cmd[1] & 0xffu) << 16) | cmd[2];
+        uint32_t count = ((uint32_t) cmd[3] << 16) | cmd[4];
+        data.push_back(pe_crc(addr, count));
+        duration += count * PE_INSTRUCTION_TIME;
+    }
+
+    pe_response.clear();
+    pe_response.push_back((uint16_t) ((status << 12) | (opcode << 8) | qe));
+    pe_response.push_back((uint16_t) (2 + data.size()));
+    pe_response.insert(pe_response.end(), data.begin(), data.end());
+    pe_index = 0;
+    bit_count = 0;
+    pe_ready = now + duration;
+    state = PE_RESPONSE;
+}
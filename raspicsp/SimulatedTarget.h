@@ -0,0 +1,218 @@
+//
+// Contains a software model of a PIC24 device as seen through its ICSP port.
+//
+
+#ifndef RASPICSP_SIMULATEDTARGET_H
+#define RASPICSP_SIMULATEDTARGET_H
+
+#include <stdint.h>
+#include <vector>
+#include "devices.h"
+
+/*
+ * Simulates a PIC24 device on the pin level.
+ *
+ * The model decodes the ICSP entry code, the SIX and REGOUT control codes and executes the subset
+ * of the PIC24 instruction set which is used by the programmer (MOV (LDI, STO, RET), BSET, GOTO and
+ * the table read and write instructions). It also models TBLPAG, NVMCON, VISI, the write latches and
+ * the flash memory itself, including the time it takes to erase or write it.
+ *
+ * When entered in enhanced ICSP mode, a programming executive is simulated on command level (if the
+ * executive memory contains one). It supports SCHECK, QVER, READP, PROGP, PROGW, QBLANK and CRCP.
+ *
+ * Everything which would confuse or damage a real device (unknown instructions, missing NOPs after
+ * two-cycle instructions, accessing the flash while it is busy...) is reported as violation.
+ */
+class SimulatedTarget {
+private:
+
+    /*
+     * Contains the states of the ICSP interface
+     */
+    enum STATE {
+        RESET, RUNNING, CONTROL, SIX, REGOUT_IDLE, REGOUT_DATA, PE_COMMAND, PE_RESPONSE
+    };
+
+    /*
+     * Contains the size of the data memory (SFRs and RAM) in bytes
+     */
+    static const uint32_t DATA_MEMORY_SIZE = 0x4000;
+
+    /*
+     * Contains the erased state of a program memory word
+     */
+    static const uint32_t ERASED = 0xffffffu;
+
+    /*
+     * Contains the bits of NVMCON
+     */
+    static const uint16_t NVMCON_WR = 0x8000;
+    static const uint16_t NVMCON_WREN = 0x4000;
+    static const uint16_t NVMCON_OP = 0x004f;
+
+    /*
+     * Contains the time (in ns) the programming executive needs to process a command and the
+     * additional time per instruction read or checked
+     */
+    static const uint64_t PE_COMMAND_TIME = 5000;
+    static const uint64_t PE_INSTRUCTION_TIME = 250;
+
+    /*
+     * Contains the version reported by the simulated programming executive
+     */
+    static const uint16_t PE_VERSION = 0x26;
+
+    const DEVICE &device;
+    uint16_t device_id;
+    uint16_t device_revision;
+
+    STATE state;
+    uint32_t shift_register;
+    uint8_t bit_count;
+    uint8_t control_length;
+    uint16_t regout;
+    uint64_t now;
+
+    uint16_t data[DATA_MEMORY_SIZE / 2];
+    std::vector<uint32_t> flash;
+    std::vector<uint32_t> executive;
+    std::vector<uint32_t> latches;
+    uint32_t latch_addr;
+    uint64_t nvm_busy_until;
+
+    uint32_t pc;
+    int pending_goto;
+    int pending_nops;
+    uint32_t pending_repeat;
+    uint64_t cpu_busy_until;
+
+    /*
+     * Contains the carry flag (SR.C), which is updated by ADD and ADDC
+     */
+    int carry;
+
+    std::vector<uint16_t> pe_command;
+    std::vector<uint16_t> pe_response;
+    size_t pe_index;
+    uint64_t pe_ready;
+
+    /*
+     * Executes the given instruction
+     */
+    void execute(uint32_t op_code);
+
+    /*
+     * Executes the given instruction (which is neither a NOP nor a REPEAT) once
+     */
+    void execute_once(uint32_t op_code);
+
+    /*
+     * Executes a TBLRDL, TBLRDH, TBLWTL or TBLWTH instruction
+     */
+    void execute_table_op(uint32_t op_code);
+
+    /*
+     * Executes an ADD, AND or XOR instruction (Wb, Ws, Wd in word mode)
+     */
+    void execute_alu_op(uint32_t op_code);
+
+    /*
+     * Computes the effective address of an indirect register operand while applying
+     * pre- or post-modifications
+     */
+    uint16_t effective_address(uint8_t reg, uint8_t mode, uint16_t step);
+
+    /*
+     * Reads a word or byte from the data memory
+     */
+    uint16_t read_data(uint16_t addr, int byte_mode);
+
+    /*
+     * Writes a word or byte into the data memory
+     */
+    void write_data(uint16_t addr, uint16_t value, int byte_mode);
+
+    /*
+     * Reads a 24 bit word of the program memory (or one of the device id registers)
+     */
+    uint32_t read_program(uint32_t addr);
+
+    /*
+     * Returns the given word of the flash or executive memory (or NULL if the address is not implemented)
+     */
+    uint32_t *program_word(uint32_t addr);
+
+    /*
+     * Determines if the executive memory contains a programming executive
+     */
+    int has_executive();
+
+    /*
+     * Executes the command received by the programming executive and prepares its response
+     */
+    void execute_pe_command();
+
+    /*
+     * Computes the CRC of the given range of the program memory like the programming executive
+     */
+    uint16_t pe_crc(uint32_t addr, uint32_t count);
+
+    /*
+     * Determines if the flash controller is still busy with a previous operation
+     */
+    int nvm_busy();
+
+    /*
+     * Starts the NVM operation which is selected in NVMCON
+     */
+    void start_nvm_operation();
+
+public:
+
+    /*
+     * Contains some statistics about the simulated session
+     */
+    uint32_t six_count;
+    uint32_t regout_count;
+    uint32_t nvm_count;
+    uint32_t pe_count;
+    uint32_t violations;
+
+    /*
+     * Creates a new device with erased program memory
+     */
+    SimulatedTarget(const DEVICE &device, uint16_t device_id, uint16_t device_revision);
+
+    /*
+     * Applies the given level to MCLR at the given (simulated) time in ns
+     */
+    void set_mclr(int level, uint64_t time);
+
+    /*
+     * Applies one PGC pulse while the host drives the given bit on PGD
+     */
+    void clock_in(int bit, uint64_t time);
+
+    /*
+     * Applies one PGC pulse while the host reads PGD and returns the bit driven by the device
+     */
+    int clock_out(uint64_t time);
+
+    /*
+     * Returns the level of PGD (when it is not clocked)
+     */
+    int sample(uint64_t time);
+
+    /*
+     * Returns the contents of the given address of the program memory
+     */
+    uint32_t peek(uint32_t addr);
+
+    /*
+     * Reports a violation of the programming specification
+     */
+    void violation(const char *format, ...);
+};
+
+
+#endif //RASPICSP_SIMULATEDTARGET_H
@@ -0,0 +1,207 @@
+#include <stddef.h>
+#include <stdexcept>
+#include "SimulatorHAL.h"
+#include "Logger.h"
+
+SimulatorHAL::SimulatorHAL(const DEVICE &device, uint32_t half_period_ns, int targets) :
+        simulated(targets, SimulatedTarget(device, DEVICE_ID, DEVICE_REVISION)), half_period_ns(half_period_ns) {
+    if (targets < 1 || targets > MAX_TARGETS) {
+        throw std::runtime_error("Between 1 and 32 devices can be simulated");
+    }
+    if (targets == 1) {
+        Logger::log("HAL", "Simulating a %s (PGC half period: %d ns)", device.NAME, half_period_ns);
+    } else {
+        Logger::log("HAL", "Simulating %d x %s (PGC half period: %d ns)", targets, device.NAME, half_period_ns);
+    }
+    selected = targets == 32 ? 0xffffffffu : (1u << targets) - 1;
+    now = 0;
+    cycles = 0;
+    reading = 0;
+    gettimeofday(&start, NULL);
+}
+
+void SimulatorHAL::mclr_up() {
+    for (size_t i = 0; i < simulated.size(); i++) {
+        if (selected & (1u << i)) {
+            simulated[i].set_mclr(1, now);
+        }
+    }
+}
+
+void SimulatorHAL::mclr_down() {
+    for (size_t i = 0; i < simulated.size(); i++) {
+        if (selected & (1u << i)) {
+            simulated[i].set_mclr(0, now);
+        }
+    }
+}
+
+void SimulatorHAL::write_mode() {
+    reading = 0;
+}
+
+void SimulatorHAL::read_mode() {
+    reading = 1;
+}
+
+void SimulatorHAL::write_bit(int bit) {
+    shift_out(bit ? 1 : 0, 1, true);
+}
+
+int SimulatorHAL::read_bit() {
+    return shift_in(1, true);
+}
+
+void SimulatorHAL::shift_out(uint32_t value, int nbits, bool lsb_first) {
+    for (size_t target = 0; target < simulated.size(); target++) {
+        if (!(selected & (1u << target))) {
+            continue;
+        }
+        if (reading) {
+            simulated[target].violation("Bits written while PGD is an input");
+        }
+        uint64_t time = now;
+        for (int i = 0; i < nbits; i++) {
+            time += 2 * half_period_ns;
+            simulated[target].clock_in((value >> (lsb_first ? i : nbits - 1 - i)) & 1, time);
+        }
+    }
+    now += 2ull * half_period_ns * nbits;
+    cycles += nbits;
+}
+
+uint32_t SimulatorHAL::shift_in(int nbits, bool lsb_first) {
+    uint32_t values[MAX_TARGETS];
+    shift_in_all(nbits, lsb_first, values);
+    for (size_t target = 0; target < simulated.size(); target++) {
+        if (selected & (1u << target)) {
+            return values[target];
+        }
+    }
+    return 0;
+}
+
+int SimulatorHAL::targets() {
+    return (int) simulated.size();
+}
+
+void SimulatorHAL::select_targets(uint32_t mask) {
+    selected = mask & (simulated.size() == 32 ? 0xffffffffu : (1u << simulated.size()) - 1);
+}
+
+void SimulatorHAL::shift_in_all(int nbits, bool lsb_first, uint32_t *values) {
+    for (size_t target = 0; target < simulated.size(); target++) {
+        if (!(selected & (1u << target))) {
+            continue;
+        }
+        if (!reading) {
+            simulated[target].violation("Bits read while PGD is an output");
+        }
+        uint64_t time = now;
+        uint32_t result = 0;
+        for (int i = 0; i < nbits; i++) {
+            time += 2 * half_period_ns;
+            result |= (uint32_t) simulated[target].clock_out(time) << (lsb_first ? i : nbits - 1 - i);
+        }
+        values[target] = result;
+    }
+    now += 2ull * half_period_ns * nbits;
+    cycles += nbits;
+}
+
+void SimulatorHAL::sample_all(uint32_t *values) {
+    for (size_t target = 0; target < simulated.size(); target++) {
+        if (!(selected & (1u << target))) {
+            continue;
+        }
+        if (!reading) {
+            simulated[target].violation("PGD sampled while it is an output");
+        }
+        values[target] = (uint32_t) simulated[target].sample(now);
+    }
+}
+
+void SimulatorHAL::replay(const uint8_t *steps, size_t count, uint32_t *levels) {
+    int final_reading = reading;
+    uint64_t clocked = 0;
+    size_t reads = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (steps[i] <= CYCLE_READ) {
+            clocked++;
+        } else {
+            final_reading = steps[i] == CYCLE_READ_MODE;
+        }
+        if (steps[i] == CYCLE_READ) {
+            levels[reads++] = 0;
+        }
+    }
+
+    // As the devices are independent of each other, each one is run through the whole sequence at once
+    for (size_t target = 0; target < simulated.size(); target++) {
+        if (!(selected & (1u << target))) {
+            continue;
+        }
+        SimulatedTarget &device = simulated[target];
+        uint32_t *level = levels;
+        int input = reading;
+        uint64_t time = now;
+        for (size_t i = 0; i < count; i++) {
+            uint8_t step = steps[i];
+            if (step <= CYCLE_HIGH) {
+                if (input) {
+                    device.violation("Bits written while PGD is an input");
+                }
+                time += 2 * half_period_ns;
+                device.clock_in(step, time);
+            } else if (step == CYCLE_READ) {
+                if (!input) {
+                    device.violation("Bits read while PGD is an output");
+                }
+                time += 2 * half_period_ns;
+                *level++ |= (uint32_t) device.clock_out(time) << target;
+            } else {
+                input = step == CYCLE_READ_MODE;
+            }
+        }
+    }
+
+    reading = final_reading;
+    now += clocked * 2 * half_period_ns;
+    cycles += clocked;
+}
+
+void SimulatorHAL::delay(unsigned int micros) {
+    now += micros * 1000ull;
+}
+
+SimulatedTarget &SimulatorHAL::get_target(int index) {
+    return simulated[index];
+}
+
+uint32_t SimulatorHAL::violations() {
+    uint32_t result = 0;
+    for (size_t i = 0; i < simulated.size(); i++) {
+        result += simulated[i].violations;
+    }
+    return result;
+}
+
+void SimulatorHAL::report() {
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    Logger::log("SIM", "%llu PGC cycles in %.3f s (%.1f M cycles/s), simulated time: %.3f s",
+                (unsigned long long) cycles, elapsed, elapsed > 0 ? cycles / elapsed / 1e6 : 0.0, now / 1e9);
+    for (size_t i = 0; i < simulated.size(); i++) {
+        SimulatedTarget &target = simulated[i];
+        if (simulated.size() == 1) {
+            Logger::log("SIM", "%u SIX, %u REGOUT, %u PE commands, %u NVM operations, %u violations",
+                        target.six_count, target.regout_count, target.pe_count, target.nvm_count, target.violations);
+        } else {
+            Logger::log("SIM", "Device %d: %u SIX, %u REGOUT, %u PE commands, %u NVM operations, %u violations",
+                        (int) i, target.six_count, target.regout_count, target.pe_count, target.nvm_count,
+                        target.violations);
+        }
+    }
+}
@@ -0,0 +1,89 @@
+//
+// Defines the HAL backend which drives a simulated device instead of real hardware.
+//
+
+#ifndef RASPICSP_SIMULATORHAL_H
+#define RASPICSP_SIMULATORHAL_H
+
+#include <sys/time.h>
+#include <vector>
+#include "HAL.h"
+#include "SimulatedTarget.h"
+
+/*
+ * Connects the programmer to one or more SimulatedTargets (which are all driven by the same lines
+ * but answer individually - just like a gang of real devices).
+ *
+ * No real time passes: every PGC cycle advances a simulated clock by the configured period, as
+ * does every call to delay. Therefore a complete session runs as fast as the host CPU permits.
+ */
+class SimulatorHAL : public HAL {
+private:
+
+    std::vector<SimulatedTarget> simulated;
+    uint32_t selected;
+    uint32_t half_period_ns;
+    uint64_t now;
+    uint64_t cycles;
+    int reading;
+    struct timeval start;
+
+public:
+
+    /*
+     * Contains the device id and revision reported by the simulated device
+     */
+    static const uint16_t DEVICE_ID = 0x4207;
+    static const uint16_t DEVICE_REVISION = 0x3003;
+
+    /*
+     * Creates a new simulator for the given number of devices which runs PGC with the given half period
+     */
+    SimulatorHAL(const DEVICE &device, uint32_t half_period_ns = 1000, int targets = 1);
+
+    virtual void mclr_up();
+
+    virtual void mclr_down();
+
+    virtual void write_mode();
+
+    virtual void read_mode();
+
+    virtual void write_bit(int bit);
+
+    virtual int read_bit();
+
+    virtual void shift_out(uint32_t value, int nbits, bool lsb_first);
+
+    virtual uint32_t shift_in(int nbits, bool lsb_first);
+
+    virtual int targets();
+
+    virtual void select_targets(uint32_t mask);
+
+    virtual void shift_in_all(int nbits, bool lsb_first, uint32_t *values);
+
+    virtual void sample_all(uint32_t *values);
+
+    virtual void replay(const uint8_t *steps, size_t count, uint32_t *levels);
+
+    virtual void delay(unsigned int micros);
+
+    /*
+     * Provides access to the simulated device with the given index
+     */
+    SimulatedTarget &get_target(int index = 0);
+
+    /*
+     * Returns the number of violations of all simulated devices
+     */
+    uint32_t violations();
+
+    /*
+     * Logs the statistics of the simulated session
+     */
+    void report();
+};
+
+
+#endif //RASPICSP_SIMULATORHAL_H
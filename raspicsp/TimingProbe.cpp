@@ -0,0 +1,73 @@
+#include <algorithm>
+#include "TimingProbe.h"
+#include "Delay.h"
+
+TimingProbe::TimingProbe() {
+    countdown = HAL_TIMING_STRIDE;
+    edges = 0;
+    first_edge = 0;
+    last_edge = 0;
+    sample_start = 0;
+    nominal_half_period = 0;
+}
+
+void TimingProbe::set_nominal_half_period(uint32_t nanos) {
+    nominal_half_period = nanos;
+}
+
+void TimingProbe::sample() {
+    uint64_t now = Delay::now();
+    if (first_edge == 0) {
+        first_edge = now;
+    }
+    last_edge = now;
+
+    if (countdown == 1) {
+        sample_start = now;
+        return;
+    }
+
+    if (samples.size() < MAX_SAMPLES) {
+        samples.push_back((uint32_t) std::min<uint64_t>(now - sample_start, 0xffffffffu));
+    }
+    countdown = HAL_TIMING_STRIDE;
+}
+
+void TimingProbe::dump_json(FILE *file) {
+    std::vector<uint32_t> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+
+    uint32_t p50 = 0, p99 = 0, min = 0, max = 0;
+    uint64_t outliers = 0;
+    if (!sorted.empty()) {
+        min = sorted.front();
+        max = sorted.back();
+        p50 = sorted[sorted.size() / 2];
+        p99 = sorted[std::min<size_t>(sorted.size() - 1, sorted.size() * 99 / 100)];
+        outliers = sorted.end() - std::upper_bound(sorted.begin(), sorted.end(), (uint32_t) HAL_TIMING_OUTLIER_NS);
+    }
+
+    double elapsed = (double) (last_edge - first_edge);
+    fprintf(file, "{\n");
+    fprintf(file, "  \"edges\": %llu,\n", (unsigned long long) edges);
+    fprintf(file, "  \"samples\": %lu,\n", (unsigned long) sorted.size());
+    fprintf(file, "  \"stride\": %d,\n", HAL_TIMING_STRIDE);
+    fprintf(file, "  \"nominal_half_period_ns\": %u,\n", nominal_half_period);
+    fprintf(file, "  \"elapsed_ns\": %.0f,\n", elapsed);
+    fprintf(file, "  \"effective_frequency_hz\": %.1f,\n", elapsed > 0 ? edges / 2 / elapsed * 1e9 : 0.0);
+    fprintf(file, "  \"clock_frequency_hz\": %.1f,\n", p50 > 0 ? 1e9 / (2.0 * p50) : 0.0);
+    fprintf(file, "  \"half_period_ns\": {\"min\": %u, \"p50\": %u, \"p99\": %u, \"max\": %u},\n", min, p50, p99, max);
+    fprintf(file, "  \"outlier_threshold_ns\": %d,\n", HAL_TIMING_OUTLIER_NS);
+    fprintf(file, "  \"outliers\": %llu,\n", (unsigned long long) outliers);
+
+    // Buckets are powers of two: each one counts the half periods up to (and including) its limit
+    fprintf(file, "  \"histogram\": [");
+    std::vector<uint32_t>::iterator from = sorted.begin();
+    for (uint32_t limit = 64; from != sorted.end(); limit = limit < 0x80000000u ? limit * 2 : 0xffffffffu) {
+        std::vector<uint32_t>::iterator to = std::upper_bound(from, sorted.end(), limit);
+        fprintf(file, "%s{\"le\": %u, \"count\": %lu}", limit == 64 ? "" : ", ", limit, (unsigned long) (to - from));
+        from = to;
+    }
+    fprintf(file, "]\n");
+    fprintf(file, "}\n");
+}
@@ -0,0 +1,89 @@
+//
+// Records the timing of the PGC edges generated by a HAL backend
+//
+
+#ifndef RASPICSP_TIMINGPROBE_H
+#define RASPICSP_TIMINGPROBE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+/*
+ * Defines the number of PGC edges between two samples. This should be odd, so that high and low
+ * phases of PGC are sampled alternately.
+ */
+#ifndef HAL_TIMING_STRIDE
+#define HAL_TIMING_STRIDE 17
+#endif
+
+/*
+ * Defines the duration (in ns) above which a half period is counted as outlier
+ */
+#ifndef HAL_TIMING_OUTLIER_NS
+#define HAL_TIMING_OUTLIER_NS 10000
+#endif
+
+/*
+ * Marks a PGC edge. Only generates code if the build is instrumented (HAL_TIMING is defined).
+ */
+#ifdef HAL_TIMING
+#define TIMING_EDGE(probe) (probe).edge()
+#else
+#define TIMING_EDGE(probe)
+#endif
+
+/*
+ * Samples the time between two consecutive PGC edges (a half period) every HAL_TIMING_STRIDE edges.
+ *
+ * This is only part of the HAL if the build is instrumented, so that a regular build does not pay
+ * for it in any way.
+ */
+class TimingProbe {
+private:
+
+    /*
+     * Contains the maximal number of samples kept in memory
+     */
+    static const uint32_t MAX_SAMPLES = 1 << 20;
+
+    uint32_t countdown;
+    uint64_t edges;
+    uint64_t first_edge;
+    uint64_t last_edge;
+    uint64_t sample_start;
+    uint32_t nominal_half_period;
+    std::vector<uint32_t> samples;
+
+    /*
+     * Takes the timestamp of the current edge
+     */
+    void sample();
+
+public:
+
+    TimingProbe();
+
+    /*
+     * Records the configured half period of the backend (in ns)
+     */
+    void set_nominal_half_period(uint32_t nanos);
+
+    /*
+     * Marks a PGC edge
+     */
+    inline void edge() {
+        edges++;
+        if (--countdown <= 1) {
+            sample();
+        }
+    }
+
+    /*
+     * Writes the statistics as JSON object into the given file
+     */
+    void dump_json(FILE *file);
+};
+
+
+#endif //RASPICSP_TIMINGPROBE_H
@@ -0,0 +1,59 @@
+#include "Transaction.h"
+#include "HAL.h"
+
+const uint32_t Transaction::VISI_STEP;
+
+Transaction::Transaction() {
+    reads = 0;
+    targets = 0;
+}
+
+void Transaction::append(uint32_t value, int nbits) {
+    for (int i = 0; i < nbits; i++) {
+        cycles.push_back((uint8_t) ((value >> i) & 1 ? CYCLE_HIGH : CYCLE_LOW));
+    }
+}
+
+int Transaction::six(uint32_t op_code) {
+    steps.push_back(op_code & 0xffffffu);
+    offsets.push_back(cycles.size());
+
+    // Control code 0000 followed by the 24 bit op code
+    append((op_code & 0xffffffu) << CONTROL_CYCLES, CONTROL_CYCLES + 24);
+
+    return (int) steps.size() - 1;
+}
+
+int Transaction::visi() {
+    steps.push_back(VISI_STEP);
+    offsets.push_back(cycles.size());
+
+    // Control code 0001 followed by 8 idle cycles
+    append(0x001, CONTROL_CYCLES + 8);
+    cycles.push_back(CYCLE_READ_MODE);
+    for (int i = 0; i < 16; i++) {
+        cycles.push_back(CYCLE_READ);
+    }
+    cycles.push_back(CYCLE_WRITE_MODE);
+
+    levels.resize(levels.size() + 16);
+    return reads++;
+}
+
+void Transaction::patch(int step, uint32_t op_code) {
+    op_code &= 0xffffffu;
+    steps[step] = op_code;
+    uint8_t *cycle = &cycles[offsets[step] + CONTROL_CYCLES];
+    for (int i = 0; i < 24; i++) {
+        cycle[i] = (uint8_t) ((op_code >> i) & 1 ? CYCLE_HIGH : CYCLE_LOW);
+    }
+}
+
+Transaction &Transaction::operator<<(uint32_t op_code) {
+    six(op_code);
+    return *this;
+}
+
+uint16_t Transaction::result(int read, int target) {
+    return values[read * targets + target];
+}
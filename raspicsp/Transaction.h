@@ -0,0 +1,95 @@
+//
+// Contains a precompiled sequence of ICSP commands
+//
+
+#ifndef RASPICSP_TRANSACTION_H
+#define RASPICSP_TRANSACTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Records a sequence of SIX commands and VISI reads, which is compiled into a flat array of PGC cycles
+ * (see HAL::replay) while being recorded.
+ *
+ * A transaction is executed by ICSP::execute. As fixed sequences (like polling NVMCON) only differ in
+ * some operands, these can be patched before executing the transaction again instead of encoding all
+ * commands over and over again.
+ */
+class Transaction {
+private:
+
+    /*
+     * Marks a VISI read in the list of steps (op codes only have 24 bits)
+     */
+    static const uint32_t VISI_STEP = 0xffffffffu;
+
+    /*
+     * Contains the number of cycles used by the control code of a SIX or REGOUT command
+     */
+    static const int CONTROL_CYCLES = 4;
+
+    /*
+     * Contains the op code (or VISI_STEP) of each step and the index of its first cycle
+     */
+    std::vector<uint32_t> steps;
+    std::vector<size_t> offsets;
+
+    std::vector<uint8_t> cycles;
+    std::vector<uint32_t> levels;
+    std::vector<uint16_t> values;
+    int reads;
+    int targets;
+
+    /*
+     * Appends nbits of the given value (starting with the LSB) as cycles
+     */
+    void append(uint32_t value, int nbits);
+
+    friend class ICSP;
+
+public:
+
+    Transaction();
+
+    /*
+     * Appends a SIX command and returns the index of the step, which can be used to patch it
+     */
+    int six(uint32_t op_code);
+
+    /*
+     * Appends a read of the VISI register and returns its index, which can be used to fetch the result
+     */
+    int visi();
+
+    /*
+     * Replaces the op code of the SIX command with the given index
+     */
+    void patch(int step, uint32_t op_code);
+
+    /*
+     * Fancy way of appending a SIX command
+     */
+    Transaction &operator<<(uint32_t op_code);
+
+    /*
+     * Appends all SIX commands of the given sequence
+     */
+    template<size_t N>
+    Transaction &operator<<(const uint32_t (&op_codes)[N]) {
+        for (size_t i = 0; i < N; i++) {
+            six(op_codes[i]);
+        }
+        return *this;
+    }
+
+    /*
+     * Returns the contents of the VISI register captured by the given read for the given target
+     * during the last execution
+     */
+    uint16_t result(int read, int target = 0);
+};
+
+
+#endif //RASPICSP_TRANSACTION_H
@@ -61,7 +61,7 @@ typedef struct {
     uint32_t NVMCON_ERASE_ALL;
 
     /*
-     * Contains the bit-pattern written to NVMCON to write a row of data
+     * Contains the bit-pattern written to NVMCON to write a row of data (ROW_SIZE instructions)
      */
     uint32_t NVMCON_WRITE_ROW;
 
@@ -85,6 +85,61 @@ typedef struct {
      * Contains the number of config words
      */
     uint8_t NO_CONFIG_WORDS;
+
+    /*
+     * Contains the bit-pattern written to NVMCON to erase a page (PAGE_SIZE instructions)
+     */
+    uint32_t NVMCON_ERASE_PAGE;
+
+    /*
+     * Contains the typical duration (in microseconds) of a chip erase, a page erase, a row write
+     * and a word write. The programmer waits this long before it starts polling NVMCON.
+     */
+    uint32_t CHIP_ERASE_TIME;
+    uint32_t PAGE_ERASE_TIME;
+    uint32_t ROW_WRITE_TIME;
+    uint32_t WORD_WRITE_TIME;
+
+    /*
+     * Describes the code-sequence required to enter enhanced ICSP mode (which runs the programming executive)
+     */
+    uint32_t EICSP_CODE;
+
+    /*
+     * Contains the address and the size (in address units) of the executive memory which holds the
+     * programming executive
+     */
+    uint32_t EXECUTIVE_ADDR;
+    uint32_t EXECUTIVE_SIZE;
+
+    /*
+     * Contains the address of the application id and the value it contains if a programming executive
+     * is present
+     */
+    uint32_t APP_ID_ADDR;
+    uint32_t APP_ID;
+
+    /*
+     * Contains the start of the RAM, which is used as buffer by routines executed via ICSP
+     */
+    uint32_t RAM_ADDR;
+
+    /*
+     * Contains the duration (in ns) of an instruction cycle while the device is in ICSP mode
+     */
+    uint32_t INSTRUCTION_CYCLE_TIME;
+
+    /*
+     * Contains the number of instructions written at once (a row) and erased at once (a page). Both are
+     * powers of two, a row contains at least 4 instructions.
+     */
+    uint32_t ROW_SIZE;
+    uint32_t PAGE_SIZE;
+
+    /*
+     * Contains the number of write latches, which hold the instructions of a row until it is written
+     */
+    uint32_t WRITE_LATCHES;
 } DEVICE;
 
 /*
@@ -104,7 +159,22 @@ static const DEVICE PIC24FJ32GB0XX = {
         0x4003,
         0x8000,
         0x0057F8,
-        4
+        4,
+        0x4042,
+        40000,
+        20000,
+        1600,
+        20,
+        0x4D434850,
+        0x800000,
+        0x800,
+        0x8007F0,
+        0xBB,
+        0x800,
+        250,
+        64,
+        512,
+        64
 };
 
 /*
@@ -124,7 +194,22 @@ static const DEVICE PIC24FJ64GB0XX = {
         0x4003,
         0x8000,
         0x00ABF8,
-        4
+        4,
+        0x4042,
+        40000,
+        20000,
+        1600,
+        20,
+        0x4D434850,
+        0x800000,
+        0x800,
+        0x8007F0,
+        0xBB,
+        0x800,
+        250,
+        64,
+        512,
+        64
 };
 
 /*
@@ -137,5 +222,24 @@ static const DEVICE DEVICES[] = {PIC24FJ32GB0XX, PIC24FJ64GB0XX};
  */
 static const int NUM_DEVICES = 2;
 
+/*
+ * Assigns a device ID (as read from DEVICE_ID_ADDR) to a device
+ */
+typedef struct {
+    uint16_t ID;
+    const DEVICE *TYPE;
+} DEVICE_ID;
+
+/*
+ * Contains the IDs of the parts of the devices above (the ..002 and ..004 variants)
+ */
+static const DEVICE_ID DEVICE_IDS[] = {{0x4203, &PIC24FJ32GB0XX}, {0x420B, &PIC24FJ32GB0XX},
+                                       {0x4207, &PIC24FJ64GB0XX}, {0x420F, &PIC24FJ64GB0XX}};
+
+/*
+ * Contains the number of entries in the DEVICE_IDS array
+ */
+static const int NUM_DEVICE_IDS = 4;
+
 
 #endif //RASPICSP_DEVICES_H
\ No newline at end of file
@@ -1,71 +1,1110 @@
+#include <algorithm>
+#include <list>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
-#include "HAL.h"
+#include <stdexcept>
+#include <unistd.h>
+#include "RaspberryHAL.h"
+#include "GPIOChipHAL.h"
+#include "SimulatorHAL.h"
 #include "PIC24.h"
+#include "Capture.h"
+#include "Daemon.h"
+#include "DeviceDatabase.h"
+#include "ElfFile.h"
+#include "HexStream.h"
+#include "HexWriter.h"
+#include "ImageCache.h"
 #include "Logger.h"
+#include "RealtimeSession.h"
 
 #define MCRL_PIN 2
 #define PGC_PIN 3
 #define PGD_PIN 4
 
+#ifdef HAL_TIMING
+#define TIMING_FILE "timing.json"
+#endif
+
 using namespace std;
 
-HAL hal(MCRL_PIN, PGD_PIN, PGC_PIN);
+/**
+ * Tries to find a device with the given name
+ */
+int findDevice(const DeviceDatabase &devices, const char *name, DEVICE &dev) {
+    const DEVICE *found = devices.find(name);
+    if (found == NULL) {
+        return 0;
+    }
+    dev = *found;
+    return 1;
+}
+
+void readHexFile(const char *name, MemoryImage &mem) {
+    HexFile file;
+    int result = file.parse(name);
+    if (result < 0) {
+        throw std::runtime_error(std::string("Invalid record in line ") + std::to_string(-result) + " of " + name);
+    }
+    file.compile(mem);
+}
+
+/**
+ * Reads the program memory of an ELF file built by XC16 and logs how much of it is code, constant data and
+ * config words
+ */
+void readElfFile(const char *name, const DEVICE &dev, MemoryImage &mem) {
+    ElfFile file;
+    file.load(name);
+    file.compile(mem);
 
+    std::vector<ElfSection> sections;
+    file.get_sections(sections, dev.CONFIG_WORDS_START_ADDR);
+    uint32_t sizes[3] = {0, 0, 0};
+    for (size_t i = 0; i < sections.size(); i++) {
+        sizes[sections[i].type] += sections[i].size / 2;
+    }
+    Logger::log("main", "%s contains %u instructions of code, %u of constant data and %u config words", name,
+                sizes[ElfSection::CODE], sizes[ElfSection::CONST], sizes[ElfSection::CONFIG]);
+}
 
 /**
- * Tries to find a device with the given name
+ * Reads the firmware for the given device, either from a bundle (see compile), an ELF file or a hex file
+ */
+void readFirmware(const char *name, const DEVICE &dev, Bundle &bundle) {
+    if (strcmp(name, "-") == 0) {
+        HexStream stream(STDIN_FILENO, "<stdin>");
+        std::vector<uint32_t> complete;
+        while (stream.read(complete)) {
+            complete.clear();
+        }
+        bundle.build(stream.get_image(), dev);
+        return;
+    }
+
+    if (Bundle::is_bundle(name)) {
+        bundle.load(name);
+        if (strcmp(bundle.device_name(), dev.NAME) != 0) {
+            throw std::runtime_error(std::string(name) + " was compiled for " + bundle.device_name());
+        }
+        return;
+    }
+
+    MemoryImage mem;
+    if (ElfFile::is_elf(name)) {
+        readElfFile(name, dev, mem);
+    } else {
+        readHexFile(name, mem);
+    }
+    bundle.build(mem, dev);
+}
+
+/**
+ * Contains the settings given on the command line
+ */
+struct Options {
+    int simulate;
+    const char *chip;
+    Delay::SOURCE delay_source;
+    uint32_t half_period_ns;
+    int realtime;
+    int cpu;
+    std::vector<uint8_t> mclr_pins;
+    std::vector<uint8_t> pgd_pins;
+    std::vector<uint8_t> pgc_pins;
+    int enhanced;
+    int update;
+    int retries;
+    const char *device_file;
+    const char *executive;
+    const char *capture;
+    const char *dump_directory;
+};
+
+/**
+ * Parses a comma separated list of GPIO pins
+ */
+int parsePins(const char *list, std::vector<uint8_t> &pins) {
+    pins.clear();
+    while (*list) {
+        char *end;
+        unsigned long pin = strtoul(list, &end, 10);
+        if (end == list || pin > 53 || (*end != ',' && *end != 0)) {
+            return 0;
+        }
+        pins.push_back((uint8_t) pin);
+        list = *end ? end + 1 : end;
+    }
+    return !pins.empty();
+}
+
+void usage() {
+    printf("Usage: raspicsp [options] <device> <hexfile>\n");
+    printf("       raspicsp [options] dump <device> <hexfile>\n");
+    printf("       raspicsp compile <device> <hexfile> <bundle>\n");
+    printf("       raspicsp [options] bench [hexfile|MB]\n");
+    printf("       raspicsp decode <capture>\n");
+    printf("       raspicsp vcd <capture> <vcdfile>\n");
+    printf("       raspicsp [options] replay <capture>\n");
+    printf("       raspicsp [options] daemon <socket>\n");
+    printf("       raspicsp submit <socket> program|verify|dump <device> <file>\n");
+    printf("       raspicsp submit <socket> id <device>\n\n");
+    printf("  -s  Simulate the device instead of using the GPIOs\n");
+    printf("  -g  Use the given GPIO chip (e.g. /dev/gpiochip0) instead of mapping /dev/mem\n");
+    printf("  -t  Enable tracing\n");
+    printf("  -d  Selects the time source used to clock PGC: spin, armtimer, systimer or clock (default)\n");
+    printf("  -p  Sets the half period of PGC in nanoseconds (default: %d)\n", RaspberryHAL::DEFAULT_HALF_PERIOD_NS);
+    printf("  -r  Runs the session in real-time mode pinned to the given CPU (use -1 to not pin the process)\n");
+    printf("  -e  Uses the programming executive (enhanced ICSP) to program and verify the device\n");
+    printf("  -u  Updates a programmed device: only erases and writes the pages which have changed\n");
+    printf("  -i  Verifies each row right after writing it and writes it again up to the given number of times\n");
+    printf("  -D  Loads further devices from the given device file (like devices.conf)\n");
+    printf("  -x  Installs the given programming executive (hex file) if a device doesn't contain one\n");
+    printf("  -G  Programs several devices in parallel, one per given PGD pin (e.g. 4,17,27,22)\n");
+    printf("  -M  Sets the MCLR pin (shared) or a list with one MCLR pin per device (default: %d)\n", MCRL_PIN);
+    printf("  -C  Sets the PGC pin (shared) or a list with one PGC pin per device (default: %d)\n", PGC_PIN);
+    printf("  -w  Records the session into the given capture file\n");
+    printf("  -o  Lets the daemon execute dump jobs, which write into the given directory\n");
+    printf("\ndump reads the program memory and the config words into a hex file (use - for stdout).\n");
+    printf("compile prepares a hex file for the device, the bundle can be given instead of the hex file.\n");
+    printf("Use auto as device to detect it by its device ID.\n");
+    printf("An ELF file built by XC16 can be given instead of a hex file.\n");
+    printf("Use - as hex file to read it from stdin (it is programmed while it is received).\n");
+    printf("bench measures the PGC frequency achieved by each available backend (or how fast a hex or ELF file is read).\n");
+    printf("Given a size in MB instead of a file, bench generates a hex file of that size.\n");
+    printf("decode prints a capture (disassembling all SIX commands), vcd converts it into a value change\n");
+    printf("dump and replay re-sends it to the device(s) and reports where the responses differ.\n");
+    printf("daemon keeps the GPIOs open and executes the jobs sent by submit (using the options given to the daemon).\n");
+    printf("A dump job only gives the name of the file, which is created in the directory given to the daemon by -o.\n");
+}
+
+/**
+ * Creates the HAL backend selected by the given options
+ */
+HAL *createHAL(Options &options, const DEVICE &dev) {
+    if (options.simulate) {
+        return new SimulatorHAL(dev, options.half_period_ns, (int) options.pgd_pins.size());
+    }
+    if (options.chip != NULL) {
+        if (options.pgd_pins.size() > 1 || options.mclr_pins.size() > 1 || options.pgc_pins.size() > 1) {
+            throw std::runtime_error("Programming several devices requires direct GPIO access (without -g)");
+        }
+        return new GPIOChipHAL(options.chip, options.mclr_pins[0], options.pgd_pins[0], options.pgc_pins[0],
+                               options.delay_source, options.half_period_ns);
+    }
+    return new RaspberryHAL(options.mclr_pins, options.pgd_pins, options.pgc_pins, options.delay_source,
+                            options.half_period_ns);
+}
+
+/**
+ * Clocks NOPs for about a second (while the device is held in reset) and returns the achieved
+ * PGC frequency in Hz
  */
-int findDevice(char *name, DEVICE &dev) {
-    for (int i = 0; i < NUM_DEVICES; i++) {
-        if (strcmp(name, DEVICES[i].NAME)) {
-            dev = DEVICES[i];
-            return 1;
+double measureFrequency(HAL &hal) {
+    hal.mclr_down();
+    hal.write_mode();
+
+    uint64_t cycles = 0;
+    uint64_t start = Delay::now();
+    uint64_t elapsed = 0;
+    while (elapsed < 1000000000ull) {
+        for (int i = 0; i < 100; i++) {
+            hal.shift_out(0, 28, true);
         }
+        cycles += 100 * 28;
+        elapsed = Delay::now() - start;
     }
+
+    return cycles * 1e9 / elapsed;
+}
+
+int benchmark(Options &options) {
+    const char *names[] = {"mmap", "gpiochip", "simulator"};
+    for (int i = 0; i < 3; i++) {
+        Options backend = options;
+        backend.simulate = i == 2;
+        backend.chip = i == 1 ? options.chip : NULL;
+        if (i == 1 && options.chip == NULL) {
+            Logger::log("bench", "%-10s skipped (select a chip using -g)", names[i]);
+            continue;
+        }
+
+        try {
+            HAL *hal = createHAL(backend, DEVICES[0]);
+            double frequency = measureFrequency(*hal);
+            delete hal;
+            Logger::log("bench", "%-10s %10.1f kHz (%.0f ns per PGC cycle)", names[i], frequency / 1000,
+                        1e9 / frequency);
+        } catch (std::exception &e) {
+            Logger::log("bench", "%-10s not available: %s", names[i], e.what());
+        }
+    }
+
     return 0;
 }
 
-void readHexFile(const char *name, std::list<MemoryWord> &mem) {
+/**
+ * Measures how fast the given ELF file is loaded into a memory image
+ */
+int benchmarkElfFile(const char *name) {
+    MemoryImage mem;
+    uint64_t runs = 0;
+    uint64_t start = Delay::now();
+    uint64_t elapsed;
+    do {
+        ElfFile file;
+        file.load(name);
+        mem.clear();
+        file.compile(mem);
+        runs++;
+        elapsed = Delay::now() - start;
+    } while (elapsed < 1000000000);
+
+    Logger::log("bench", "%s: %d rows loaded %llu times", name, (int) mem.row_count(), (unsigned long long) runs);
+    Logger::log("bench", "%.1f us per file", elapsed / 1e3 / runs);
+
+    return 0;
+}
+
+/**
+ * Represents one line of a hex file read by parseHexLines
+ */
+struct HexLine {
+    uint32_t addr;
+    uint8_t type;
+    std::vector<uint8_t> data;
+};
+
+/**
+ * Decodes the two hex digits at the given position of a line (throws if there are none)
+ */
+static uint8_t parseHexByte(const std::string &text, size_t position) {
+    std::string digits = text.substr(position, 2);
+    if (digits.size() != 2 || !isxdigit((unsigned char) digits[0]) || !isxdigit((unsigned char) digits[1])) {
+        throw std::invalid_argument(digits);
+    }
+    return (uint8_t) std::stoul(digits, 0, 16);
+}
+
+/**
+ * Parses the given stream like the parser replaced by HexFile::parse did (std::getline, std::substr and std::stoul
+ * per byte, a vector per line and a list node per record), but checks the records like HexFile::parse. It is only
+ * kept as reference for bench. Returns the number of records or a negative number to indicate the first line which
+ * contained invalid data.
+ */
+static int parseHexLines(std::istream &input, std::list<HexLine> &lines) {
+    lines.clear();
+    uint32_t base = 0;
+    int line_number = 0;
+    std::string text;
+    while (std::getline(input, text)) {
+        line_number++;
+        if (!text.empty() && text[text.size() - 1] == '\r') {
+            text.erase(text.size() - 1);
+        }
+        if (text.empty()) {
+            continue;
+        }
+        if (text[0] != ':') {
+            return -line_number;
+        }
+
+        HexLine line;
+        uint8_t sum;
+        try {
+            uint8_t length = parseHexByte(text, 1);
+            uint8_t high = parseHexByte(text, 3);
+            uint8_t low = parseHexByte(text, 5);
+            line.type = parseHexByte(text, 7);
+            line.addr = base + (high << 8 | low);
+            sum = (uint8_t) (length + high + low + line.type);
+            size_t position = 9;
+            for (int i = 0; i < length; i++) {
+                line.data.push_back(parseHexByte(text, position));
+                sum = (uint8_t) (sum + line.data.back());
+                position += 2;
+            }
+            sum = (uint8_t) (sum + parseHexByte(text, position));
+            if (text.size() != position + 2) {
+                return -line_number;
+            }
+        } catch (std::logic_error &) {
+            return -line_number;
+        }
+        if (sum != 0) {
+            return -line_number;
+        }
+        lines.push_back(line);
+
+        size_t length = line.data.size();
+        if (line.type == 1 && length == 0) {
+            break;
+        } else if (line.type == 2 && length == 2) {
+            base = (uint32_t) (line.data[0] << 8 | line.data[1]) << 4;
+        } else if (line.type == 4 && length == 2) {
+            base = (uint32_t) (line.data[0] << 8 | line.data[1]) << 16;
+        } else if (line.type != 0 && (line.type != 5 || length != 4)) {
+            return -line_number;
+        }
+    }
+
+    return (int) lines.size();
+}
+
+/**
+ * Parses the given hex file over and over again for about a second (at least three times), either by HexFile::parse
+ * (which maps the file) or line by line from a stream by parseHexLines, and compiles the result into the given image.
+ * Returns the shortest time per file in ns (the one least disturbed by other processes).
+ */
+double timeHexParser(const char *name, int lines, MemoryImage &image, int &records) {
     HexFile file;
-    std::fstream in;
-    in.open(name, std::fstream::in);
-    file.parse(in);
-    file.compileTo16BitWords(mem);
+    std::list<HexLine> parsed;
+    uint64_t best = UINT64_MAX;
+    uint64_t runs = 0;
+    uint64_t start = Delay::now();
+    uint64_t end;
+    do {
+        uint64_t begin = Delay::now();
+        if (lines) {
+            std::ifstream in(name, std::ifstream::binary);
+            records = parseHexLines(in, parsed);
+        } else {
+            records = file.parse(name);
+        }
+        end = Delay::now();
+        if (records < 0) {
+            throw std::runtime_error(std::string("Invalid record in line ") + std::to_string(-records) + " of " + name);
+        }
+        best = std::min(best, end - begin);
+        runs++;
+    } while (end - start < 1000000000 || runs < 3);
+
+    image.clear();
+    if (lines) {
+        std::list<HexLine>::const_iterator iterator;
+        for (iterator = parsed.begin(); iterator != parsed.end(); ++iterator) {
+            if (iterator->type == 0) {
+                image.set_bytes(iterator->addr >> 1, iterator->data.data(), (uint32_t) iterator->data.size());
+            }
+        }
+    } else {
+        file.compile(image);
+    }
+    return (double) best;
+}
+
+/**
+ * Measures how fast the given hex file is parsed by the mapping parser and by the line based parser it replaced.
+ * Returns how many times as fast the mapping parser is.
+ */
+double benchmarkHexFile(const char *name) {
+    MemoryImage mapped_image, lines_image;
+    int records = 0;
+    double mapped_time = timeHexParser(name, 0, mapped_image, records);
+    double lines_time = timeHexParser(name, 1, lines_image, records);
+
+    // Both parsers have to produce the same image
+    std::vector<uint32_t> rows, other_rows;
+    mapped_image.get_rows(rows);
+    lines_image.get_rows(other_rows);
+    int same = rows == other_rows;
+    for (size_t i = 0; i < rows.size() && same; i++) {
+        same = std::equal(mapped_image.get_row(rows[i]), mapped_image.get_row(rows[i]) + MemoryImage::ROW_SIZE,
+                          lines_image.get_row(rows[i]));
+    }
+    if (!same) {
+        throw std::runtime_error(std::string("The parsers read different images from ") + name);
+    }
+
+    std::ifstream in(name, std::ifstream::binary | std::ifstream::ate);
+    double size = (double) in.tellg();
+    Logger::log("bench", "%s: %d records, %.0f bytes", name, records, size);
+    Logger::log("bench", "mapped: %.1f MB/s (%.1f us per file)", size * 1e3 / mapped_time, mapped_time / 1e3);
+    Logger::log("bench", "lines:  %.1f MB/s (%.1f us per file)", size * 1e3 / lines_time, lines_time / 1e3);
+    Logger::log("bench", "The mapped parser is %.1f times as fast", lines_time / mapped_time);
+
+    return lines_time / mapped_time;
+}
+
+/**
+ * Writes random instructions into a temporary hex file of about the given size in MB (laid out like the files
+ * built by XC16) and measures how fast it is parsed. Fails if the mapped parser isn't at least TARGET_SPEEDUP
+ * times as fast as the line based parser.
+ */
+int benchmarkGeneratedHexFile(int megabytes) {
+    static const double TARGET_SPEEDUP = 50;
+
+    char name[] = "/tmp/raspicsp-bench-XXXXXX.hex";
+    int fd = mkstemps(name, 4);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create a temporary hex file");
+    }
+    FILE *out = fdopen(fd, "w");
+    HexWriter writer(out);
+    // Each instruction takes 11 characters (four bytes per 16 byte record of 44 characters)
+    uint32_t count = (uint32_t) megabytes * 1024 * 1024 / 11;
+    uint32_t instructions[1024];
+    uint32_t random = 1;
+    for (uint32_t addr = 0; count > 0; addr += 2 * 1024) {
+        uint32_t chunk = std::min(count, (uint32_t) 1024);
+        for (uint32_t i = 0; i < chunk; i++) {
+            random = random * 1103515245 + 12345;
+            instructions[i] = random >> 8;
+        }
+        writer.write(addr, instructions, chunk);
+        count -= chunk;
+    }
+    writer.close();
+    fclose(out);
+
+    double speedup;
+    try {
+        speedup = benchmarkHexFile(name);
+    } catch (...) {
+        unlink(name);
+        throw;
+    }
+    unlink(name);
+    if (speedup < TARGET_SPEEDUP) {
+        Logger::log("bench", "The mapped parser is supposed to be at least %.0f times as fast", TARGET_SPEEDUP);
+        return 3;
+    }
+    return 0;
+}
+
+/**
+ * Reads and logs the IDs of all devices. Returns the number of devices found.
+ */
+int detectDevices(PIC24 &pgm) {
+    pgm.read_device_id();
+    const std::vector<Target> &targets = pgm.get_targets();
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets.size() == 1) {
+            Logger::log("main", "Device ID is: 0x%04x 0x%04x", targets[i].device_id, targets[i].device_revision);
+        } else {
+            Logger::log("main", "Device %d: ID is 0x%04x 0x%04x", (int) i, targets[i].device_id,
+                        targets[i].device_revision);
+        }
+    }
+    if (pgm.active_targets() == 0) {
+        Logger::log("main", "No device found!");
+    }
+    return pgm.active_targets();
+}
+
+/**
+ * Selects the device used to access a device which is to be detected: the simulated one (if it is known)
+ * or the first one
+ */
+void probeDevice(Options &options, const DeviceDatabase &devices, DEVICE &dev) {
+    const DEVICE *probe = options.simulate ? devices.find_by_id(SimulatorHAL::DEVICE_ID) : NULL;
+    dev = probe != NULL ? *probe : devices.get(0);
+}
+
+/**
+ * Detects the type of the connected devices by their device IDs. The device ID is read using the ICSP
+ * sequences of the given device (which are the same for all known devices), on success it is replaced
+ * by the detected one.
+ */
+void detectType(HAL &hal, const DeviceDatabase &devices, DEVICE &dev) {
+    PIC24 pgm(hal, dev, NULL);
+    pgm.read_device_id();
+    const std::vector<Target> &targets = pgm.get_targets();
+    const DEVICE *found = NULL;
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (!targets[i].active) {
+            continue;
+        }
+        const DEVICE *type = devices.find_by_id(targets[i].device_id);
+        if (type == NULL) {
+            char id[8];
+            snprintf(id, sizeof(id), "0x%04x", targets[i].device_id);
+            throw std::runtime_error(std::string("Unknown device ID: ") + id);
+        }
+        if (found != NULL && found != type) {
+            throw std::runtime_error(std::string("Devices of different types cannot be programmed together: ") +
+                                     found->NAME + " and " + type->NAME);
+        }
+        found = type;
+    }
+    if (found == NULL) {
+        throw std::runtime_error("No device found to detect");
+    }
+
+    Logger::log("main", "Detected device: %s", found->NAME);
+    dev = *found;
+}
+
+/**
+ * Writes the program memory of the device into the given hex file (or to stdout if it is "-")
+ */
+int dump(HAL &hal, DEVICE &dev, const char *hexFile, Capture *capture) {
+    PIC24 pgm(hal, dev, capture);
+    if (detectDevices(pgm) == 0) {
+        return 3;
+    }
+
+    FILE *out = strcmp(hexFile, "-") == 0 ? stdout : fopen(hexFile, "w");
+    if (out == NULL) {
+        throw std::runtime_error(std::string("Cannot create ") + hexFile);
+    }
+    try {
+        HexWriter writer(out);
+        pgm.dump(writer);
+        writer.close();
+    } catch (...) {
+        if (out != stdout) {
+            fclose(out);
+        }
+        throw;
+    }
+    if (out != stdout && fclose(out) != 0) {
+        throw std::runtime_error(std::string("Cannot write ") + hexFile);
+    }
+
+    return 0;
+}
+
+/**
+ * Compiles the given hex file into a bundle for the given device
+ */
+int compile(DEVICE &dev, const char *hexFile, const char *bundleFile) {
+    Bundle bundle;
+    readFirmware(hexFile, dev, bundle);
+    bundle.save(bundleFile);
+    Logger::log("main", "%d rows and %d words written to %s (CRC 0x%04x)", (int) bundle.row_count(),
+                (int) bundle.word_count(), bundleFile, bundle.get_crc());
+
+    return 0;
+}
+
+/**
+ * Programs the hex file given on stdin while it is being received: rows are written as soon as all of
+ * their words were given, everything else once the end of the file is reached. The bundle receives the
+ * complete firmware (to verify it).
+ */
+void programStream(PIC24 &pgm, const DEVICE &dev, Bundle &bundle) {
+    HexStream stream(STDIN_FILENO, "<stdin>");
+    uint32_t limit = Bundle::code_limit(dev);
+    std::vector<uint32_t> complete;
+    std::vector<uint32_t> written;
+    int more;
+    do {
+        more = stream.read(complete);
+        for (size_t i = 0; i < complete.size(); i++) {
+            if (complete[i] < limit) {
+                pgm.program_row(complete[i], stream.get_image().get_row(complete[i]));
+                written.push_back(complete[i]);
+            }
+        }
+        complete.clear();
+    } while (more);
+    Logger::log("main", "%d rows programmed while receiving the hex file", (int) written.size());
+
+    bundle.build(stream.get_image(), dev);
+    std::sort(written.begin(), written.end());
+    pgm.program(bundle, written);
+}
+
+/**
+ * Programs the devices with the given firmware and verifies them. Without a firmware, the hex file is
+ * read from stdin while programming.
+ */
+int programDevice(PIC24 &pgm, const DEVICE &dev, Options &options, const Bundle *firmware) {
+    if (options.enhanced && dev.ROW_SIZE != MemoryImage::ROW_SIZE) {
+        throw std::runtime_error("The programming executive only supports devices with rows of 64 instructions");
+    }
+    Bundle received;
+    const Bundle &mem = firmware != NULL ? *firmware : received;
+
+    if (detectDevices(pgm) == 0) {
+        return 3;
+    }
+    const std::vector<Target> &targets = pgm.get_targets();
+
+    if (options.enhanced && !pgm.has_executive()) {
+        if (options.executive == NULL) {
+            throw std::runtime_error("No programming executive present (use -x to install one)");
+        }
+        MemoryImage executive;
+        readHexFile(options.executive, executive);
+        pgm.program_executive(executive);
+    }
+
+    int mismatches;
+    if (options.update) {
+        Logger::log("main", "Updating changed pages...");
+        pgm.program_differential(mem);
+
+        Logger::log("main", "Verifying memory...");
+        mismatches = pgm.verify(mem);
+    } else if (options.enhanced) {
+        Logger::log("main", "Erasing all program memory...");
+        pgm.erase_chip();
+        pgm.enter_enhanced();
+
+        Logger::log("main", "Programming device...");
+        pgm.program_enhanced(mem);
+
+        Logger::log("main", "Verifying memory...");
+        mismatches = pgm.verify_enhanced(mem);
+    } else {
+        Logger::log("main", "Erasing all program memory...");
+        pgm.erase_chip();
+        pgm.blank_check();
+
+        if (options.retries >= 0) {
+            Logger::log("main", "Programming and verifying device...");
+            mismatches = pgm.program_verified(mem, options.retries);
+        } else {
+            Logger::log("main", "Programming device...");
+            if (firmware == NULL) {
+                programStream(pgm, dev, received);
+            } else {
+                pgm.program(mem);
+            }
+
+            Logger::log("main", "Verifying memory...");
+            mismatches = pgm.verify(mem);
+        }
+    }
+    pgm.report_nvm_timing();
+
+    if (targets.size() > 1) {
+        for (size_t i = 0; i < targets.size(); i++) {
+            Logger::log("main", "Device %d: %s", (int) i, targets[i].active ? "OK" : targets[i].failure);
+        }
+        Logger::log("main", "%d of %d devices programmed successfully", pgm.active_targets(), (int) targets.size());
+    }
+
+    if (mismatches > 0 || pgm.active_targets() < (int) targets.size()) {
+        return 3;
+    }
+
+    return 0;
+}
+
+int run(HAL &hal, DEVICE &dev, Options &options, const char *hexFile, Capture *capture) {
+    PIC24 pgm(hal, dev, capture);
+    Bundle mem;
+    // A hex file given on stdin is programmed while it is received (unless the whole file is required)
+    int streaming = strcmp(hexFile, "-") == 0 && !options.update && !options.enhanced && options.retries < 0 &&
+                    dev.ROW_SIZE <= MemoryImage::ROW_SIZE;
+    if (!streaming) {
+        readFirmware(hexFile, dev, mem);
+    }
+
+    return programDevice(pgm, dev, options, streaming ? NULL : &mem);
+}
+
+/**
+ * Verifies the devices against the given firmware without programming them
+ */
+int verifyDevice(PIC24 &pgm, Options &options, const Bundle &firmware) {
+    if (detectDevices(pgm) == 0) {
+        return 3;
+    }
+
+    int mismatches;
+    if (options.enhanced) {
+        if (!pgm.has_executive()) {
+            throw std::runtime_error("No programming executive present (program the device using -x first)");
+        }
+        pgm.enter_enhanced();
+        mismatches = pgm.verify_enhanced(firmware);
+    } else {
+        mismatches = pgm.verify(firmware);
+    }
+
+    return mismatches > 0 || pgm.active_targets() < (int) pgm.get_targets().size() ? 3 : 0;
+}
+
+/**
+ * Executes the commands working on capture files (decode, vcd and replay)
+ */
+int processCapture(Options &options, const DeviceDatabase &devices, const char *command, char **args) {
+    Capture capture(args[0]);
+    DEVICE dev;
+    if (!findDevice(devices, capture.device_name(), dev)) {
+        throw std::runtime_error(std::string("Unknown device in capture: ") + capture.device_name());
+    }
+
+    if (strcmp(command, "decode") == 0) {
+        capture.decode(stdout, dev);
+        return 0;
+    }
+
+    if (strcmp(command, "vcd") == 0) {
+        FILE *out = fopen(args[1], "w");
+        if (out == NULL) {
+            throw std::runtime_error(std::string("Cannot create ") + args[1]);
+        }
+        capture.export_vcd(out);
+        fclose(out);
+        return 0;
+    }
+
+    HAL *hal = createHAL(options, dev);
+    uint64_t differences;
+    try {
+        RealtimeSession session(options.realtime, options.cpu);
+        differences = capture.replay(*hal);
+    } catch (...) {
+        delete hal;
+        throw;
+    }
+    delete hal;
+
+    return differences > 0 ? 3 : 0;
+}
+
+/**
+ * Executes a job received by the daemon. The HAL is kept open between jobs, only a simulator is created
+ * again for a job on another device.
+ */
+int runJob(Options &options, const DeviceDatabase &devices, ImageCache &cache, HAL *&hal, const char *&simulated,
+           const Job &job) {
+    DEVICE dev;
+    int detecting = job.device == "auto";
+    if (detecting) {
+        probeDevice(options, devices, dev);
+    } else if (!findDevice(devices, job.device.c_str(), dev)) {
+        throw std::runtime_error("Unknown device: " + job.device);
+    }
+    if (hal == NULL || (options.simulate && strcmp(simulated, dev.NAME) != 0)) {
+        delete hal;
+        hal = NULL;
+        hal = createHAL(options, dev);
+        simulated = dev.NAME;
+    }
+
+    // The daemon may run with more privileges than the client, so it only dumps into its own directory
+    std::string dumpFile;
+    if (job.command == "dump") {
+        if (options.dump_directory == NULL) {
+            throw std::runtime_error("The daemon doesn't execute dump jobs (use -o to give it a directory)");
+        }
+        if (job.file.empty() || job.file == "." || job.file == ".." || job.file == "-" ||
+            job.file.find('/') != std::string::npos) {
+            throw std::runtime_error("A dump job can only give the name of a file: " + job.file);
+        }
+        dumpFile = std::string(options.dump_directory) + "/" + job.file;
+    }
+    if (detecting) {
+        detectType(*hal, devices, dev);
+    }
+    const Bundle *firmware = NULL;
+    if (job.command == "program" || job.command == "verify") {
+        firmware = &cache.get(job.file.c_str(), dev);
+    }
+
+    if (job.command == "dump") {
+        return dump(*hal, dev, dumpFile.c_str(), NULL);
+    }
+    PIC24 pgm(*hal, dev, NULL);
+    if (job.command == "id") {
+        return detectDevices(pgm) > 0 ? 0 : 3;
+    }
+    if (job.command == "verify") {
+        return verifyDevice(pgm, options, *firmware);
+    }
+    return programDevice(pgm, dev, options, firmware);
+}
+
+/**
+ * Runs the daemon which executes the jobs received via the socket at the given path until it receives
+ * SIGINT or SIGTERM
+ */
+int serve(Options &options, const DeviceDatabase &devices, const char *path) {
+    HAL *hal = NULL;
+    const char *simulated = NULL;
+    // The log of the daemon is most probably written into a file
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    try {
+        // The GPIOs are mapped once, a simulator is created by the first job
+        if (!options.simulate) {
+            hal = createHAL(options, devices.get(0));
+        }
+        ImageCache cache(readFirmware);
+        Daemon daemon(path);
+        // The real-time mode is entered once, each job only reports the latencies it suffered
+        RealtimeSession session(options.realtime, options.cpu);
+        Job job;
+        while (daemon.next(job)) {
+            int result;
+            try {
+                result = runJob(options, devices, cache, hal, simulated, job);
+            } catch (std::exception &e) {
+                Logger::log("main", "Error: %s", e.what());
+                result = 5;
+            }
+            session.report();
+            daemon.finish(job, result);
+        }
+    } catch (std::exception &e) {
+        Logger::log("main", "Error: %s", e.what());
+        delete hal;
+        return 5;
+    }
+    Logger::log("daemon", "Stopped");
+    delete hal;
+    return 0;
+}
+
+/**
+ * Submits a job to the daemon. The file is given with its absolute path, as the daemon may run in another directory
+ * (except for a dump, which the daemon writes into its own directory).
+ */
+int submit(const char *path, int argc, char **argv) {
+    std::vector<std::string> request(argv, argv + argc);
+    if (argc == 3 && strcmp(argv[0], "dump") != 0) {
+        char *absolute = realpath(argv[2], NULL);
+        if (absolute != NULL) {
+            request[2] = absolute;
+            free(absolute);
+        }
+    }
+    return Daemon::submit(path, request);
 }
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        printf("Usage: raspicsp <device> <hexfile>\n");
+    Options options;
+    options.simulate = 0;
+    options.chip = NULL;
+    options.delay_source = Delay::CLOCK;
+    options.half_period_ns = RaspberryHAL::DEFAULT_HALF_PERIOD_NS;
+    options.realtime = 0;
+    options.cpu = -1;
+    options.mclr_pins.push_back(MCRL_PIN);
+    options.pgd_pins.push_back(PGD_PIN);
+    options.pgc_pins.push_back(PGC_PIN);
+    options.enhanced = 0;
+    options.update = 0;
+    options.retries = -1;
+    options.device_file = NULL;
+    options.executive = NULL;
+    options.capture = NULL;
+    options.dump_directory = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "sg:td:p:r:G:M:C:eui:D:x:w:o:")) != -1) {
+        switch (opt) {
+            case 's':
+                options.simulate = 1;
+                break;
+            case 'g':
+                options.chip = optarg;
+                break;
+            case 't':
+                Logger::enable_tracing();
+                break;
+            case 'd':
+                if (!Delay::find_source(optarg, options.delay_source)) {
+                    printf("Unknown time source: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'p':
+                options.half_period_ns = (uint32_t) strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                options.realtime = 1;
+                options.cpu = atoi(optarg);
+                break;
+            case 'e':
+                options.enhanced = 1;
+                break;
+            case 'u':
+                options.update = 1;
+                break;
+            case 'i':
+                options.retries = atoi(optarg);
+                break;
+            case 'D':
+                options.device_file = optarg;
+                break;
+            case 'x':
+                options.executive = optarg;
+                break;
+            case 'w':
+                options.capture = optarg;
+                break;
+            case 'o':
+                options.dump_directory = optarg;
+                break;
+            case 'G':
+            case 'M':
+            case 'C':
+                if (!parsePins(optarg, opt == 'G' ? options.pgd_pins : opt == 'M' ? options.mclr_pins
+                                                                                   : options.pgc_pins)) {
+                    printf("Invalid list of pins: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (options.update && options.enhanced) {
+        printf("The options -u and -e cannot be combined\n");
+        return 1;
+    }
+    if (options.retries >= 0 && (options.update || options.enhanced)) {
+        printf("The option -i cannot be combined with -u or -e\n");
+        return 1;
+    }
+
+    DeviceDatabase devices;
+    try {
+        if (access(DeviceDatabase::DEFAULT_FILE, F_OK) == 0) {
+            devices.load(DeviceDatabase::DEFAULT_FILE);
+        }
+        if (options.device_file != NULL) {
+            devices.load(options.device_file);
+        }
+    } catch (std::exception &e) {
+        Logger::log("main", "Error: %s", e.what());
+        return 5;
+    }
+
+    if (argc - optind == 1 && strcmp(argv[optind], "bench") == 0) {
+        return benchmark(options);
+    }
+
+    if (argc - optind == 2 && strcmp(argv[optind], "bench") == 0) {
+        try {
+            const char *name = argv[optind + 1];
+            if (*name != 0 && strspn(name, "0123456789") == strlen(name)) {
+                return benchmarkGeneratedHexFile(atoi(name));
+            }
+            if (ElfFile::is_elf(name)) {
+                return benchmarkElfFile(name);
+            }
+            benchmarkHexFile(name);
+            return 0;
+        } catch (std::exception &e) {
+            Logger::log("main", "Error: %s", e.what());
+            return 5;
+        }
+    }
+
+    if ((argc - optind == 2 && (strcmp(argv[optind], "decode") == 0 || strcmp(argv[optind], "replay") == 0)) ||
+        (argc - optind == 3 && strcmp(argv[optind], "vcd") == 0)) {
+        try {
+            return processCapture(options, devices, argv[optind], argv + optind + 1);
+        } catch (std::exception &e) {
+            Logger::log("main", "Error: %s", e.what());
+            return 5;
+        }
+    }
+
+    if (argc - optind == 2 && strcmp(argv[optind], "daemon") == 0) {
+        return serve(options, devices, argv[optind + 1]);
+    }
+
+    if ((argc - optind == 4 || argc - optind == 5) && strcmp(argv[optind], "submit") == 0) {
+        try {
+            return submit(argv[optind + 1], argc - optind - 2, argv + optind + 2);
+        } catch (std::exception &e) {
+            Logger::log("main", "Error: %s", e.what());
+            return 5;
+        }
+    }
+
+    if (argc - optind == 4 && strcmp(argv[optind], "compile") == 0) {
+        DEVICE dev;
+        if (!findDevice(devices, argv[optind + 1], dev)) {
+            printf("Unknown device: %s\n", argv[optind + 1]);
+            return 2;
+        }
+        try {
+            return compile(dev, argv[optind + 2], argv[optind + 3]);
+        } catch (std::exception &e) {
+            Logger::log("main", "Error: %s", e.what());
+            return 5;
+        }
+    }
+
+    int dumping = argc - optind == 3 && strcmp(argv[optind], "dump") == 0;
+    if (dumping) {
+        optind++;
+        // Keep stdout clean if it receives the hex file
+        if (strcmp(argv[optind + 1], "-") == 0) {
+            Logger::redirect(stderr);
+        }
+    }
+
+    if (argc - optind != 2) {
+        usage();
         return 1;
     }
 
     DEVICE dev;
-    if (!findDevice(argv[0], dev)) {
-        printf("Unknown device: %s\n\nKnown devices:\n", argv[0]);
-        for (int i = 0; i < NUM_DEVICES; i++) {
-            printf(" * %s\n", DEVICES[i].NAME);
+    int detecting = strcmp(argv[optind], "auto") == 0;
+    if (detecting) {
+        probeDevice(options, devices, dev);
+    } else if (!findDevice(devices, argv[optind], dev)) {
+        printf("Unknown device: %s\n\nKnown devices:\n", argv[optind]);
+        for (size_t i = 0; i < devices.size(); i++) {
+            printf(" * %s\n", devices.get(i).NAME);
         }
         return 2;
     }
 
-    PIC24 pgm(hal, dev);
-    std::list<MemoryWord> mem;
-    readHexFile(argv[1], mem);
-
-    uint16_t lo, hi;
-    pgm.read_device_id(lo, hi);
-    Logger::log("main", "Device ID is: 0x%04x 0x%04x", lo, hi);
+    HAL *hal = NULL;
+    Capture *capture = NULL;
+    int result;
+    try {
+        hal = createHAL(options, dev);
+        if (detecting) {
+            detectType(*hal, devices, dev);
+        }
+        if (options.capture != NULL) {
+            capture = new Capture(dev.NAME, options.half_period_ns, hal->targets());
+        }
+        RealtimeSession session(options.realtime, options.cpu);
+        if (dumping) {
+            result = dump(*hal, dev, argv[optind + 1], capture);
+        } else {
+            result = run(*hal, dev, options, argv[optind + 1], capture);
+        }
+    } catch (std::exception &e) {
+        Logger::log("main", "Error: %s", e.what());
+        result = 5;
+    }
 
-    Logger::log("main", "Erasing all program memory...");
-    pgm.erase_chip();
+    // The capture is written in any case, as it is most useful when something went wrong
+    if (capture != NULL) {
+        try {
+            capture->save(options.capture);
+        } catch (std::exception &e) {
+            Logger::log("main", "Error: %s", e.what());
+        }
+        delete capture;
+    }
 
-    Logger::log("main", "Programming device...");
-    pgm.program(mem);
+#ifdef HAL_TIMING
+    if (hal != NULL) {
+        FILE *file = fopen(TIMING_FILE, "w");
+        if (file != NULL) {
+            hal->timing.dump_json(file);
+            fclose(file);
+            Logger::log("main", "PGC timing statistics written to %s", TIMING_FILE);
+        }
+    }
+#endif
 
-    Logger::log("main", "Verifying memory...");
-    pgm.verify(mem);
+    if (options.simulate && hal != NULL) {
+        SimulatorHAL *simulator = (SimulatorHAL *) hal;
+        simulator->report();
+        if (simulator->violations() > 0 && result == 0) {
+            result = 4;
+        }
+    }
+    delete hal;
 
-    return 0;
-}
\ No newline at end of file
+    return result;
+}
@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# Compiles test.hex into a bundle and programs a simulated device from it. A bundle with a flipped byte in its first
+# row has to be rejected before anything is written.
+#
+# Usage: bundle.sh <raspicsp> <source directory>
+#
+
+RASPICSP=$1
+SOURCE=$2
+DEVICE=PIC24FJ64GB0XX
+
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+fail() {
+    echo "$1"
+    exit 1
+}
+
+"$RASPICSP" compile $DEVICE "$SOURCE/test.hex" "$DIR/test.bdl" || fail "Compiling test.hex failed"
+"$RASPICSP" -s $DEVICE "$DIR/test.bdl" || fail "Programming the bundle failed"
+
+# The rows follow the header (72 bytes) and the bitmap (its size in words is at offset 20), each row starts with its
+# digests (12 bytes) followed by the words
+BITMAP=$(od -A n -t u4 -j 20 -N 4 "$DIR/test.bdl" | tr -d ' ')
+OFFSET=$((72 + 4 * BITMAP + 12 + 5))
+BYTE=$(od -A n -t u1 -j $OFFSET -N 1 "$DIR/test.bdl" | tr -d ' ')
+printf "\\$(printf %o $((BYTE ^ 0x10)))" | dd of="$DIR/test.bdl" bs=1 seek=$OFFSET conv=notrunc 2>/dev/null
+
+"$RASPICSP" -s $DEVICE "$DIR/test.bdl" > "$DIR/damaged.log" 2>&1 && fail "A damaged bundle was programmed"
+grep -q "The row at 0x000000 of .* is damaged" "$DIR/damaged.log" || fail "The damaged row was not reported"
+grep -q "Programming device" "$DIR/damaged.log" && fail "The damaged bundle was not rejected before programming"
+exit 0
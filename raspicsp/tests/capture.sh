@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# Records a session on the simulator, replays it (which has to find no differences) and decodes it. Replayed against
+# a device which answers differently (tests/moved_id.conf moves its device ID), the differences have to be reported.
+#
+# Usage: capture.sh <raspicsp> <source directory>
+#
+
+RASPICSP=$1
+SOURCE=$2
+DEVICE=PIC24FJ64GB0XX
+
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+fail() {
+    echo "$1"
+    exit 1
+}
+
+"$RASPICSP" -s -w "$DIR/session.cap" $DEVICE "$SOURCE/test.hex" || fail "Recording the session failed"
+
+"$RASPICSP" -s replay "$DIR/session.cap" > "$DIR/replay.log" || fail "Replaying the session failed"
+grep -q "Replay finished with 0 difference(s)" "$DIR/replay.log" || fail "The replay found differences"
+
+"$RASPICSP" decode "$DIR/session.cap" > "$DIR/decode.log" || fail "Decoding the session failed"
+grep -q "KEY *0x4d434851" "$DIR/decode.log" || fail "The ICSP entry code was not decoded"
+grep -q "SIX *0x040200  GOTO 0x000200" "$DIR/decode.log" || fail "The SIX commands were not disassembled"
+
+"$RASPICSP" vcd "$DIR/session.cap" "$DIR/session.vcd" || fail "Converting the session failed"
+grep -q "enddefinitions" "$DIR/session.vcd" || fail "The value change dump has no header"
+
+"$RASPICSP" -s -D "$SOURCE/tests/moved_id.conf" replay "$DIR/session.cap" > "$DIR/moved.log"
+[ $? -eq 3 ] || fail "Replaying against another device has to fail"
+grep -q "read 0x0000 instead of 0x4207" "$DIR/moved.log" || fail "The difference was not reported"
+exit 0
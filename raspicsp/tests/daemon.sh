@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# Starts a simulating daemon and submits jobs to it: the result of each job has to be the exit code of submit,
+# invalid requests have to be rejected and a file which is submitted again has to be taken from the cache.
+#
+# Usage: daemon.sh <raspicsp> <source directory>
+#
+
+RASPICSP=$1
+SOURCE=$2
+DEVICE=PIC24FJ64GB0XX
+
+DIR=$(mktemp -d) || exit 1
+trap 'kill $DAEMON 2>/dev/null; rm -rf "$DIR"' EXIT
+
+fail() {
+    echo "$1"
+    exit 1
+}
+
+# Submits a job (the output is kept in $DIR/job.log) and checks its result
+expect() {
+    RESULT=$1
+    shift
+    "$RASPICSP" submit "$DIR/socket" "$@" > "$DIR/job.log" 2>&1
+    CODE=$?
+    cat "$DIR/job.log"
+    [ $CODE -eq $RESULT ] || fail "Job $* returned $CODE instead of $RESULT"
+}
+
+"$RASPICSP" -s -o "$DIR" daemon "$DIR/socket" > "$DIR/daemon.log" 2>&1 &
+DAEMON=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$DIR/socket" ] && break
+    sleep 0.1
+done
+
+expect 0 program $DEVICE "$SOURCE/test.hex"
+grep -q "^queued 1 " "$DIR/job.log" || fail "The job was not queued"
+grep -q "Image of .*test.hex cached" "$DIR/job.log" || fail "The image was not cached"
+expect 0 verify $DEVICE "$SOURCE/test.hex"
+grep -q "Using the cached image of .*test.hex" "$DIR/job.log" || fail "The cached image was not used"
+expect 3 verify $DEVICE "$SOURCE/tests/firmware.hex"
+expect 0 id $DEVICE
+grep -q "Device ID is: 0x4207" "$DIR/job.log" || fail "The device ID was not read"
+
+expect 1 erase $DEVICE "$SOURCE/test.hex"
+grep -q "^error Unknown command" "$DIR/job.log" || fail "An unknown command was not rejected"
+expect 1 program $DEVICE
+grep -q "^error Wrong number of arguments" "$DIR/job.log" || fail "A missing argument was not rejected"
+expect 5 dump $DEVICE ../dump.hex
+grep -q "A dump job can only give the name of a file" "$DIR/job.log" || fail "A dump path was not rejected"
+[ -e "$DIR/../dump.hex" ] && fail "The dump was written outside of the directory"
+
+# The daemon reports the result of each job it executed
+kill $DAEMON
+wait $DAEMON
+for job in "1 finished (result 0)" "2 finished (result 0)" "3 finished (result 3)" "4 finished (result 0)" \
+           "5 finished (result 5)"; do
+    grep -q "Job $job" "$DIR/daemon.log" || fail "Job $job is missing in the log of the daemon"
+done
+exit 0
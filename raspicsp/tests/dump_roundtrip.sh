@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# Programs test.hex through a simulating daemon, dumps the device again and checks that the dump compiles into the
+# same bundle as test.hex.
+#
+# Usage: dump_roundtrip.sh <raspicsp> <source directory>
+#
+
+RASPICSP=$1
+SOURCE=$2
+DEVICE=PIC24FJ64GB0XX
+
+DIR=$(mktemp -d) || exit 1
+trap 'kill $DAEMON 2>/dev/null; rm -rf "$DIR"' EXIT
+
+fail() {
+    echo "$1"
+    exit 1
+}
+
+"$RASPICSP" -s -o "$DIR" daemon "$DIR/socket" &
+DAEMON=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$DIR/socket" ] && break
+    sleep 0.1
+done
+
+"$RASPICSP" submit "$DIR/socket" program $DEVICE "$SOURCE/test.hex" || fail "Programming failed"
+"$RASPICSP" submit "$DIR/socket" dump $DEVICE dump.hex || fail "Dumping failed"
+
+"$RASPICSP" compile $DEVICE "$SOURCE/test.hex" "$DIR/test.bdl" || fail "Compiling test.hex failed"
+"$RASPICSP" compile $DEVICE "$DIR/dump.hex" "$DIR/dump.bdl" || fail "Compiling the dump failed"
+cmp "$DIR/test.bdl" "$DIR/dump.bdl" || fail "The dump differs from test.hex"
@@ -0,0 +1,24 @@
+#!/bin/sh
+#
+# Compiles the ELF file firmware.elf and the hex file converted from it (firmware.hex) into bundles, which have to
+# be identical. The ELF file contains a segment whose physical address differs from its virtual one (in the PSV
+# window) and a writable segment in data memory, which must not be programmed.
+#
+# Usage: elf_bundle.sh <raspicsp> <source directory>
+#
+
+RASPICSP=$1
+SOURCE=$2
+DEVICE=PIC24FJ64GB0XX
+
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+fail() {
+    echo "$1"
+    exit 1
+}
+
+"$RASPICSP" compile $DEVICE "$SOURCE/tests/firmware.elf" "$DIR/elf.bdl" || fail "Compiling the ELF file failed"
+"$RASPICSP" compile $DEVICE "$SOURCE/tests/firmware.hex" "$DIR/hex.bdl" || fail "Compiling the hex file failed"
+cmp "$DIR/elf.bdl" "$DIR/hex.bdl" || fail "The ELF file differs from the hex file"
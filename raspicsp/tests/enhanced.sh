@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# Installs tests/executive.hex on a simulated device and programs and verifies it in enhanced ICSP mode (PROGP, PROGW,
+# CRCP and READP for the config words). Verifying another file has to find the rows whose CRC doesn't match and
+# read them back by READP.
+#
+# Usage: enhanced.sh <raspicsp> <source directory>
+#
+
+RASPICSP=$1
+SOURCE=$2
+DEVICE=PIC24FJ64GB0XX
+
+DIR=$(mktemp -d) || exit 1
+trap 'kill $DAEMON 2>/dev/null; rm -rf "$DIR"' EXIT
+
+fail() {
+    echo "$1"
+    exit 1
+}
+
+"$RASPICSP" -s -e -x "$SOURCE/tests/executive.hex" daemon "$DIR/socket" &
+DAEMON=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$DIR/socket" ] && break
+    sleep 0.1
+done
+
+"$RASPICSP" submit "$DIR/socket" program $DEVICE "$SOURCE/test.hex" > "$DIR/program.log" ||
+    fail "Programming in enhanced ICSP mode failed"
+grep -q "Programming the programming executive" "$DIR/program.log" || fail "The executive was not installed"
+grep -q "Programming executive version" "$DIR/program.log" || fail "Enhanced ICSP mode was not entered"
+"$RASPICSP" submit "$DIR/socket" verify $DEVICE "$SOURCE/test.hex" || fail "Verifying in enhanced ICSP mode failed"
+
+"$RASPICSP" submit "$DIR/socket" verify $DEVICE "$SOURCE/tests/firmware.hex" > "$DIR/verify.log"
+[ $? -eq 3 ] || fail "Verifying another file has to fail"
+grep -q "CRC of the row at 0x[0-9a-f]* does not match" "$DIR/verify.log" || fail "The changed row was not found"
+exit 0
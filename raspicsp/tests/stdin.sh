@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# Programs a simulated device from stdin: test.hex in order and shuffled (tests/shuffled.hex contains the same records
+# in random order). A row which is given again after it was complete (and may have been programmed) has to be rejected.
+#
+# Usage: stdin.sh <raspicsp> <source directory>
+#
+
+RASPICSP=$1
+SOURCE=$2
+DEVICE=PIC24FJ64GB0XX
+
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+fail() {
+    echo "$1"
+    exit 1
+}
+
+"$RASPICSP" -s $DEVICE - < "$SOURCE/test.hex" || fail "Programming test.hex from stdin failed"
+"$RASPICSP" -s $DEVICE - < "$SOURCE/tests/shuffled.hex" || fail "Programming the shuffled records from stdin failed"
+
+# The record of the row at 0x000200 is sent again after the rest of the file was received
+{
+    grep -v ":00000001" "$SOURCE/test.hex"
+    sleep 1
+    echo ":020000040000fa"
+    grep -i "^:10040000" "$SOURCE/test.hex"
+    echo ":00000001FF"
+} | "$RASPICSP" -s $DEVICE - > "$DIR/duplicate.log" 2>&1 && fail "A row given twice was programmed"
+grep -q "The row at 0x000200 is given again in <stdin>" "$DIR/duplicate.log" || fail "The row given twice was not reported"
+exit 0